@@ -0,0 +1,123 @@
+package main
+/**
+ * build a module bundle of all the modules in a `modules` dir, which is mounted by
+ * js_create_env() if it is saved as `mod_path`/modules.bundle.
+ * the layout of a bundle, all integers are uint32 in little endian:
+ *   "DUKBNDL\0" version count
+ *   count entries of { name_off name_len data_off data_len flags }, sorted by name
+ *   names and data
+ */
+
+import (
+	js "github.com/rosbit/duktape-bridge/duk-bridge-go"
+	"encoding/binary"
+	"path/filepath"
+	"io/fs"
+	"sort"
+	"flag"
+	"os"
+	"fmt"
+)
+
+const (
+	bundleMagic   = "DUKBNDL\x00"
+	bundleVersion = 1
+	headSize  = 16
+	entrySize = 20
+
+	flagSource   = 0
+	flagBytecode = 1
+)
+
+type entry struct {
+	name  string
+	data  []byte
+	flags uint32
+}
+
+func collect(modDir string, bytecode bool) ([]entry, error) {
+	var jsEnv *js.JSEnv
+	if bytecode {
+		jsEnv = js.NewEnv(nil)
+		defer jsEnv.Destroy()
+	}
+
+	var entries []entry
+	err := filepath.WalkDir(modDir, func(path string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		if d.IsDir() || filepath.Ext(path) != ".js" {
+			return nil
+		}
+		rel, err := filepath.Rel(modDir, path)
+		if err != nil {
+			return err
+		}
+		src, err := os.ReadFile(path)
+		if err != nil {
+			return err
+		}
+		e := entry{name: filepath.ToSlash(rel), data: src, flags: flagSource}
+		if bytecode {
+			if e.data, err = jsEnv.DumpModule(src, e.name); err != nil {
+				return fmt.Errorf("%s: %v", path, err)
+			}
+			e.flags = flagBytecode
+		}
+		entries = append(entries, e)
+		return nil
+	})
+	sort.Slice(entries, func(i, j int) bool { return entries[i].name < entries[j].name })
+	return entries, err
+}
+
+func build(entries []entry) []byte {
+	size := headSize + entrySize*len(entries)
+	for _, e := range entries {
+		size += len(e.name) + len(e.data)
+	}
+
+	b := make([]byte, size)
+	le := binary.LittleEndian
+	copy(b, bundleMagic)
+	le.PutUint32(b[8:], bundleVersion)
+	le.PutUint32(b[12:], uint32(len(entries)))
+
+	off := headSize + entrySize*len(entries)
+	for i, e := range entries {
+		p := b[headSize+entrySize*i:]
+		le.PutUint32(p, uint32(off))
+		le.PutUint32(p[4:], uint32(len(e.name)))
+		off += copy(b[off:], e.name)
+		le.PutUint32(p[8:], uint32(off))
+		le.PutUint32(p[12:], uint32(len(e.data)))
+		off += copy(b[off:], e.data)
+		le.PutUint32(p[16:], e.flags)
+	}
+	return b
+}
+
+func main() {
+	bytecode := flag.Bool("bytecode", false, "save modules as bytecode instead of source")
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [-bytecode] <modules-dir> <bundle-file>\n", os.Args[0])
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+	if flag.NArg() != 2 {
+		flag.Usage()
+		os.Exit(1)
+	}
+
+	entries, err := collect(flag.Arg(0), *bytecode)
+	if err != nil {
+		fmt.Printf("failed to collect modules: %v\n", err)
+		os.Exit(2)
+	}
+	if err = os.WriteFile(flag.Arg(1), build(entries), 0644); err != nil {
+		fmt.Printf("failed to write %s: %v\n", flag.Arg(1), err)
+		os.Exit(3)
+	}
+	fmt.Printf("%d modules saved to %s\n", len(entries), flag.Arg(1))
+}
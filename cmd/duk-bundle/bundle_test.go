@@ -0,0 +1,106 @@
+package main
+
+import (
+	js "github.com/rosbit/duktape-bridge/duk-bridge-go"
+	"path/filepath"
+	"testing"
+	"os"
+)
+
+func writeBundle(t *testing.T, modDir, bundleFile string, bytecode bool) {
+	entries, err := collect(modDir, bytecode)
+	if err != nil {
+		t.Fatalf("failed to collect modules: %v\n", err)
+	}
+	// replaced by rename, as a bundle being mapped must not be rewritten in place.
+	tmp := bundleFile + ".tmp"
+	if err = os.WriteFile(tmp, build(entries), 0644); err != nil {
+		t.Fatalf("failed to write bundle: %v\n", err)
+	}
+	if err = os.Rename(tmp, bundleFile); err != nil {
+		t.Fatalf("failed to rename bundle: %v\n", err)
+	}
+}
+
+func requireB(t *testing.T, jsEnv *js.JSEnv) string {
+	r, err := js.EvalAs[string](jsEnv, "require('lib/a').b()")
+	if err != nil {
+		t.Fatalf("failed to require from bundle: %v\n", err)
+	}
+	return r
+}
+
+func Test_bundle(t *testing.T) {
+	dir := t.TempDir()
+	modDir := filepath.Join(dir, "modules")
+	if err := os.MkdirAll(filepath.Join(modDir, "lib"), 0755); err != nil {
+		t.Fatal(err)
+	}
+	os.WriteFile(filepath.Join(modDir, "lib", "a.js"), []byte("var b = require('./b'); exports.b = function() { return b.v; };"), 0644)
+	os.WriteFile(filepath.Join(modDir, "lib", "b.js"), []byte("exports.v = 'old';"), 0644)
+	bundleFile := filepath.Join(dir, "modules.bundle")
+
+	for _, bytecode := range []bool{false, true} {
+		writeBundle(t, modDir, bundleFile, bytecode)
+		jsEnv := js.NewEnv(nil)
+		if err := jsEnv.MountBundle(bundleFile); err != nil {
+			t.Fatalf("%v\n", err)
+		}
+		if r := requireB(t, jsEnv); r != "old" {
+			t.Errorf("unexpected result with bytecode=%v: %s\n", bytecode, r)
+		}
+
+		// a replaced bundle is mapped again by a new env, while the old one is still mounted.
+		os.WriteFile(filepath.Join(modDir, "lib", "b.js"), []byte("exports.v = 'new';"), 0644)
+		writeBundle(t, modDir, bundleFile, bytecode)
+		jsEnv2 := js.NewEnv(nil)
+		if err := jsEnv2.MountBundle(bundleFile); err != nil {
+			t.Fatalf("%v\n", err)
+		}
+		if r := requireB(t, jsEnv2); r != "new" {
+			t.Errorf("replaced bundle not mapped again with bytecode=%v: %s\n", bytecode, r)
+		}
+		jsEnv2.Destroy()
+		jsEnv.Destroy()
+		os.WriteFile(filepath.Join(modDir, "lib", "b.js"), []byte("exports.v = 'old';"), 0644)
+	}
+
+	jsEnv := js.NewEnv(nil)
+	defer jsEnv.Destroy()
+	if err := jsEnv.MountBundle(filepath.Join(dir, "none.bundle")); err == nil {
+		t.Errorf("error expected when mounting a missing bundle\n")
+	}
+}
+
+func Test_invalidateBundled(t *testing.T) {
+	exe, err := os.Executable()
+	if err != nil {
+		t.Fatal(err)
+	}
+	modDir := filepath.Join(filepath.Dir(exe), "modules")
+	if err = os.MkdirAll(modDir, 0755); err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(modDir)
+	modFile := filepath.Join(modDir, "c.js")
+	os.WriteFile(modFile, []byte("exports.v = 'bundled';"), 0644)
+	bundleFile := filepath.Join(t.TempDir(), "c.bundle")
+	writeBundle(t, modDir, bundleFile, true)
+
+	jsEnv := js.NewEnv(nil)
+	defer jsEnv.Destroy()
+	if err = jsEnv.MountBundle(bundleFile); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	// the module in the bundle takes precedence over its file
+	os.WriteFile(modFile, []byte("exports.v = 'file';"), 0644)
+	if r, err := js.EvalAs[string](jsEnv, "require('c').v"); err != nil || r != "bundled" {
+		t.Errorf("unexpected result: %v, %v\n", r, err)
+	}
+	if jsEnv.InvalidateModule("c") {
+		t.Errorf("a module in the bundle should not be invalidated\n")
+	}
+	if r, err := js.EvalAs[string](jsEnv, "require('c').v"); err != nil || r != "bundled" {
+		t.Errorf("unexpected result: %v, %v\n", r, err)
+	}
+}
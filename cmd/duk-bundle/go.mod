@@ -0,0 +1,7 @@
+module duk-bundle
+
+go 1.20
+
+require github.com/rosbit/duktape-bridge v0.0.0
+
+replace github.com/rosbit/duktape-bridge => ../../
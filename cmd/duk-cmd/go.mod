@@ -1,6 +1,6 @@
 module duk-cmd
 
-go 1.17
+go 1.18
 
 require github.com/rosbit/duktape-bridge v0.0.0
 
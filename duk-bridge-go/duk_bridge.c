@@ -15,23 +15,29 @@
 #include <sys/stat.h>
 #include <libgen.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
 #ifdef Darwin
 #include <mach-o/dyld.h>
 #else
-#include <unistd.h>
+#include <sys/inotify.h>
 #endif
 
 #define NATIVE_FUNC "_nf_"
 #define NATIVE_UDD  "_nu_"
+#define NATIVE_UDD_FREE "_nuf_"
+#define NATIVE_UDD_OWNER "_nuo_"
 
 #define NATIVE_MOD  "_nm_"
 #define NATIVE_MOD_HANDLE    "_nmh_"
-#define NATIVE_MOD_COUNT     "_nmc_"
-#define NATIVE_MOD_EXT       "_nme_"
-#define NATIVE_MOD_LOADER    "_nml_"
-#define NATIVE_MOD_METHODS   "_nmm_"
-#define NATIVE_MOD_ATTRS     "_nma_"
 #define NATIVE_MOD_FINALIZER "_nmf_"
 
 #define ECMA_OBJ "_eo_"
@@ -42,93 +48,363 @@ static char *createHiddenSymbol(const char *type, unsigned long index) {
 	return hiddenSymbol;
 }
 
-#define getNativeModNum(index) createHiddenSymbol(NATIVE_MOD, index)
 #define getEcmaObjNum(index) createHiddenSymbol(ECMA_OBJ, index)
 
-static void make_func_bridge(duk_context *ctx, const char *func_name, fn_native_func native_func, duk_idx_t nargs, void *udd);
+static void make_func_bridge(duk_context *ctx, const char *func_name, fn_native_func native_func, duk_idx_t nargs, void *udd, fn_free_udd free_udd);
+static void push_func_bridge(duk_context *ctx, fn_native_func native_func, duk_idx_t nargs, void *udd, fn_free_udd free_udd);
+struct event_loop;
+static void free_loop(struct event_loop *loop);
 
-// the default implementation of readFileContent
-static int defReadFileContent(const char *f, char **c, size_t *l) {
+// files not less than MMAP_MIN_SIZE bytes are mapped instead of being read by the default reader.
+#define MMAP_MIN_SIZE (64*1024)
+
+/*
+ * read a file to malloc()ed memory, or return a read-only mapping of a large file if map
+ * is not 0, which is compiled without copying and shared with the page cache. a mapped file
+ * must not be truncated until the content is unmapped, otherwise reading it raises SIGBUS.
+ */
+static int read_file(const char *f, char **c, size_t *l, int map) {
+	int fd = open(f, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR) {
+			return -1;
+		}
+		fprintf(stderr, "failed to open %s for reading\n", f);
+		return -4;
+	}
 	struct stat sb;
-	if (stat(f, &sb) == -1) {
-		// perror(f);
+	if (fstat(fd, &sb) == -1) {
+		close(fd);
 		return -1;
 	}
 	off_t size = sb.st_size;
 	if (size == 0) {
+		close(fd);
 		fprintf(stderr, "%s has no content.\n", f);
 		return -2;
 	}
-	char *src = malloc(size);
-	if (src == NULL) {
-		fprintf(stderr, "failed to calloc memory of %ld bytes for %s\n", (long)size, f);
-		return -3;
-	}
-	FILE *fp = fopen(f, "rb");
-	if (fp == NULL) {
-		free(src);
-		fprintf(stderr, "failed to open %s for reading\n", f);
-		return -4;
-	}
-	if (fread(src, 1, size, fp) != size) {
-		fclose(fp);
-		free(src);
-		fprintf(stderr, "failed to read %s\n", f);
-		return -5;
+
+	char *src;
+	if (map && size >= MMAP_MIN_SIZE) {
+		src = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (src == MAP_FAILED) {
+			fprintf(stderr, "failed to map %s\n", f);
+			return -5;
+		}
+	} else {
+		src = malloc(size);
+		if (src == NULL) {
+			close(fd);
+			fprintf(stderr, "failed to calloc memory of %ld bytes for %s\n", (long)size, f);
+			return -3;
+		}
+		off_t n = 0;
+		while (n < size) {
+			ssize_t r = read(fd, src+n, size-n);
+			if (r <= 0) {
+				if (r < 0 && errno == EINTR) {
+					continue;
+				}
+				close(fd);
+				free(src);
+				fprintf(stderr, "failed to read %s\n", f);
+				return -5;
+			}
+			n += r;
+		}
+		close(fd);
 	}
-	fclose(fp);
 
 	*c = src;
 	*l = size;
 	return 0;
 }
 
+// the default implementation of readFileContent, large files are mapped.
+static int defReadFileContent(const char *f, char **c, size_t *l) {
+	return read_file(f, c, l, 1);
+}
+
+static void defFreeFileContent(char *c, size_t l) {
+	if (l >= MMAP_MIN_SIZE) {
+		munmap(c, l);
+	} else {
+		free(c);
+	}
+}
+
+// content returned by a reader set by js_set_readfile() or js_set_env_readfile()
+static void freeContent(char *c, size_t l) {
+	(void)l;
+	free(c);
+}
+
 static fn_read_file readFileContent = defReadFileContent;
+static fn_free_file freeFileContent = defFreeFileContent;
 
 void js_set_readfile(fn_read_file read_file)
+{
+	js_set_readfile_ex(read_file, NULL);
+}
+
+void js_set_readfile_ex(fn_read_file read_file, fn_free_file free_file)
 {
 	if (read_file != NULL) {
+		freeFileContent = (free_file != NULL) ? free_file : freeContent;
 		readFileContent = read_file;
 	}
 }
 
-static duk_ret_t unloadDll(duk_context *ctx) {
-	duk_push_current_function(ctx);
-	if (duk_get_prop_string(ctx, -1, NATIVE_MOD_HANDLE)) {
-		void *hMod = duk_get_pointer(ctx, -1);
-		dlclose(hMod);
+/* a module loader added by js_add_module_loader() */
+typedef struct {
+	void *udd;
+	char *mod_ext;  // without the leading '.'
+	fn_load_module load_module;
+	fn_get_methods_list get_methods;
+	fn_get_attrs_list get_attrs;
+	fn_module_finalizer finalizer;
+	int next_same_bucket; // index of the next loader in the same ext bucket, -1 for the end
+} module_loader_t;
+
+#define LOADER_BUCKETS 16
+
+/* states of an env, stored as the udata of the Duktape heap */
+typedef struct {
+	fn_read_env_file read_file;
+	void *read_file_udd;
+	env_stats_t stats; // updated by the allocator of the heap
+	char *mod_home;    // `mod_path`/modules/
+	struct bundle *bundle; // mounted by js_mount_bundle()
+	unsigned long watch_gen; // changes of the module watcher applied
+	module_loader_t *loaders; // in the order of adding
+	int loader_count;
+	int loader_cap;
+	int ext_buckets[LOADER_BUCKETS]; // hash of mod_ext -> index of the 1st loader, -1 for none
+	struct event_loop *loop; // created by js_enable_loop()
+} env_state_t;
+
+/* the allocator of the Duktape heap, which counts the memory of an env */
+#define MEM_HDR_SIZE 16 // the size of an allocation is kept before it, with the alignment of malloc()
+
+static void add_heap_bytes(env_state_t *state, size_t inc, size_t dec, size_t allocs) {
+	size_t bytes = state->stats.heap_bytes + inc - dec;
+	__atomic_store_n(&state->stats.heap_bytes, bytes, __ATOMIC_RELAXED);
+	if (bytes > state->stats.peak_bytes) {
+		__atomic_store_n(&state->stats.peak_bytes, bytes, __ATOMIC_RELAXED);
+	}
+	if (allocs > 0) {
+		__atomic_store_n(&state->stats.alloc_count, state->stats.alloc_count + allocs, __ATOMIC_RELAXED);
 	}
-	duk_pop_2(ctx);
-	return 0;
 }
 
-static duk_ret_t loadAndInitDll(duk_context *ctx) {
-	const char *modPath = duk_get_string(ctx, 0);
-	const char *modName = duk_get_string(ctx, 1);
+static void *env_alloc(void *udata, duk_size_t size) {
+	char *p = (char*)malloc(size + MEM_HDR_SIZE);
+	if (p == NULL) {
+		return NULL;
+	}
+	*(size_t*)p = size;
+	add_heap_bytes((env_state_t*)udata, size, 0, 1);
+	return p + MEM_HDR_SIZE;
+}
+
+static void env_free(void *udata, void *ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+	char *p = (char*)ptr - MEM_HDR_SIZE;
+	add_heap_bytes((env_state_t*)udata, 0, *(size_t*)p, 0);
+	free(p);
+}
+
+static void *env_realloc(void *udata, void *ptr, duk_size_t size) {
+	if (ptr == NULL) {
+		return env_alloc(udata, size);
+	}
+	if (size == 0) {
+		env_free(udata, ptr);
+		return NULL;
+	}
+	char *p = (char*)ptr - MEM_HDR_SIZE;
+	size_t old_size = *(size_t*)p;
+	p = (char*)realloc(p, size + MEM_HDR_SIZE);
+	if (p == NULL) {
+		return NULL;
+	}
+	*(size_t*)p = size;
+	add_heap_bytes((env_state_t*)udata, size, old_size, 1);
+	return p + MEM_HDR_SIZE;
+}
+
+static env_state_t *get_env_state(duk_context *ctx) {
+	duk_memory_functions mf;
+	duk_get_memory_functions(ctx, &mf);
+	return (env_state_t*)mf.udata;
+}
+
+void js_set_env_readfile(void *env, fn_read_env_file read_file, void *udd)
+{
+	env_state_t *state = get_env_state((duk_context*)env);
+	state->read_file = read_file;
+	state->read_file_udd = udd;
+}
+
+void js_get_env_stats(void *env, env_stats_t *stats)
+{
+	env_state_t *state = get_env_state((duk_context*)env);
+	stats->heap_bytes = __atomic_load_n(&state->stats.heap_bytes, __ATOMIC_RELAXED);
+	stats->peak_bytes = __atomic_load_n(&state->stats.peak_bytes, __ATOMIC_RELAXED);
+	stats->alloc_count = __atomic_load_n(&state->stats.alloc_count, __ATOMIC_RELAXED);
+}
+
+/*
+ * read a file with the reader of the env, or the reader set by js_set_readfile(). the content
+ * must be freed by calling free_file(content, len).
+ */
+static int read_file_content(duk_context *ctx, const char *f, char **c, size_t *l, fn_free_file *free_file) {
+	env_state_t *state = get_env_state(ctx);
+	if (state != NULL && state->read_file != NULL) {
+		*free_file = freeContent;
+		return state->read_file(state->read_file_udd, f, c, l);
+	}
+	*free_file = freeFileContent;
+	return readFileContent(f, c, l);
+}
+
+/*
+ * read a module file, which is never mapped by the default reader. module sources are copied
+ * to JS strings anyway, and a module may be rewritten in place while it is read, e.g. when
+ * it is edited to be reloaded by js_apply_module_changes().
+ */
+static int read_module_file(const char *f, char **c, size_t *l, fn_free_file *free_file) {
+	if (readFileContent == defReadFileContent) {
+		*free_file = freeContent;
+		return read_file(f, c, l, 0);
+	}
+	*free_file = freeFileContent;
+	return readFileContent(f, c, l);
+}
+
+// same as read_file_content(), but the module file is read by read_module_file().
+static int read_module_content(duk_context *ctx, const char *f, char **c, size_t *l, fn_free_file *free_file) {
+	env_state_t *state = get_env_state(ctx);
+	if (state != NULL && state->read_file != NULL) {
+		*free_file = freeContent;
+		return state->read_file(state->read_file_udd, f, c, l);
+	}
+	return read_module_file(f, c, l, free_file);
+}
+
+/**
+ * native modules loaded by dlopen() are shared by all the envs in the process.
+ * a module is dlclose()d when the last env using it releases it.
+ */
+typedef struct dll_entry {
+	char *path;
+	void *hMod;
+	void *initFn;
+	int refs;
+	struct dll_entry *next;
+} dll_entry_t;
+
+static dll_entry_t *dll_cache = NULL;
+static pthread_mutex_t dll_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static dll_entry_t *acquire_dll(const char *modPath, const char *modName) {
+	dll_entry_t *e;
+	pthread_mutex_lock(&dll_cache_lock);
+	for (e=dll_cache; e!=NULL; e=e->next) {
+		if (strcmp(e->path, modPath) == 0) {
+			e->refs++;
+			pthread_mutex_unlock(&dll_cache_lock);
+			return e;
+		}
+	}
 
 	void *hMod = dlopen(modPath, RTLD_LAZY);
 	if (hMod == NULL) {
-		duk_push_undefined(ctx);
-		return 1;
+		pthread_mutex_unlock(&dll_cache_lock);
+		return NULL;
+	}
+	char *initFunc;
+	if (asprintf(&initFunc, "init_%s", modName) < 0) {
+		dlclose(hMod);
+		pthread_mutex_unlock(&dll_cache_lock);
+		return NULL;
 	}
-	char initFunc[40];
-	sprintf(initFunc, "init_%s", modName);
 	void *initFn = dlsym(hMod, initFunc);
-	if (initFn == NULL) {
+	free(initFunc);
+	if (initFn == NULL || (e = (dll_entry_t*)malloc(sizeof(dll_entry_t))) == NULL) {
 		dlclose(hMod);
-		duk_push_undefined(ctx);
-		return 1;
+		pthread_mutex_unlock(&dll_cache_lock);
+		return NULL;
+	}
+	e->path = strdup(modPath);
+	e->hMod = hMod;
+	e->initFn = initFn;
+	e->refs = 1;
+	e->next = dll_cache;
+	dll_cache = e;
+	pthread_mutex_unlock(&dll_cache_lock);
+	return e;
+}
+
+static void release_dll(dll_entry_t *entry) {
+	dll_entry_t **pe;
+	pthread_mutex_lock(&dll_cache_lock);
+	if (--entry->refs > 0) {
+		pthread_mutex_unlock(&dll_cache_lock);
+		return;
+	}
+	for (pe=&dll_cache; *pe!=NULL; pe=&(*pe)->next) {
+		if (*pe == entry) {
+			*pe = entry->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dll_cache_lock);
+
+	dlclose(entry->hMod);
+	free(entry->path);
+	free(entry);
+}
+
+static duk_ret_t unloadDll(duk_context *ctx) {
+	duk_push_current_function(ctx);
+	if (duk_get_prop_string(ctx, -1, NATIVE_MOD_HANDLE)) {
+		dll_entry_t *entry = (dll_entry_t*)duk_get_pointer(ctx, -1);
+		release_dll(entry);
+	}
+	duk_pop_2(ctx);
+	return 0;
+}
+
+// load a DLL and call its init function, the returned module is pushed. 0 if the DLL is not found.
+static int push_dll_module(duk_context *ctx, const char *modPath, const char *modName) {
+	dll_entry_t *entry = acquire_dll(modPath, modName);
+	if (entry == NULL) {
+		return 0;
 	}
 
-	duk_push_c_function(ctx, (duk_c_function)initFn, 0);
+	duk_push_c_function(ctx, (duk_c_function)entry->initFn, 0);
 	duk_call(ctx, 0);                                // [ module ]
 
 	duk_push_c_function(ctx, unloadDll, 0);          // [ module, unloadDll ]
-	duk_push_pointer(ctx, hMod);                     // [ module, unloadDll, hMod ]
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_HANDLE); // [ module, unloadDll ] with unloadDll[NATIVE_MOD_HANDLE] = hMod
+	duk_push_pointer(ctx, entry);                    // [ module, unloadDll, entry ]
+	duk_put_prop_string(ctx, -2, NATIVE_MOD_HANDLE); // [ module, unloadDll ] with unloadDll[NATIVE_MOD_HANDLE] = entry
 	duk_set_finalizer(ctx, -2);                      // [ module ] with unloadDll as finalizer
 
-	// dlclose(hMod);  // this will be called in unloadDll()
+	// release_dll(entry);  // this will be called in unloadDll()
+	return 1;
+}
+
+static duk_ret_t loadAndInitDll(duk_context *ctx) {
+	const char *modPath = duk_get_string(ctx, 0);
+	const char *modName = duk_get_string(ctx, 1);
+
+	if (!push_dll_module(ctx, modPath, modName)) {
+		duk_push_undefined(ctx);
+	}
 	return 1;
 }
 
@@ -186,7 +462,7 @@ void js_add_module_method(void *env, module_method_t *method)
 	} else {
 		nargs = method->nargs;
 	}
-	make_func_bridge(ctx, method->name, method->method, nargs, method->udd); // [ ..., obj ] with obj[method->name] = native_func_bridge
+	make_func_bridge(ctx, method->name, method->method, nargs, method->udd, method->free_udd); // [ ..., obj ] with obj[method->name] = native_func_bridge
 }
 
 void js_add_module_attr(void *env, module_attr_t *attr)
@@ -231,6 +507,28 @@ void js_add_module_attr(void *env, module_attr_t *attr)
 	duk_put_prop_string(ctx, -2, attr->name); // [ ..., obj ] with obj[attr->name] = attr
 }
 
+void js_add_module_accessor(void *env, module_accessor_t *accessor)
+{
+	// [ ..., obj ]
+	duk_context *ctx = (duk_context*)env;
+	duk_uint_t flags = DUK_DEFPROP_HAVE_GETTER | DUK_DEFPROP_SET_ENUMERABLE | DUK_DEFPROP_SET_CONFIGURABLE;
+	duk_idx_t obj_idx = -3;
+
+	duk_push_string(ctx, accessor->name);                         // [ ..., obj, name ]
+	push_func_bridge(ctx, accessor->getter, 0, accessor->udd, accessor->free_udd); // [ ..., obj, name, getter ]
+	if (accessor->setter != NULL) {
+		push_func_bridge(ctx, accessor->setter, 1, accessor->udd, NULL); // [ ..., obj, name, getter, setter ]
+		if (accessor->free_udd != NULL) {
+			// the getter owning udd is kept alive by the setter
+			duk_dup(ctx, -2);                                          // [ ..., obj, name, getter, setter, getter ]
+			duk_put_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_UDD_OWNER)); // [ ..., obj, name, getter, setter ] with setter[_nuo_] = getter
+		}
+		flags |= DUK_DEFPROP_HAVE_SETTER;
+		obj_idx = -4;
+	}
+	duk_def_prop(ctx, obj_idx, flags); // [ ..., obj ] with obj[name] as accessor
+}
+
 enum {
 	init_obj_ok = 0,
 	failed_to_init_obj,
@@ -289,790 +587,3246 @@ static int init_native_obj(duk_context *ctx, void *udd, const char *mod_home, co
 	return init_obj_ok;
 }
 
-// load module with module loaders
-static duk_ret_t loadNativeModule(duk_context *ctx) {
-	const char *mod_home = duk_get_string(ctx, 0); 
-	const char *id = duk_get_string(ctx, 1);
-	int loader_count = 0;
+static unsigned int ext_bucket(const char *ext, size_t len) {
+	unsigned int h = 5381;
+	size_t i;
+	for (i=0; i<len; i++) {
+		h = h*33 + (unsigned char)ext[i];
+	}
+	return h % LOADER_BUCKETS;
+}
 
-	duk_push_global_object(ctx); // [ ..., global ]
-	if (!duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_MOD_COUNT))) {
-		duk_pop_2(ctx);
-		duk_push_undefined(ctx);
+static const char *skip_ext_dot(const char *ext) {
+	return (ext != NULL && *ext == '.') ? ext+1 : ext;
+}
+
+// call the loader, 1 if the module is pushed, 0 if not loaded, -1 if the loader failed.
+static int try_module_loader(duk_context *ctx, module_loader_t *loader, const char *mod_home, const char *id) {
+	if (loader->load_module == NULL || loader->get_methods == NULL) {
+		return 0;
+	}
+	switch (init_native_obj(ctx, loader->udd, mod_home, id, loader->mod_ext, loader->load_module, loader->get_methods, loader->get_attrs, loader->finalizer)) {
+	case init_obj_ok:
 		return 1;
+	case failed_to_init_obj:
+		return -1;
+	case try_other_init:
+	default:
+		return 0;
 	}
+}
 
-	loader_count = duk_get_int(ctx, -1);
-	duk_pop_2(ctx);
-	// [ ... ]
-	int i;
-	for (i=0; i<loader_count; i++) {
-		char *modNum = getNativeModNum(i);
-		duk_bool_t rc = duk_get_global_string(ctx, modNum);
-		free(modNum);
-		if (!rc) {
-			return 1;
-		}
+// whether ext, without the leading dot, is an extension of the last component of id, e.g. "go.so" of "a/x.go.so"
+static int is_id_ext(const char *id, const char *ext) {
+	size_t id_len = strlen(id), ext_len = strlen(ext);
+	if (ext_len == 0 || ext_len >= id_len || id[id_len-ext_len-1] != '.' || strcmp(id+id_len-ext_len, ext) != 0) {
+		return 0;
+	}
+	return strchr(id+id_len-ext_len, '/') == NULL;
+}
 
-		// [ ..., loader ]
-		duk_get_prop_string(ctx, -1, NATIVE_MOD_EXT);
-		duk_get_prop_string(ctx, -2, NATIVE_MOD_LOADER);
-		duk_get_prop_string(ctx, -3, NATIVE_MOD_METHODS);
-		duk_get_prop_string(ctx, -4, NATIVE_MOD_ATTRS);
-		duk_get_prop_string(ctx, -5, NATIVE_MOD_FINALIZER);
-		duk_get_prop_string(ctx, -6, NATIVE_UDD);
-
-		void *udd = duk_get_pointer(ctx, -1);
-		fn_module_finalizer finalizer = (fn_module_finalizer)duk_get_pointer(ctx, -2);
-		fn_get_attrs_list get_attrs = (fn_get_attrs_list)duk_get_pointer(ctx, -3);
-		fn_get_methods_list get_methods = (fn_get_methods_list)duk_get_pointer(ctx, -4);
-		fn_load_module load_module = (fn_load_module)duk_get_pointer(ctx, -5);
-		const char *ext = duk_get_string(ctx, -6);
-		duk_pop_n(ctx, 7);
-		// [ ... ]
-
-		if (load_module == NULL || get_methods == NULL) {
-			continue;
-		}
+/*
+ * load module with module loaders, the module is pushed if it is loaded. 0 if not loaded.
+ * the loaders whose mod_ext is an extension of id are tried first, found by one hash lookup
+ * for every dot in the last component of id, so mod_ext may have more than one dot. if none
+ * of them loads it, the other loaders are tried in the order of adding.
+ */
+static int push_native_module(duk_context *ctx, const char *mod_home, const char *id) {
+	env_state_t *state = get_env_state(ctx);
+	if (state->loader_count == 0) {
+		return 0;
+	}
 
-		int ret = init_native_obj(ctx, udd, mod_home, id, ext, load_module, get_methods, get_attrs, finalizer);
-		switch (ret) {
-		case init_obj_ok:
-			return 1;
-		case failed_to_init_obj:
-			duk_push_undefined(ctx);
-			return 1;
-		case try_other_init:
-		default:
-			continue;
+	const char *base = strrchr(id, '/');
+	const char *dot;
+	int i, ret;
+	for (dot=strchr(base != NULL ? base : id, '.'); dot != NULL; dot=strchr(dot+1, '.')) {
+		const char *ext = dot + 1;
+		for (i=state->ext_buckets[ext_bucket(ext, strlen(ext))]; i>=0; i=state->loaders[i].next_same_bucket) {
+			module_loader_t *loader = &state->loaders[i];
+			if (strcmp(loader->mod_ext, ext) != 0) {
+				continue;
+			}
+			if ((ret = try_module_loader(ctx, loader, mod_home, id)) != 0) {
+				return ret > 0;
+			}
 		}
 	}
 
-	duk_push_undefined(ctx);
-	return 1;
+	for (i=0; i<state->loader_count; i++) {
+		module_loader_t *loader = &state->loaders[i];
+		if (is_id_ext(id, loader->mod_ext)) {
+			continue; // tried above
+		}
+		if ((ret = try_module_loader(ctx, loader, mod_home, id)) != 0) {
+			return ret > 0;
+		}
+	}
+	return 0;
 }
 
-static duk_ret_t readFile(duk_context *ctx) {
-	const char *modPath = duk_get_string(ctx, 0);
-
-	char *src;
-	size_t size;
-	int ret = readFileContent(modPath, &src, &size);
-	if (ret != 0) {
+static duk_ret_t loadNativeModule(duk_context *ctx) {
+	const char *mod_home = duk_get_string(ctx, 0);
+	const char *id = duk_get_string(ctx, 1);
+	if (!push_native_module(ctx, mod_home, id)) {
 		duk_push_undefined(ctx);
-		return 1;
 	}
-	duk_push_lstring(ctx, src, size);
-	free(src);
 	return 1;
 }
 
-static void set_global_function(duk_context *ctx, const char *func_name, duk_c_function func, duk_idx_t nargs) {
-	duk_push_string(ctx, func_name);       // [ global, func_name ]
-	duk_push_c_function(ctx, func, nargs); // [ global, func_name, function]
-	duk_put_prop(ctx, -3);                 // [ global ] with global[func_name]=function
-}
+/**
+ * module bundles, which are mapped by mmap() once and shared by all the envs in the process.
+ * the layout of a bundle, all integers are uint32 in little endian:
+ *   "DUKBNDL\0" version count
+ *   count entries of { name_off name_len data_off data_len flags }, sorted by name
+ *   names and data
+ * a name is the path relative to `mod_path`/modules/, e.g. "lib/a.js". the data is the
+ * source if flags is bundle_source, or the bytecode of the module function if bundle_bytecode.
+ */
+#define BUNDLE_MAGIC      "DUKBNDL"
+#define BUNDLE_VERSION    1
+#define BUNDLE_HEAD_SIZE  16
+#define BUNDLE_ENTRY_SIZE 20
 
-static void init_global_funcs(duk_context *ctx) {
-	duk_push_global_object(ctx);            // [ global ]
+enum {
+	bundle_source = 0,
+	bundle_bytecode
+};
 
-	set_global_function(ctx, "readFile", readFile, 1);
-	set_global_function(ctx, "loadNativeModule", loadNativeModule, 2);
-	set_global_function(ctx, "loadAndInitDll", loadAndInitDll, 2);
+typedef struct bundle {
+	char *path;
+	dev_t dev;                 // the identity of the file mapped, a bundle replaced or
+	ino_t ino;                 // rewritten at the same path is mapped again
+	struct timespec mtime;
+	const unsigned char *addr;
+	size_t size;
+	uint32_t count;
+	int refs;
+	struct bundle *next;
+} bundle_t;
 
-	duk_pop(ctx);
+static bundle_t *bundles = NULL;
+static pthread_mutex_t bundle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t get_u32le(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
-static void getExePath(char *path, size_t size)
-{
+static const unsigned char *bundle_entry(bundle_t *b, uint32_t i) {
+	return b->addr + BUNDLE_HEAD_SIZE + (size_t)i * BUNDLE_ENTRY_SIZE;
+}
+
+// check all the entries are in the mapping, so they can be used without checking later
+static int check_bundle(const unsigned char *addr, size_t size, uint32_t *count) {
+	if (size < BUNDLE_HEAD_SIZE || memcmp(addr, BUNDLE_MAGIC, 8) != 0 || get_u32le(addr+8) != BUNDLE_VERSION) {
+		return -1;
+	}
+	uint32_t n = get_u32le(addr+12);
+	if ((size - BUNDLE_HEAD_SIZE) / BUNDLE_ENTRY_SIZE < n) {
+		return -1;
+	}
+	uint32_t i;
+	for (i=0; i<n; i++) {
+		const unsigned char *e = addr + BUNDLE_HEAD_SIZE + (size_t)i * BUNDLE_ENTRY_SIZE;
+		uint64_t name_end = (uint64_t)get_u32le(e) + get_u32le(e+4);
+		uint64_t data_end = (uint64_t)get_u32le(e+8) + get_u32le(e+12);
+		if (name_end > size || data_end > size) {
+			return -1;
+		}
+	}
+	*count = n;
+	return 0;
+}
+
+static bundle_t *acquire_bundle(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
 #ifdef Darwin
-	_NSGetExecutablePath(path, (uint32_t*)&size);
+	struct timespec mtime = st.st_mtimespec;
 #else
-	size = readlink("/proc/self/exe", path, size);
+	struct timespec mtime = st.st_mtim;
 #endif
-	path[size] = '\0';
-}
-
-// the Duktape.modSearch implementation. there's a '%s' which will be replaced by the value of `mod_home`
-static const char *modSearch_impl = "\
-Duktape.modSearch = function (id, require, exports, module) {\n\
-    /* readFile(): reads a file from disk, and returns a string or undefined.\n\
-     * 'id' is in resolved canonical form so it only contains terms and\n\
-     * slashes, and no '.' or '..' terms.\n\
-     *\n\
-     * loadAndInitDll(): load DLL, call its init function, return module\n\
-     * init function return value (typically an object containing the\n\
-     * module's function/constant bindings).  Return undefined if DLL\n\
-     * not found.\n\
-     */\n\
-    var name;\n\
-    var src;\n\
-    var mod;\n\
-    //print('in modSearch_impl');\n\
-	var modHome = '%s/modules/';\n\
-	if (id.endsWith('.js')) {\n\
-		name = modHome + id;\n\
-		src = readFile(name);\n\
-		if (typeof src === 'string') {\n\
-			return src;\n\
-		}\n\
-		throw new Error('module not found: ' + id);\n\
-	}\n\
-	/* ECMAScript check. */\n\
-	name = modHome + id + '.js';\n\
-	src = readFile(name);\n\
-	if (typeof src === 'string') {\n\
-		return src;\n\
-	}\n\
-   /* DLL check.  DLL init function is platform specific.\n\
-	*\n\
-	* The DLL loader could also need e.g. 'require' to load further modules,\n\
-	* but typically native modules don't need to load submodules.\n\
-	*/\n\
-	name = modHome + id + '.so';\n\
-	mod = loadAndInitDll(name, id);\n\
-	if (mod) {\n\
-		module.exports = mod;  /* replace exports table with module's exports */\n\
-		return undefined;\n\
-	}\n\
-	/* load native module */\n\
-	mod = loadNativeModule(modHome, id);\n\
-	if (mod) {\n\
-		module.exports = mod;\n\
-		return undefined;\n\
-	}\n\
-    /* Must find either a DLL or an ECMAScript file (or both) */\n\
-    throw new Error('module not found: ' + id);\n\
-}";
 
-#define MAX_PATH_LEN 512
-static void set_modSearch(duk_context *ctx, const char *mod_path)
-{
-	const char *s;
-	if (mod_path == NULL) {
-		size_t len = MAX_PATH_LEN;
-		char *exePath = malloc(len);
-		if (exePath == NULL) {
-			return;
+	// a mapping is shared only if the file is not changed since it was mapped.
+	bundle_t *b;
+	pthread_mutex_lock(&bundle_lock);
+	for (b=bundles; b!=NULL; b=b->next) {
+		if (strcmp(b->path, path) == 0 && b->dev == st.st_dev && b->ino == st.st_ino && b->size == (size_t)st.st_size &&
+			b->mtime.tv_sec == mtime.tv_sec && b->mtime.tv_nsec == mtime.tv_nsec) {
+			b->refs++;
+			pthread_mutex_unlock(&bundle_lock);
+			close(fd);
+			return b;
 		}
-		getExePath(exePath, len);
+	}
 
-		char *exeDir = dirname(exePath);
-		s = duk_push_sprintf(ctx, modSearch_impl, exeDir);
-		free(exePath);
-	} else {
-		s = duk_push_sprintf(ctx, modSearch_impl, mod_path);
+	void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		pthread_mutex_unlock(&bundle_lock);
+		return NULL;
 	}
 
-	int ret = duk_peval(ctx);
-	if (ret != 0) {
-		s = duk_safe_to_string(ctx, -1);
-		fprintf(stderr, "failed to set modSearch: %s\n", s);
+	uint32_t count;
+	if (check_bundle((const unsigned char*)addr, (size_t)st.st_size, &count) != 0 ||
+		(b = (bundle_t*)malloc(sizeof(bundle_t))) == NULL) {
+		munmap(addr, (size_t)st.st_size);
+		pthread_mutex_unlock(&bundle_lock);
+		return NULL;
 	}
-	duk_pop(ctx);
+	if ((b->path = strdup(path)) == NULL) {
+		free(b);
+		munmap(addr, (size_t)st.st_size);
+		pthread_mutex_unlock(&bundle_lock);
+		return NULL;
+	}
+	b->dev = st.st_dev;
+	b->ino = st.st_ino;
+	b->mtime = mtime;
+	b->addr = (const unsigned char*)addr;
+	b->size = (size_t)st.st_size;
+	b->count = count;
+	b->refs = 1;
+	b->next = bundles;
+	bundles = b;
+	pthread_mutex_unlock(&bundle_lock);
+	return b;
 }
 
-void* js_create_env(const char *mod_path)
-{
-	duk_context *ctx = duk_create_heap_default();
-	duk_print_alert_init(ctx, 0);
-	duk_console_init(ctx, 0);
-	duk_module_duktape_init(ctx);
-	init_global_funcs(ctx);
-	set_modSearch(ctx, mod_path);
-	return ctx;
+static void release_bundle(bundle_t *b) {
+	bundle_t **p;
+	pthread_mutex_lock(&bundle_lock);
+	if (--b->refs == 0) {
+		for (p=&bundles; *p!=NULL; p=&(*p)->next) {
+			if (*p == b) {
+				*p = b->next;
+				break;
+			}
+		}
+		munmap((void*)b->addr, b->size);
+		free(b->path);
+		free(b);
+	}
+	pthread_mutex_unlock(&bundle_lock);
 }
 
-void js_destroy_env(void *env)
-{
-	duk_context *ctx = (duk_context*)env;
-	duk_destroy_heap(ctx);
+// find the entry of name by binary search, 0 if found.
+static int find_in_bundle(bundle_t *b, const char *name, size_t name_len, const char **data, size_t *data_len, uint32_t *flags) {
+	uint32_t lo = 0, hi = b->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const unsigned char *e = bundle_entry(b, mid);
+		const char *n = (const char*)b->addr + get_u32le(e);
+		size_t n_len = get_u32le(e+4);
+		int c = memcmp(n, name, n_len < name_len ? n_len : name_len);
+		if (c == 0) {
+			c = (n_len < name_len) ? -1 : (n_len > name_len ? 1 : 0);
+		}
+		if (c == 0) {
+			*data = (const char*)b->addr + get_u32le(e+8);
+			*data_len = get_u32le(e+12);
+			*flags = get_u32le(e+16);
+			return 0;
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return -1;
 }
 
-int js_register_var(void *env, const char *var_name, arg_format_t val_type, void **val, size_t val_size)
+int js_mount_bundle(void *env, const char *bundle_file)
 {
-	duk_context *ctx = (duk_context*)env;
-	duk_push_global_object(ctx); // [ global ]
-	module_attr_t attr = {var_name, val_type, *val, val_size};
-	js_add_module_attr(env, &attr);
-	duk_pop(ctx);
+	env_state_t *state = get_env_state((duk_context*)env);
+	bundle_t *b = acquire_bundle(bundle_file);
+	if (b == NULL) {
+		return -1;
+	}
+	if (state->bundle != NULL) {
+		release_bundle(state->bundle);
+	}
+	state->bundle = b;
 	return 0;
 }
 
-int js_register_code_func(void *env, const char *js_code, size_t len, const char *func_name)
-{
-	duk_context *ctx = (duk_context*)env;
+// find the module `id`+ext in the mounted bundle, 0 if found.
+static int find_bundle_module(duk_context *ctx, const char *id, const char *ext, const char **data, size_t *data_len, uint32_t *flags) {
+	env_state_t *state = get_env_state(ctx);
+	if (state->bundle == NULL) {
+		return -1;
+	}
+	size_t name_len;
+	duk_push_sprintf(ctx, "%s%s", id, ext);
+	const char *name = duk_get_lstring(ctx, -1, &name_len);
+	int found = find_in_bundle(state->bundle, name, name_len, data, data_len, flags);
+	duk_pop(ctx);
+	return found;
+}
+
+// compile the module source to the module function. [ ... src ] -> [ ... func ] or [ ... err ]
+static duk_int_t compile_module(duk_context *ctx, const char *file_name) {
+	duk_push_string(ctx, "function (require, exports, module) {");
+	duk_insert(ctx, -2);
+	duk_push_string(ctx, "\n}");
+	duk_concat(ctx, 3);                         // [ ... wrapper ]
+	duk_push_string(ctx, file_name);
+	return duk_pcompile(ctx, DUK_COMPILE_FUNCTION);
+}
+
+// load the module function from bytecode without copying. [ ... ] -> [ ... func ]
+static void load_module_bytecode(duk_context *ctx, const void *code, size_t code_len) {
+	duk_push_external_buffer(ctx);
+	duk_config_buffer(ctx, -1, (void*)code, code_len);
+	duk_load_function(ctx);
+}
+
+// call the module function in modSearch, whose arguments are [ id require exports module ].
+static void call_module_func(duk_context *ctx) {
+	// [ ..., func ]
+	duk_dup(ctx, 2);          // [ ..., func exports ]
+	duk_dup(ctx, 1);          // [ ..., func exports require ]
+	duk_dup(ctx, 2);          // [ ..., func exports require exports ]
+	duk_dup(ctx, 3);          // [ ..., func exports require exports module ]
+	duk_call_method(ctx, 3);  // [ ..., retval ]
+	duk_pop(ctx);
+}
+
+/**
+ * the bytecode of modules compiled by modSearch, shared by all the envs in the process.
+ * an entry is keyed by the resolved path and the hash of the source, so a changed source
+ * is compiled again. the bytecode is immutable and loaded by every env without compiling.
+ */
+typedef struct code_entry {
+	char *path;
+	uint64_t hash;
+	size_t src_len;
+	void *code;
+	size_t code_len;
+	int refs;   // the cache holds 1 until the entry is replaced
+	struct code_entry *next;
+} code_entry_t;
+
+static code_entry_t *code_cache = NULL;
+static pthread_mutex_t code_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hash_source(const char *src, size_t len) {
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	size_t i;
+	for (i=0; i<len; i++) {
+		h ^= (unsigned char)src[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void unref_code(code_entry_t *e) {
+	if (--e->refs == 0) {
+		free(e->path);
+		free(e->code);
+		free(e);
+	}
+}
+
+static code_entry_t *acquire_code(const char *path, uint64_t hash, size_t src_len) {
+	code_entry_t *e;
+	pthread_mutex_lock(&code_cache_lock);
+	for (e=code_cache; e!=NULL; e=e->next) {
+		if (strcmp(e->path, path) == 0) {
+			if (e->hash == hash && e->src_len == src_len) {
+				e->refs++;
+			} else {
+				e = NULL;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&code_cache_lock);
+	return e;
+}
+
+static void release_code(code_entry_t *e) {
+	pthread_mutex_lock(&code_cache_lock);
+	unref_code(e);
+	pthread_mutex_unlock(&code_cache_lock);
+}
+
+// save the bytecode of path, the entry of the old source is replaced.
+static void save_code(const char *path, uint64_t hash, size_t src_len, const void *code, size_t code_len) {
+	code_entry_t *e = (code_entry_t*)malloc(sizeof(code_entry_t));
+	if (e == NULL) {
+		return;
+	}
+	e->path = strdup(path);
+	e->code = malloc(code_len);
+	if (e->path == NULL || e->code == NULL) {
+		free(e->path);
+		free(e->code);
+		free(e);
+		return;
+	}
+	memcpy(e->code, code, code_len);
+	e->hash = hash;
+	e->src_len = src_len;
+	e->code_len = code_len;
+	e->refs = 1;
+
+	code_entry_t **p;
+	pthread_mutex_lock(&code_cache_lock);
+	for (p=&code_cache; *p!=NULL; p=&(*p)->next) {
+		if (strcmp((*p)->path, path) == 0) {
+			code_entry_t *old = *p;
+			*p = old->next;
+			unref_code(old); // freed when no env is loading it
+			break;
+		}
+	}
+	e->next = code_cache;
+	code_cache = e;
+	pthread_mutex_unlock(&code_cache_lock);
+}
+
+// remove the bytecode of path, 0 if found.
+static int forget_code(const char *path) {
+	code_entry_t **p;
+	int ret = -1;
+	pthread_mutex_lock(&code_cache_lock);
+	for (p=&code_cache; *p!=NULL; p=&(*p)->next) {
+		if (strcmp((*p)->path, path) == 0) {
+			code_entry_t *e = *p;
+			*p = e->next;
+			unref_code(e);
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&code_cache_lock);
+	return ret;
+}
+
+/*
+ * run the module source at the top of the stack in modSearch, by loading the bytecode
+ * compiled by any env before. 0 if the module is run, 1 if the source is left to Duktape,
+ * which compiles it and reports the syntax error.
+ */
+static int run_module_source(duk_context *ctx, const char *path) {
+	size_t len;
+	const char *src = duk_get_lstring(ctx, -1, &len);
+	uint64_t hash = hash_source(src, len);
+
+	code_entry_t *e = acquire_code(path, hash, len);
+	if (e != NULL) {
+		load_module_bytecode(ctx, e->code, e->code_len); // [ ..., src, func ]
+		release_code(e);
+	} else {
+		duk_dup(ctx, -1);
+		if (compile_module(ctx, path) != 0) {
+			duk_pop(ctx);
+			return 1;
+		}
+		duk_dup(ctx, -1);
+		duk_dump_function(ctx);                           // [ ..., src, func, bytecode ]
+		size_t code_len;
+		void *code = duk_get_buffer(ctx, -1, &code_len);
+		save_code(path, hash, len, code, code_len);
+		duk_pop(ctx);                                     // [ ..., src, func ]
+	}
+	duk_remove(ctx, -2);                                  // [ ..., func ]
+	call_module_func(ctx);
+	return 0;
+}
+
+static duk_ret_t readFile(duk_context *ctx) {
+	const char *modPath = duk_get_string(ctx, 0);
+
+	env_state_t *state = get_env_state(ctx);
+	if (state->bundle != NULL && state->mod_home != NULL && modPath != NULL) {
+		size_t home_len = strlen(state->mod_home);
+		const char *data;
+		size_t data_len;
+		uint32_t flags;
+		if (strncmp(modPath, state->mod_home, home_len) == 0 &&
+			find_bundle_module(ctx, modPath+home_len, "", &data, &data_len, &flags) == 0 && flags == bundle_source) {
+			duk_push_lstring(ctx, data, data_len);
+			return 1;
+		}
+	}
+
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_module_content(ctx, modPath, &src, &size, &free_file);
+	if (ret != 0) {
+		duk_push_undefined(ctx);
+		return 1;
+	}
+	duk_push_lstring(ctx, src, size);
+	free_file(src, size);
+	return 1;
+}
+
+static void set_global_function(duk_context *ctx, const char *func_name, duk_c_function func, duk_idx_t nargs) {
+	duk_push_string(ctx, func_name);       // [ global, func_name ]
+	duk_push_c_function(ctx, func, nargs); // [ global, func_name, function]
+	duk_put_prop(ctx, -3);                 // [ global ] with global[func_name]=function
+}
+
+static void init_global_funcs(duk_context *ctx) {
+	duk_push_global_object(ctx);            // [ global ]
+
+	set_global_function(ctx, "readFile", readFile, 1);
+	set_global_function(ctx, "loadNativeModule", loadNativeModule, 2);
+	set_global_function(ctx, "loadAndInitDll", loadAndInitDll, 2);
+
+	duk_pop(ctx);
+}
+
+static void getExePath(char *path, size_t size)
+{
+#ifdef Darwin
+	_NSGetExecutablePath(path, (uint32_t*)&size);
+#else
+	size = readlink("/proc/self/exe", path, size);
+#endif
+	path[size] = '\0';
+}
+
+/**
+ * the resolution cache of require(), shared by all the envs in the process.
+ * an entry maps `mod_home`+id to the kind of module found in the file system:
+ *  - mod_js: `id`.js, which is read directly next time
+ *  - mod_dll: no `id`.js, but `id`.so
+ *  - mod_native: neither `id`.js nor `id`.so, only module loaders are tried
+ * mod_dll/mod_native entries are negative lookups, they are valid as long as the
+ * mtime of the directory containing the files is not changed.
+ */
+typedef enum {
+	mod_unknown,
+	mod_js,
+	mod_dll,
+	mod_native
+} mod_kind_t;
+
+typedef struct mod_entry {
+	char *name;            // `mod_home`+id
+	mod_kind_t kind;
+	struct timespec dir_mtime;
+	struct mod_entry *next;
+} mod_entry_t;
+
+static mod_entry_t *mod_cache = NULL;
+static pthread_mutex_t mod_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int get_dir_mtime(const char *name, struct timespec *mtime) {
+	char *dir = strdup(name);
+	if (dir == NULL) {
+		return -1;
+	}
+	struct stat st;
+	int ret = stat(dirname(dir), &st);
+	free(dir);
+	if (ret != 0) {
+		return -1;
+	}
+#ifdef Darwin
+	*mtime = st.st_mtimespec;
+#else
+	*mtime = st.st_mtim;
+#endif
+	return 0;
+}
+
+static mod_kind_t lookup_mod(const char *name) {
+	mod_entry_t *e;
+	mod_kind_t kind = mod_unknown;
+	struct timespec dir_mtime;
+
+	pthread_mutex_lock(&mod_cache_lock);
+	for (e=mod_cache; e!=NULL; e=e->next) {
+		if (strcmp(e->name, name) == 0) {
+			kind = e->kind;
+			dir_mtime = e->dir_mtime;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mod_cache_lock);
+
+	if (kind == mod_dll || kind == mod_native) {
+		struct timespec mtime;
+		if (get_dir_mtime(name, &mtime) != 0 || mtime.tv_sec != dir_mtime.tv_sec || mtime.tv_nsec != dir_mtime.tv_nsec) {
+			return mod_unknown;
+		}
+	}
+	return kind;
+}
+
+static void forget_mod(const char *name) {
+	mod_entry_t **p;
+	pthread_mutex_lock(&mod_cache_lock);
+	for (p=&mod_cache; *p!=NULL; p=&(*p)->next) {
+		if (strcmp((*p)->name, name) == 0) {
+			mod_entry_t *e = *p;
+			*p = e->next;
+			free(e->name);
+			free(e);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mod_cache_lock);
+}
+
+static void save_mod(const char *name, mod_kind_t kind) {
+	struct timespec dir_mtime;
+	if (get_dir_mtime(name, &dir_mtime) != 0) {
+		return;
+	}
+
+	mod_entry_t *e;
+	pthread_mutex_lock(&mod_cache_lock);
+	for (e=mod_cache; e!=NULL; e=e->next) {
+		if (strcmp(e->name, name) == 0) {
+			break;
+		}
+	}
+	if (e == NULL) {
+		if ((e = (mod_entry_t*)malloc(sizeof(mod_entry_t))) == NULL || (e->name = strdup(name)) == NULL) {
+			free(e);
+			pthread_mutex_unlock(&mod_cache_lock);
+			return;
+		}
+		e->next = mod_cache;
+		mod_cache = e;
+	}
+	e->kind = kind;
+	e->dir_mtime = dir_mtime;
+	pthread_mutex_unlock(&mod_cache_lock);
+}
+
+// files are read by the default reader, so the results of the file system can be cached.
+static int use_mod_cache(duk_context *ctx) {
+	env_state_t *state = get_env_state(ctx);
+	return state->read_file == NULL && readFileContent == defReadFileContent;
+}
+
+// push the content of `mod_home`+id+ext as a string, 0 if not found.
+static int push_mod_source(duk_context *ctx, const char *name, const char *ext) {
+	char *path;
+	if (asprintf(&path, "%s%s", name, ext) < 0) {
+		return 0;
+	}
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_module_content(ctx, path, &src, &size, &free_file);
+	free(path);
+	if (ret != 0) {
+		return 0;
+	}
+	duk_push_lstring(ctx, src, size);
+	free_file(src, size);
+	return 1;
+}
+
+static int push_mod_dll(duk_context *ctx, const char *name, const char *id) {
+	char *path;
+	if (asprintf(&path, "%s.so", name) < 0) {
+		return 0;
+	}
+	int ret = push_dll_module(ctx, path, id);
+	free(path);
+	return ret;
+}
+
+/*
+ * the Duktape.modSearch implementation, the module `id` is searched by the order:
+ * the mounted bundle, `id`.js, `id`.so in `mod_home`, the module loaders.
+ * JS modules are run with the bytecode shared by all the envs, see run_module_source().
+ */
+static duk_ret_t modSearch(duk_context *ctx) {
+	// [ id require exports module ]
+	const char *id = duk_require_string(ctx, 0);
+	env_state_t *state = get_env_state(ctx);
+	const char *mod_home = (state->mod_home != NULL) ? state->mod_home : "";
+	size_t id_len = strlen(id);
+
+	int is_js = (id_len > 3 && strcmp(id+id_len-3, ".js") == 0);
+	const char *ext = is_js ? "" : ".js";
+
+	duk_push_sprintf(ctx, "%s%s%s", mod_home, id, ext); // [ id require exports module path ]
+	const char *path = duk_get_string(ctx, -1);
+	const char *data;
+	size_t data_len;
+	uint32_t flags;
+	if (find_bundle_module(ctx, id, ext, &data, &data_len, &flags) == 0) {
+		if (flags == bundle_bytecode) {
+			load_module_bytecode(ctx, data, data_len);
+			call_module_func(ctx);
+			return 0;
+		}
+		duk_push_lstring(ctx, data, data_len);
+		return run_module_source(ctx, path);
+	}
+
+	duk_push_sprintf(ctx, "%s%s", mod_home, id); // [ id require exports module path name ]
+	const char *name = duk_get_string(ctx, -1);
+	if (is_js) {
+		if (push_mod_source(ctx, name, "")) {
+			return run_module_source(ctx, path);
+		}
+		return duk_error(ctx, DUK_ERR_ERROR, "module not found: %s", id);
+	}
+
+	int cached = use_mod_cache(ctx);
+	mod_kind_t kind = cached ? lookup_mod(name) : mod_unknown;
+
+	if (kind == mod_unknown || kind == mod_js) {
+		if (push_mod_source(ctx, name, ".js")) {
+			if (cached && kind == mod_unknown) {
+				save_mod(name, mod_js);
+			}
+			return run_module_source(ctx, path);
+		}
+		kind = mod_unknown;
+	}
+
+	if (kind == mod_unknown || kind == mod_dll) {
+		if (push_mod_dll(ctx, name, id)) {
+			if (cached && kind == mod_unknown) {
+				save_mod(name, mod_dll);
+			}
+			duk_put_prop_string(ctx, 3, "exports"); // replace exports table with module's exports
+			return 0;
+		}
+		if (cached) {
+			save_mod(name, mod_native);
+		}
+	}
+
+	if (push_native_module(ctx, mod_home, id)) {
+		duk_put_prop_string(ctx, 3, "exports");
+		return 0;
+	}
+	return duk_error(ctx, DUK_ERR_ERROR, "module not found: %s", id);
+}
+
+#define MAX_PATH_LEN 512
+// `mod_path`/modules/, or the `modules` dir beside the executive if mod_path is NULL.
+static char *get_mod_home(const char *mod_path)
+{
+	char *mod_home = NULL;
+	if (mod_path == NULL) {
+		size_t len = MAX_PATH_LEN;
+		char *exePath = malloc(len);
+		if (exePath == NULL) {
+			return NULL;
+		}
+		getExePath(exePath, len);
+
+		char *exeDir = dirname(exePath);
+		if (asprintf(&mod_home, "%s/modules/", exeDir) < 0) {
+			mod_home = NULL;
+		}
+		free(exePath);
+	} else {
+		if (asprintf(&mod_home, "%s/modules/", mod_path) < 0) {
+			mod_home = NULL;
+		}
+	}
+	return mod_home;
+}
+
+static void set_modSearch(duk_context *ctx, const char *mod_path)
+{
+	env_state_t *state = get_env_state(ctx);
+	state->mod_home = get_mod_home(mod_path);
+
+	if (state->mod_home != NULL) {
+		// `mod_path`/modules.bundle, mounted if it exists
+		char *bundle_file;
+		if (asprintf(&bundle_file, "%.*s.bundle", (int)strlen(state->mod_home)-1, state->mod_home) >= 0) {
+			state->bundle = acquire_bundle(bundle_file);
+			free(bundle_file);
+		}
+	}
+
+	duk_get_global_string(ctx, "Duktape");     // [ Duktape ]
+	duk_push_c_function(ctx, modSearch, 4);    // [ Duktape modSearch ]
+	duk_put_prop_string(ctx, -2, "modSearch"); // [ Duktape ] with Duktape.modSearch = modSearch
+	duk_pop(ctx);
+}
+
+/**
+ * warming of modules: the dependency graph of an entry script is found by scanning
+ * `require('...')` literals, and all the modules are read and compiled to the code cache
+ * by a pool of threads, each of which has its own heap for compiling.
+ */
+typedef struct warm_mod {
+	char *id;       // NULL for the entry script
+	char *path;
+	int status;
+	long read_us;
+	long compile_us;
+	struct warm_mod *next;
+} warm_mod_t;
+
+typedef struct {
+	char *mod_home;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	warm_mod_t *mods;   // all the modules found, in the order of finding
+	warm_mod_t *tail;
+	warm_mod_t *next;   // the next one to be warmed
+	int running;        // count of modules being warmed
+	int nthreads;
+	pthread_t *threads;
+} warm_t;
+
+static long elapsed_us(struct timespec *from) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) * 1000000L + (now.tv_nsec - from->tv_nsec) / 1000;
+}
+
+/*
+ * resolve the id required by the module `parent` as Duktape does: terms "." and ".." of
+ * a relative id are resolved against the dir of parent. NULL if the id is invalid.
+ */
+static char *resolve_mod_id(const char *parent, const char *req, size_t req_len) {
+	char *id = malloc(strlen(parent) + req_len + 2);
+	if (id == NULL) {
+		return NULL;
+	}
+	size_t n = 0;
+	if (req[0] == '.') {
+		const char *slash = strrchr(parent, '/');
+		if (slash != NULL) {
+			n = slash - parent;
+			memcpy(id, parent, n);
+		}
+	}
+
+	const char *p = req, *end = req + req_len;
+	while (p < end) {
+		const char *term = p;
+		while (p < end && *p != '/') {
+			p++;
+		}
+		size_t len = p - term;
+		if (p < end) {
+			p++;
+		}
+		if (len == 0) {
+			free(id);
+			return NULL;
+		}
+		if (len == 1 && term[0] == '.') {
+			continue;
+		}
+		if (len == 2 && term[0] == '.' && term[1] == '.') {
+			if (n == 0) {
+				free(id);
+				return NULL;
+			}
+			while (n > 0 && id[n-1] != '/') {
+				n--;
+			}
+			if (n > 0) {
+				n--;
+			}
+			continue;
+		}
+		if (n > 0) {
+			id[n++] = '/';
+		}
+		memcpy(id+n, term, len);
+		n += len;
+	}
+	id[n] = '\0';
+	return (n > 0) ? id : (free(id), NULL);
+}
+
+static int is_ident_char(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$' || c == '.';
+}
+
+// add a module required by parent, if it is not found before. called with w->lock locked.
+static void add_warm_mod(warm_t *w, const char *parent, const char *req, size_t req_len) {
+	char *id = resolve_mod_id(parent, req, req_len);
+	if (id == NULL) {
+		return;
+	}
+	warm_mod_t *m;
+	for (m=w->mods; m!=NULL; m=m->next) {
+		if (m->id != NULL && strcmp(m->id, id) == 0) {
+			free(id);
+			return;
+		}
+	}
+	if ((m = (warm_mod_t*)calloc(1, sizeof(warm_mod_t))) == NULL) {
+		free(id);
+		return;
+	}
+	size_t id_len = strlen(id);
+	int is_js = (id_len > 3 && strcmp(id+id_len-3, ".js") == 0);
+	if (asprintf(&m->path, "%s%s%s", w->mod_home, id, is_js ? "" : ".js") < 0) {
+		free(m);
+		free(id);
+		return;
+	}
+	m->id = id;
+	w->tail->next = m;
+	w->tail = m;
+	if (w->next == NULL) {
+		w->next = m;
+	}
+}
+
+// scan `require('...')` literals in src, and add the modules required.
+static void scan_requires(warm_t *w, const char *parent, const char *src, size_t len) {
+	const char *p = src, *end = src + len;
+	pthread_mutex_lock(&w->lock);
+	while ((p = memchr(p, 'r', end-p)) != NULL) {
+		if (end-p < 7 || memcmp(p, "require", 7) != 0 || (p > src && is_ident_char(p[-1]))) {
+			p++;
+			continue;
+		}
+		p += 7;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+		if (p >= end || *p != '(') {
+			continue;
+		}
+		p++;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+		if (p >= end || (*p != '\'' && *p != '"')) {
+			continue;
+		}
+		char quote = *p++;
+		const char *req = p;
+		while (p < end && *p != quote && *p != '\\' && *p != '\n') {
+			p++;
+		}
+		if (p < end && *p == quote && p > req) {
+			add_warm_mod(w, parent, req, p - req);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+// read the module, scan its requires and compile it to the code cache.
+static void warm_module(warm_t *w, duk_context *ctx, warm_mod_t *m) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	if (read_module_file(m->path, &src, &size, &free_file) != 0) {
+		m->status = -1;
+		return;
+	}
+	m->read_us = elapsed_us(&start);
+
+	scan_requires(w, (m->id != NULL) ? m->id : "", src, size);
+	if (m->id == NULL) {
+		free_file(src, size);
+		return; // the entry script is not a module
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t hash = hash_source(src, size);
+	code_entry_t *e = acquire_code(m->path, hash, size);
+	if (e != NULL) {
+		release_code(e);
+	} else {
+		duk_push_lstring(ctx, src, size);
+		if (compile_module(ctx, m->path) == 0) {
+			duk_dump_function(ctx);
+			size_t code_len;
+			void *code = duk_get_buffer(ctx, -1, &code_len);
+			save_code(m->path, hash, size, code, code_len);
+		} else {
+			m->status = -2;
+		}
+		duk_pop(ctx);
+	}
+	free_file(src, size);
+	m->compile_us = elapsed_us(&start);
+}
+
+static void *warm_worker(void *arg) {
+	warm_t *w = (warm_t*)arg;
+	duk_context *ctx = duk_create_heap_default();
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (w->next == NULL && w->running > 0) {
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+		if (w->next == NULL) {
+			break;
+		}
+		warm_mod_t *m = w->next;
+		w->next = m->next;
+		w->running++;
+		pthread_mutex_unlock(&w->lock);
+
+		if (ctx != NULL) {
+			warm_module(w, ctx, m);
+		} else {
+			m->status = -3;
+		}
+
+		pthread_mutex_lock(&w->lock);
+		w->running--;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if (ctx != NULL) {
+		duk_destroy_heap(ctx);
+	}
+	return NULL;
+}
+
+static void free_warm(warm_t *w) {
+	warm_mod_t *m, *next;
+	for (m=w->mods; m!=NULL; m=next) {
+		next = m->next;
+		free(m->id);
+		free(m->path);
+		free(m);
+	}
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	free(w->threads);
+	free(w->mod_home);
+	free(w);
+}
+
+void *js_warm_modules(const char *mod_path, const char *entry_script, int nthreads)
+{
+	if (nthreads <= 0) {
+		nthreads = 4;
+	}
+	warm_t *w = (warm_t*)calloc(1, sizeof(warm_t));
+	if (w == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	w->mod_home = get_mod_home(mod_path);
+	w->threads = (pthread_t*)malloc(sizeof(pthread_t)*nthreads);
+	w->mods = (warm_mod_t*)calloc(1, sizeof(warm_mod_t));
+	if (w->mod_home == NULL || w->threads == NULL || w->mods == NULL || (w->mods->path = strdup(entry_script)) == NULL) {
+		free_warm(w);
+		return NULL;
+	}
+	w->tail = w->next = w->mods;
+
+	for (w->nthreads=0; w->nthreads<nthreads; w->nthreads++) {
+		if (pthread_create(&w->threads[w->nthreads], NULL, warm_worker, w) != 0) {
+			break;
+		}
+	}
+	if (w->nthreads == 0) {
+		free_warm(w);
+		return NULL;
+	}
+	return w;
+}
+
+int js_warm_modules_wait(void *warm, fn_warm_report report, void *udd)
+{
+	warm_t *w = (warm_t*)warm;
+	int i;
+	for (i=0; i<w->nthreads; i++) {
+		pthread_join(w->threads[i], NULL);
+	}
+
+	int count = 0;
+	warm_mod_t *m;
+	for (m=w->mods->next; m!=NULL; m=m->next) {
+		if (m->status == 0) {
+			count++;
+		}
+		if (report != NULL) {
+			report(udd, m->id, m->path, m->status, m->read_us, m->compile_us);
+		}
+	}
+	free_warm(w);
+	return count;
+}
+
+// a module loaded by dlopen() is kept loaded by the envs using it, and dlopen() returns it again.
+static int is_dll_module(const char *mod_home, const char *id, size_t id_len) {
+	char *path;
+	if (asprintf(&path, "%s%.*s.js", mod_home, (int)id_len, id) < 0) {
+		return 0;
+	}
+	struct stat st;
+	int dll = 0;
+	if (stat(path, &st) != 0) {
+		strcpy(path+strlen(path)-3, ".so");
+		dll = (stat(path, &st) == 0);
+	}
+	free(path);
+	return dll;
+}
+
+int js_invalidate_module(void *env, const char *id)
+{
+	duk_context *ctx = (duk_context*)env;
+	env_state_t *state = get_env_state(ctx);
+	size_t id_len = strlen(id);
+	int is_js = (id_len > 3 && strcmp(id+id_len-3, ".js") == 0);
+	int found = 0;
+
+	// a module in the mounted bundle is required instead of its file, so it is not reloaded.
+	const char *data;
+	size_t data_len;
+	uint32_t flags;
+	duk_push_lstring(ctx, id, is_js ? id_len-3 : id_len);
+	int bundled = (find_bundle_module(ctx, duk_get_string(ctx, -1), ".js", &data, &data_len, &flags) == 0);
+	duk_pop(ctx);
+	if (bundled || (!is_js && state->mod_home != NULL && is_dll_module(state->mod_home, id, id_len))) {
+		return -2;
+	}
+
+	duk_get_global_string(ctx, "Duktape");     // [ Duktape ]
+	duk_get_prop_string(ctx, -1, "modLoaded"); // [ Duktape modLoaded ]
+	if (duk_is_object(ctx, -1)) {
+		// a module required as `id` or `id`.js
+		duk_push_string(ctx, id);
+		if (is_js) {
+			duk_push_lstring(ctx, id, id_len-3);
+		} else {
+			duk_push_sprintf(ctx, "%s.js", id);
+		}                                      // [ Duktape modLoaded id id2 ]
+		if (duk_has_prop_string(ctx, -3, duk_get_string(ctx, -2))) {
+			duk_del_prop_string(ctx, -3, duk_get_string(ctx, -2));
+			found = 1;
+		}
+		if (duk_has_prop_string(ctx, -3, duk_get_string(ctx, -1))) {
+			duk_del_prop_string(ctx, -3, duk_get_string(ctx, -1));
+			found = 1;
+		}
+		duk_pop_2(ctx);
+	}
+	duk_pop_2(ctx);
+
+	if (state->mod_home != NULL) {
+		char *name;
+		if (asprintf(&name, "%s%.*s", state->mod_home, (int)(is_js ? id_len-3 : id_len), id) >= 0) {
+			char *path;
+			forget_mod(name);
+			if (asprintf(&path, "%s.js", name) >= 0) {
+				forget_code(path);
+				free(path);
+			}
+			free(name);
+		}
+	}
+	return found ? 0 : -1;
+}
+
+/**
+ * the module watcher: a thread watching `mod_home` and its subdirs with inotify records the ids
+ * of changed .js files. .so files are not watched, because they can't be reloaded. the changes are applied to an env by js_apply_module_changes() in
+ * the thread using the env, because an env can't be touched by the watcher thread.
+ */
+typedef struct changed_mod {
+	char *id;
+	unsigned long gen;  // the generation of the watcher when the module changed
+	struct changed_mod *next;
+} changed_mod_t;
+
+typedef struct {
+	int wd;
+	char *dir; // dir relative to mod_home, "" or ending with '/'
+} watched_dir_t;
+
+typedef struct {
+	char *mod_home;
+	int fd;
+	int stop_pipe[2];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	changed_mod_t *changes;
+	unsigned long gen;
+	watched_dir_t *dirs;
+	int ndirs;
+} mod_watcher_t;
+
+#ifndef Darwin
+static void watch_dir(mod_watcher_t *w, const char *dir) {
+	char *path;
+	if (asprintf(&path, "%s%s", w->mod_home, dir) < 0) {
+		return;
+	}
+	int wd = inotify_add_watch(w->fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ONLYDIR);
+	if (wd < 0) {
+		free(path);
+		return;
+	}
+	watched_dir_t *dirs = (watched_dir_t*)realloc(w->dirs, sizeof(watched_dir_t)*(w->ndirs+1));
+	char *d = strdup(dir);
+	if (dirs == NULL || d == NULL) {
+		if (dirs != NULL) {
+			w->dirs = dirs;
+		}
+		free(d);
+		free(path);
+		return;
+	}
+	w->dirs = dirs;
+	w->dirs[w->ndirs].wd = wd;
+	w->dirs[w->ndirs].dir = d;
+	w->ndirs++;
+
+	DIR *dp = opendir(path);
+	free(path);
+	if (dp == NULL) {
+		return;
+	}
+	struct dirent *de;
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_type == DT_DIR && de->d_name[0] != '.') {
+			char *sub;
+			if (asprintf(&sub, "%s%s/", dir, de->d_name) >= 0) {
+				watch_dir(w, sub);
+				free(sub);
+			}
+		}
+	}
+	closedir(dp);
+}
+
+static void add_change(mod_watcher_t *w, const char *dir, const char *file) {
+	size_t len = strlen(file);
+	if (len <= 3 || strcmp(file+len-3, ".js") != 0) {
+		return;
+	}
+	char *id;
+	if (asprintf(&id, "%s%.*s", dir, (int)len-3, file) < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	changed_mod_t *c;
+	for (c=w->changes; c!=NULL; c=c->next) {
+		if (strcmp(c->id, id) == 0) {
+			break;
+		}
+	}
+	if (c == NULL) {
+		if ((c = (changed_mod_t*)malloc(sizeof(changed_mod_t))) == NULL) {
+			pthread_mutex_unlock(&w->lock);
+			free(id);
+			return;
+		}
+		c->id = id;
+		c->next = w->changes;
+		w->changes = c;
+	} else {
+		free(id);
+	}
+	c->gen = w->gen + 1;
+	__atomic_store_n(&w->gen, w->gen + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *watcher_thread(void *arg) {
+	mod_watcher_t *w = (mod_watcher_t*)arg;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd fds[2] = {{w->fd, POLLIN, 0}, {w->stop_pipe[0], POLLIN, 0}};
+
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents != 0) {
+			break;
+		}
+		ssize_t n = read(w->fd, buf, sizeof(buf));
+		if (n <= 0) {
+			continue;
+		}
+		char *p;
+		for (p=buf; p<buf+n; p+=sizeof(struct inotify_event)+((struct inotify_event*)p)->len) {
+			struct inotify_event *ev = (struct inotify_event*)p;
+			if (ev->len == 0) {
+				continue;
+			}
+			int i;
+			for (i=0; i<w->ndirs && w->dirs[i].wd != ev->wd; i++);
+			if (i == w->ndirs) {
+				continue;
+			}
+			if (ev->mask & IN_ISDIR) {
+				if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+					char *sub;
+					if (asprintf(&sub, "%s%s/", w->dirs[i].dir, ev->name) >= 0) {
+						watch_dir(w, sub);
+						free(sub);
+					}
+				}
+				continue;
+			}
+			if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) {
+				add_change(w, w->dirs[i].dir, ev->name);
+			}
+		}
+	}
+	return NULL;
+}
+#endif
+
+static void free_watcher(mod_watcher_t *w) {
+	changed_mod_t *c, *next;
+	for (c=w->changes; c!=NULL; c=next) {
+		next = c->next;
+		free(c->id);
+		free(c);
+	}
+	int i;
+	for (i=0; i<w->ndirs; i++) {
+		free(w->dirs[i].dir);
+	}
+	free(w->dirs);
+	if (w->fd >= 0) {
+		close(w->fd);
+	}
+	if (w->stop_pipe[0] >= 0) {
+		close(w->stop_pipe[0]);
+		close(w->stop_pipe[1]);
+	}
+	pthread_mutex_destroy(&w->lock);
+	free(w->mod_home);
+	free(w);
+}
+
+void *js_watch_modules(const char *mod_path)
+{
+#ifdef Darwin
+	return NULL;
+#else
+	mod_watcher_t *w = (mod_watcher_t*)calloc(1, sizeof(mod_watcher_t));
+	if (w == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	w->fd = -1;
+	w->stop_pipe[0] = w->stop_pipe[1] = -1;
+	if ((w->mod_home = get_mod_home(mod_path)) == NULL ||
+		(w->fd = inotify_init1(IN_CLOEXEC)) < 0 ||
+		pipe(w->stop_pipe) != 0) {
+		free_watcher(w);
+		return NULL;
+	}
+	watch_dir(w, "");
+	if (w->ndirs == 0 || pthread_create(&w->thread, NULL, watcher_thread, w) != 0) {
+		free_watcher(w);
+		return NULL;
+	}
+	return w;
+#endif
+}
+
+void js_unwatch_modules(void *watcher)
+{
+	mod_watcher_t *w = (mod_watcher_t*)watcher;
+	if (w == NULL) {
+		return;
+	}
+	if (write(w->stop_pipe[1], "", 1) == 1) {
+		pthread_join(w->thread, NULL);
+	}
+	free_watcher(w);
+}
+
+int js_apply_module_changes(void *env, void *watcher)
+{
+	duk_context *ctx = (duk_context*)env;
+	env_state_t *state = get_env_state(ctx);
+	mod_watcher_t *w = (mod_watcher_t*)watcher;
+	if (w == NULL || __atomic_load_n(&w->gen, __ATOMIC_ACQUIRE) == state->watch_gen) {
+		return 0;
+	}
+
+	// the ids are copied, the modules are invalidated without holding the lock.
+	duk_idx_t n = 0;
+	duk_push_array(ctx); // [ ids ]
+	pthread_mutex_lock(&w->lock);
+	changed_mod_t *c;
+	for (c=w->changes; c!=NULL; c=c->next) {
+		if (c->gen > state->watch_gen) {
+			duk_push_string(ctx, c->id);
+			duk_put_prop_index(ctx, -2, n++);
+		}
+	}
+	state->watch_gen = w->gen;
+	pthread_mutex_unlock(&w->lock);
+
+	int count = 0;
+	duk_idx_t i;
+	for (i=0; i<n; i++) {
+		duk_get_prop_index(ctx, -1, i);
+		if (js_invalidate_module(env, duk_get_string(ctx, -1)) == 0) {
+			count++;
+		}
+		duk_pop(ctx);
+	}
+	duk_pop(ctx);
+	return count;
+}
+
+void* js_create_env(const char *mod_path)
+{
+	env_state_t *state = (env_state_t*)calloc(1, sizeof(env_state_t));
+	if (state == NULL) {
+		return NULL;
+	}
+	int i;
+	for (i=0; i<LOADER_BUCKETS; i++) {
+		state->ext_buckets[i] = -1;
+	}
+	duk_context *ctx = duk_create_heap(env_alloc, env_realloc, env_free, state, NULL);
+	if (ctx == NULL) {
+		free(state);
+		return NULL;
+	}
+	duk_print_alert_init(ctx, 0);
+	duk_console_init(ctx, 0);
+	duk_module_duktape_init(ctx);
+	init_global_funcs(ctx);
+	set_modSearch(ctx, mod_path);
+	return ctx;
+}
+
+void js_destroy_env(void *env)
+{
+	duk_context *ctx = (duk_context*)env;
+	env_state_t *state = get_env_state(ctx);
+	duk_destroy_heap(ctx);
+	int i;
+	for (i=0; i<state->loader_count; i++) {
+		free(state->loaders[i].mod_ext);
+	}
+	free(state->loaders);
+	if (state->bundle != NULL) {
+		release_bundle(state->bundle);
+	}
+	if (state->loop != NULL) {
+		free_loop(state->loop);
+	}
+	free(state->mod_home);
+	free(state);
+}
+
+int js_register_var(void *env, const char *var_name, arg_format_t val_type, void **val, size_t val_size)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_push_global_object(ctx); // [ global ]
+	module_attr_t attr = {var_name, val_type, *val, val_size};
+	js_add_module_attr(env, &attr);
+	duk_pop(ctx);
+	return 0;
+}
+
+int js_register_code_func(void *env, const char *js_code, size_t len, const char *func_name)
+{
+	duk_context *ctx = (duk_context*)env;
+
+	duk_push_global_object(ctx);        // [ global ]
+	duk_push_string(ctx, func_name);    // [ global, func_name ]
+	if (duk_pcompile_lstring(ctx, DUK_COMPILE_FUNCTION, js_code, len) != 0) {
+		fprintf(stderr, "failed to compile script to %s: %s\n", func_name, duk_safe_to_string(ctx, -1));
+		duk_pop_3(ctx);
+		return -1;
+	}
+	// [ global, func_name, function ]
+
+	duk_bool_t rc = duk_put_prop(ctx, -3); // [ global ] with global[func_name] = function
+	if (rc != 1) {
+		fprintf(stderr, "failed to binding script with %s\n", func_name);
+		duk_pop(ctx);
+		return -2;
+	}
+
+	duk_pop(ctx);
+	return 0;
+}
+
+int js_register_file_func(void *env, const char *script_file, const char *func_name)
+{
+	duk_context *ctx = (duk_context*)env;
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_file_content(ctx, script_file, &src, &size, &free_file);
+	if (ret != 0) {
+		return ret;
+	}
+	
+	duk_push_global_object(ctx);        // [ global ]
+	duk_push_string(ctx, func_name);    // [ global, func_name ]
+	duk_push_string(ctx, script_file);  // [ global, func_name, script_file ]
+	if (duk_pcompile_lstring_filename(ctx, DUK_COMPILE_FUNCTION, src, size) != 0) {
+		fprintf(stderr, "failed to compile %s: %s\n", script_file, duk_safe_to_string(ctx, -1));
+		duk_pop_3(ctx);
+		free_file(src, size);
+		return -6;
+	}
+	free_file(src, size);
+	// [ global, func_name, function ]
+
+	duk_bool_t rc = duk_put_prop(ctx, -3); // [ global ] with global[func_name] = function
+	if (rc != 1) {
+		fprintf(stderr, "failed to binding %s with %s\n", script_file, func_name);
+		duk_pop(ctx);
+		return -7;
+	}
+
+	duk_pop(ctx);
+	return 0;
+}
+
+int js_unregister_func(void *env, const char *func_name)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_push_global_object(ctx);        // [ global ]
+	int rc = duk_del_prop_string(ctx, -1, func_name);
+	duk_pop(ctx);
+	return rc;
+}
+
+static void call_result_callback(duk_context *ctx, fn_call_func_res call_func_res, void *udd) {
+	size_t len;
+	void *res;
+	res_type_t res_type;
+	double d;
+	switch (duk_get_type(ctx, -1)) {
+	case DUK_TYPE_UNDEFINED:
+	case DUK_TYPE_NULL:
+		res_type = rt_none;
+		res = NULL;
+		break;
+	case DUK_TYPE_BOOLEAN:
+		res_type = rt_bool;
+		res = (void*)(long)duk_get_boolean(ctx, -1);
+		break;
+	case DUK_TYPE_NUMBER:
+		res_type = rt_double;
+		d = duk_get_number(ctx, -1);
+		res = double2voidp(d);
+		break;
+	case DUK_TYPE_STRING:
+		res_type = rt_string;
+		res = (void*)duk_get_lstring(ctx, -1, &len);
+		break;
+	case DUK_TYPE_BUFFER:
+		res_type = rt_buffer;
+		res = (void*)duk_get_buffer(ctx, -1, &len);
+		break;
+	case DUK_TYPE_OBJECT:
+		if (duk_is_ecmascript_function(ctx, -1)) {
+			res_type = rt_func;
+			// copy the function to the top
+			duk_push_null(ctx);   // [ ... null ]
+			duk_copy(ctx, -2, -1); // [ ... func ]
+			unsigned long func_index = save_top_object(ctx); // [ ... ]
+			res = (void*)func_index; // which must be freed by calling js_destropy_ecmascript_func
+			break;
+		}
+		if (duk_is_buffer_data(ctx, -1)) {
+			res_type = rt_buffer;
+			res = (void*)duk_get_buffer_data(ctx, -1, &len);
+			break;
+		}
+		if (duk_is_error(ctx, -1)) {
+			res_type = rt_error;
+			res = (void*)duk_safe_to_lstring(ctx, -1, &len);
+			break;
+		}
+	default:
+		res_type = duk_is_array(ctx, -1) ? rt_array : rt_object;
+		duk_json_encode(ctx, -1);
+		res = (void*)duk_get_lstring(ctx, -1, &len);
+		break;
+	}
+	call_func_res(udd, res_type, res, len);
+}
+
+static int call_func(duk_context *ctx, int argc, const char *func_name, fn_call_func_res call_func_res, void *udd) {
+	// [ func, args ... ]
+	duk_int_t rc = duk_pcall(ctx, argc); // [ retval ]
+	if (call_func_res != NULL) {
+		call_result_callback(ctx, call_func_res, udd);
+	}
+	duk_pop(ctx);
+	return (rc == DUK_EXEC_SUCCESS) ? 0 : -2;
+}
+
+static int push_args_and_call_func(duk_context *ctx, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+{
+	// [ func ]
+	if (fmt == NULL || *fmt == '\0') {
+		return call_func(ctx, 0, func_name, call_func_res, udd);
+	}
+
+	int argc = 0;
+	char *s;
+	size_t l;
+	int d;
+	int i = 0;
+	int nx = 0; // count of external buffers
+	duk_idx_t func_idx = duk_get_top_index(ctx);
+	unsigned long func_index;
+	void *objUdd;
+	fn_create_ecmascript_instance create_ecmascript_instance;
+	while (*fmt) {
+		argc++;
+		switch (*fmt++) {
+		case af_none:
+			i++; //skip it
+			duk_push_null(ctx);
+			break;
+		case af_bool:
+			d = (int)(long)argv[i++];
+			duk_push_boolean(ctx, d);
+			break;
+		case af_int:
+			d = (int)(long)argv[i++];
+			duk_push_int(ctx, d);
+			break;
+		case af_double:
+			duk_push_number(ctx, voidp2double(argv[i++]));
+			break;
+		case af_zstring:
+			s = (char*)argv[i++];
+			duk_push_string(ctx, s);
+			break;
+		case af_lstring:
+			l = (size_t)argv[i++];
+			s = (char*)argv[i++];
+			duk_push_lstring(ctx, s, l);
+			break;
+		case af_error:
+			l = (size_t)argv[i++];
+			s = (char*)argv[i++];
+			duk_generic_error(ctx, "%.*s", (int)l, s);
+			break;
+		case af_buffer:
+			l = (size_t)argv[i++];
+			s = (char*)argv[i++];
+			duk_push_lstring(ctx, s, l);
+			duk_to_buffer(ctx, -1, NULL);
+			duk_push_buffer_object(ctx, -1, 0, l, DUK_BUFOBJ_NODEJS_BUFFER);
+			duk_remove(ctx, -2);
+			break;
+		case af_xbuffer:
+			l = (size_t)argv[i++];
+			s = (char*)argv[i++];
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, s, l);
+			duk_dup(ctx, -1);
+			duk_insert(ctx, func_idx); // [ xbuf ... func ... xbuf ], kept to be detached after calling
+			nx++;
+			duk_push_buffer_object(ctx, -1, 0, l, DUK_BUFOBJ_NODEJS_BUFFER);
+			duk_remove(ctx, -2);
+			break;
+		case af_ecmafunc:
+			func_index = (unsigned long)argv[i++];
+			load_object(ctx, func_index); // now the top ctx is [ func ]
+			break;
+		case af_mobject:
+			objUdd = argv[i++];
+			create_ecmascript_instance = (fn_create_ecmascript_instance)argv[i++];
+			if (create_ecmascript_instance == NULL || create_ecmascript_instance(ctx, objUdd) != 0) {
+				duk_push_undefined(ctx);
+			}
+			break;
+		case af_jarray:
+		case af_jobject:
+		default:
+			l = (size_t)argv[i++];
+			s = (char*)argv[i++];
+			duk_push_lstring(ctx, s, l);
+			duk_json_decode(ctx, -1);
+			break;
+		}
+	}
+	// [ xbuf ... func arg1 arg2 ... argn ]
+
+	int ret = call_func(ctx, argc, func_name, call_func_res, udd); // [ xbuf ... ]
+	for (; nx>0; nx--) {
+		// the memory of external buffer belongs to the caller, JS must not access it any more.
+		duk_config_buffer(ctx, -1, NULL, 0);
+		duk_pop(ctx);
+	}
+	return ret;
+}
+
+int js_call_registered_func(void *env, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+{
+	duk_context *ctx = (duk_context*)env;
+	if (!duk_get_global_string(ctx, func_name)) {
+		duk_pop(ctx);
+		return -1;
+	}
+	// [ func ]
+
+	return push_args_and_call_func(ctx, func_name, call_func_res, udd, fmt, argv);
+}
+
+int js_call_file_func(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+{
+	duk_context *ctx = (duk_context*)env;
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_file_content(ctx, script_file, &src, &size, &free_file);
+	if (ret != 0) {
+		return ret;
+	}
+	ret = duk_pcompile_lstring(ctx, DUK_COMPILE_FUNCTION, src, size);
+	free_file(src, size);
+
+	if (ret != 0) {
+		fprintf(stderr, "failed to compile %s: %s\n", script_file, duk_safe_to_string(ctx, -1));
+		duk_pop(ctx);
+		return -1;
+	}
+	// [ func ]
+
+	return push_args_and_call_func(ctx, script_file, call_func_res, udd, fmt, argv);
+}
+
+int js_eval(void *env, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_int_t ret = duk_peval_lstring(ctx, js_code, len); // [ retval ]
+	if (call_func_res != NULL) {
+		call_result_callback(ctx, call_func_res, udd);
+	}
+	duk_pop(ctx);
+	return (ret == 0) ? 0: -1;
+}
+
+int js_eval_file(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_file_content(ctx, script_file, &src, &size, &free_file);
+	if (ret != 0) {
+		if (ret == -1 && call_func_res != NULL) {
+			duk_push_error_object(ctx, DUK_ERR_ERROR, "%s not found", script_file);
+			call_result_callback(ctx, call_func_res, udd);
+			duk_pop(ctx);
+		}
+		return ret;
+	}
+
+	ret = js_eval(env, src, size, call_func_res, udd);
+	free_file(src, size);
+	return ret;
+}
+
+int js_check_syntax(void *env, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_int_t ret = duk_pcompile_lstring(ctx, 0, js_code, len); // [ retval ]
+	if (call_func_res != NULL) {
+		if (ret == 0) {
+			// syntax ok, return undefined
+			duk_push_undefined(ctx);
+			duk_remove(ctx, -2);
+		} 
+		call_result_callback(ctx, call_func_res, udd);
+	}
+	duk_pop(ctx);
+	return (ret == 0) ? 0: -1;
+}
+
+int js_check_syntax_file(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	char *src;
+	size_t size;
+	fn_free_file free_file;
+	int ret = read_file_content(ctx, script_file, &src, &size, &free_file);
+	if (ret != 0) {
+		if (ret == -1 && call_func_res != NULL) {
+			duk_push_error_object(ctx, DUK_ERR_ERROR, "%s not found", script_file);
+			call_result_callback(ctx, call_func_res, udd);
+			duk_pop(ctx);
+		}
+		return ret;
+	}
+
+	ret = js_check_syntax(env, src, size, call_func_res, udd);
+	free_file(src, size);
+	return ret;
+}
+
+int js_dump_module(void *env, const char *js_code, size_t len, const char *file_name, fn_call_func_res call_func_res, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_push_lstring(ctx, js_code, len);
+	duk_int_t ret = compile_module(ctx, file_name != NULL ? file_name : "module"); // [ func ]
+	if (ret == 0) {
+		duk_dump_function(ctx);                 // [ bytecode ]
+	}
+	if (call_func_res != NULL) {
+		call_result_callback(ctx, call_func_res, udd);
+	}
+	duk_pop(ctx);
+	return (ret == 0) ? 0 : -1;
+}
 
-	duk_push_global_object(ctx);        // [ global ]
-	duk_push_string(ctx, func_name);    // [ global, func_name ]
-	if (duk_pcompile_lstring(ctx, DUK_COMPILE_FUNCTION, js_code, len) != 0) {
-		fprintf(stderr, "failed to compile script to %s: %s\n", func_name, duk_safe_to_string(ctx, -1));
-		duk_pop_3(ctx);
-		return -1;
+/*
+ * convert the arguments of a native function in ctx to fmt and args. the strings, buffers and
+ * JSON in args are valid until the arguments are removed from ctx.
+ * @return the memory of fmt and args to be freed, NULL if failed.
+ */
+static char *get_native_args(duk_context *ctx, duk_idx_t nargs, char **pfmt, void ***pargs)
+{
+	char *p = (char*)malloc(sizeof(void*) * 2 * nargs + nargs + 1);
+	if (p == NULL) {
+		return NULL;
+	}
+	void **args = (void**)p;
+	char *fmt = p + (sizeof(void*) * 2 * nargs);
+	int i, j;
+	double d;
+	duk_int_t type;
+	duk_size_t len;
+	for (i=0, j=0; i<nargs; i++) {
+		switch (duk_get_type(ctx, i)) {
+		case DUK_TYPE_UNDEFINED:
+		case DUK_TYPE_NULL:
+			fmt[i] = af_none;
+			args[j++] = NULL;
+			break;
+		case DUK_TYPE_BOOLEAN:
+			fmt[i] = af_bool;
+			args[j++] = (void*)(long)duk_get_boolean(ctx, i);
+			break;
+		case DUK_TYPE_NUMBER:
+			fmt[i] = af_double;
+			d = duk_get_number(ctx, i);
+			args[j++] = double2voidp(d);
+			break;
+		case DUK_TYPE_STRING:
+			fmt[i] = af_lstring;
+			args[j+1] = (void*)duk_get_lstring(ctx, i, &len);
+			args[j] = (void*)len;
+			j += 2;
+			break;
+		case DUK_TYPE_BUFFER:
+			fmt[i] = af_buffer;
+			args[j+1] = (void*)duk_get_buffer(ctx, i, &len);
+			args[j] = (void*)len;
+			j += 2;
+			break;
+		case DUK_TYPE_OBJECT:
+			if (duk_is_ecmascript_function(ctx, i)) {
+				fmt[i] = af_ecmafunc;
+				// copy the function to the top
+				duk_push_null(ctx);   // [ ... null ]
+				duk_copy(ctx, i, -1); // [ ... func ]
+				unsigned long func_index = save_top_object(ctx); // [ ... ]
+				args[j++] = (void*)func_index; // which must be freed by calling js_destropy_ecmascript_func
+				break;
+			}
+			if (duk_is_buffer_data(ctx, i)) {
+				fmt[i] = af_buffer;
+				args[j+1] = duk_get_buffer_data(ctx, i, &len);
+				args[j] = (void*)len;
+				j += 2;
+				break;
+			}
+		default:
+			fmt[i] = duk_is_array(ctx, i) ? af_jarray : af_jobject;
+			duk_json_encode(ctx, i);
+			args[j+1] = (void*)duk_get_lstring(ctx, i, &len);
+			args[j] = (void*)len;
+			j += 2;
+			break;
+		}
 	}
-	// [ global, func_name, function ]
 
-	duk_bool_t rc = duk_put_prop(ctx, -3); // [ global ] with global[func_name] = function
-	if (rc != 1) {
-		fprintf(stderr, "failed to binding script with %s\n", func_name);
-		duk_pop(ctx);
-		return -2;
+	fmt[nargs] = '\0';
+	*pfmt = fmt;
+	*pargs = args;
+	return p;
+}
+
+// push the result of a native function, an error is thrown for rt_error.
+static duk_ret_t push_native_result(duk_context *ctx, res_type_t res_type, void *cb_res, size_t res_len, fn_free_res free_res)
+{
+	switch (res_type) {
+	case rt_none:
+		return 0;
+	case rt_bool:
+		duk_push_boolean(ctx, (duk_bool_t)(long)cb_res);
+		return 1;
+	case rt_int:
+		duk_push_int(ctx, (duk_int_t)(long)cb_res);
+		return 1;
+	case rt_double:
+		duk_push_number(ctx, (duk_double_t)voidp2double(cb_res));
+		return 1;
+	case rt_string:
+		duk_push_lstring(ctx, (const char*)cb_res, res_len);
+		if (free_res != NULL) {
+			free_res(cb_res);
+		}
+		return 1;
+	case rt_buffer:
+		duk_push_lstring(ctx, (const char*)cb_res, res_len);
+		duk_to_buffer(ctx, -1, NULL);
+		duk_push_buffer_object(ctx, -1, 0, res_len, DUK_BUFOBJ_NODEJS_BUFFER);
+		duk_remove(ctx, -2);
+		if (free_res != NULL) {
+			free_res(cb_res);
+		}
+		return 1;
+	case rt_func:
+		load_object(ctx, (unsigned long)cb_res); // now the top of ctx is [ func ]
+		return 1;
+	case rt_error:
+		return duk_generic_error(ctx, "%.*s", (int)res_len, (const char*)cb_res);
+	case rt_mobject:
+		{
+			fn_create_ecmascript_instance create_ecmascript_instance = (fn_create_ecmascript_instance)cb_res;
+			void *udd = (void*)res_len;
+			if (create_ecmascript_instance == NULL || create_ecmascript_instance(ctx, udd) != 0) {
+				duk_push_undefined(ctx);
+			}
+			return 1;
+		}
+	case rt_object:
+	case rt_array:
+	default:
+		duk_push_lstring(ctx, (const char*)cb_res, res_len);
+		duk_json_decode(ctx, -1);
+		if (free_res != NULL) {
+			free_res(cb_res);
+		}
+		return 1;
+	}
+}
+
+static duk_ret_t native_func_bridge(duk_context *ctx)
+{
+	duk_idx_t nargs = duk_get_top(ctx);                           // [ ... ]
+	duk_push_current_function(ctx);                               // [ ..., native_func_bridge ]
+	duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_FUNC)); // [ ..., native_func_bridge, native_func ]
+	duk_get_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_UDD));  // [ ..., native_func_bridge, native_func, udd ]
+	fn_native_func native_func = (fn_native_func)duk_get_pointer(ctx, -2);
+	void *udd = duk_get_pointer(ctx, -1);	
+	duk_pop_3(ctx);               // [ ... ]
+
+	void *cb_res;
+	res_type_t res_type;
+	size_t res_len;
+	fn_free_res free_res = NULL;
+	if (nargs == 0) {
+		native_func(udd, NULL, NULL, &cb_res, &res_type, &res_len, &free_res);
+	} else {
+		char *fmt;
+		void **args;
+		char *p = get_native_args(ctx, nargs, &fmt, &args);
+		if (p == NULL) {
+			return 0;
+		}
+		native_func(udd, fmt, args, &cb_res, &res_type, &res_len, &free_res);
+		free(p);
+	}
+
+	return push_native_result(ctx, res_type, cb_res, res_len, free_res);
+}
+
+// finalizer of a native_func_bridge owning its udd
+static duk_ret_t free_func_bridge_udd(duk_context *ctx)
+{
+	// [ native_func_bridge ]
+	duk_get_prop_string(ctx, 0, DUK_HIDDEN_SYMBOL(NATIVE_UDD_FREE)); // [ native_func_bridge, free_udd ]
+	duk_get_prop_string(ctx, 0, DUK_HIDDEN_SYMBOL(NATIVE_UDD));      // [ native_func_bridge, free_udd, udd ]
+	fn_free_udd free_udd = (fn_free_udd)duk_get_pointer(ctx, -2);
+	void *udd = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+	if (free_udd != NULL) {
+		duk_del_prop_string(ctx, 0, DUK_HIDDEN_SYMBOL(NATIVE_UDD_FREE)); // udd is freed only once
+		free_udd(udd);
+	}
+	return 0;
+}
+
+static void push_func_bridge(duk_context *ctx, fn_native_func native_func, duk_idx_t nargs, void *udd, fn_free_udd free_udd)
+{
+	duk_push_c_function(ctx, native_func_bridge, nargs); // [ ..., native_func_bridge ]
+	duk_push_pointer(ctx, native_func);                  // [ ..., natvie_func_bridge, native_func ]
+	duk_put_prop_string(ctx, -2, 
+	                    DUK_HIDDEN_SYMBOL(NATIVE_FUNC)); // [ ..., native_func_bridge ] with native_func_bridge[_nf_] = native_func
+	duk_push_pointer(ctx, udd);                          // [ ..., native_func_bridge, udd ]
+	duk_put_prop_string(ctx, -2, 
+	                    DUK_HIDDEN_SYMBOL(NATIVE_UDD));  // [ ..., native_func_bridge ] with native_func_bridge[_nu_] = udd
+	if (free_udd != NULL) {
+		duk_push_pointer(ctx, free_udd);                 // [ ..., native_func_bridge, free_udd ]
+		duk_put_prop_string(ctx, -2,
+		                    DUK_HIDDEN_SYMBOL(NATIVE_UDD_FREE)); // [ ..., native_func_bridge ] with native_func_bridge[_nuf_] = free_udd
+		duk_push_c_function(ctx, free_func_bridge_udd, 2);  // [ ..., native_func_bridge, free_func_bridge_udd ]
+		duk_set_finalizer(ctx, -2);                      // [ ..., native_func_bridge ] with free_func_bridge_udd as finalizer
+	}
+}
+
+static void make_func_bridge(duk_context *ctx, const char *func_name, fn_native_func native_func, duk_idx_t nargs, void *udd, fn_free_udd free_udd)
+{
+	// [ obj ]
+	duk_push_string(ctx, func_name);                     // [ obj, func_name ]
+	push_func_bridge(ctx, native_func, nargs, udd, free_udd); // [ obj, func_name, native_func_bridge ]
+	duk_put_prop(ctx, -3);                               // [ obj ] with obj[func_name] = native_func_bridge
+}
+
+int js_register_native_func(void *env, const char *func_name, fn_native_func native_func, int param_num, void *udd)
+{
+	return js_register_native_func_ex(env, func_name, native_func, param_num, udd, NULL);
+}
+
+int js_register_native_func_ex(void *env, const char *func_name, fn_native_func native_func, int param_num, void *udd, fn_free_udd free_udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	duk_idx_t nargs;
+	if (param_num < 0) {
+		nargs = DUK_VARARGS;
+	} else {
+		nargs = param_num;
 	}
 
+	duk_push_global_object(ctx);                               // [ global ]
+	make_func_bridge(ctx, func_name, native_func, nargs, udd, free_udd); // [ global ] with global[func_name] = native_func_bridge
 	duk_pop(ctx);
 	return 0;
 }
 
-int js_register_file_func(void *env, const char *script_file, const char *func_name)
+int js_unregister_native_func(void *env, const char *func_name)
 {
 	duk_context *ctx = (duk_context*)env;
-	char *src;
-	size_t size;
-	int ret = readFileContent(script_file, &src, &size);
-	if (ret != 0) {
-		return ret;
+	duk_push_global_object(ctx);   // [ global ]
+	if (!duk_get_prop_string(ctx, -1, func_name)) {
+		duk_pop_2(ctx);
+		return -1;
 	}
-	
-	duk_push_global_object(ctx);        // [ global ]
-	duk_push_string(ctx, func_name);    // [ global, func_name ]
-	duk_push_string(ctx, script_file);  // [ global, func_name, script_file ]
-	if (duk_pcompile_lstring_filename(ctx, DUK_COMPILE_FUNCTION, src, size) != 0) {
-		fprintf(stderr, "failed to compile %s: %s\n", script_file, duk_safe_to_string(ctx, -1));
+	// [ global, func ]
+	if (!duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_FUNC))) {
 		duk_pop_3(ctx);
-		free(src);
-		return -6;
+		return -2;
 	}
-	free(src);
-	// [ global, func_name, function ]
+	duk_pop_2(ctx); // [ global ]
+	duk_del_prop_string(ctx, -1, func_name);
+	duk_pop(ctx);
+	return 0;
+}
 
-	duk_bool_t rc = duk_put_prop(ctx, -3); // [ global ] with global[func_name] = function
-	if (rc != 1) {
-		fprintf(stderr, "failed to binding %s with %s\n", script_file, func_name);
-		duk_pop(ctx);
-		return -7;
+int js_call_ecmascript_func(void *env, void *ecma_func, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+{
+	duk_context *ctx = (duk_context*)env;
+	unsigned long func_index = (unsigned long)ecma_func;
+	load_object(ctx, func_index);  // now ctx contains [ func ]
+	return push_args_and_call_func(ctx, "_ecmafunc_", call_func_res, udd, fmt, argv);
+}
+
+void js_destroy_ecmascript_obj(void *env, void *ecma_obj) {
+	duk_context* ctx = (duk_context*)env;
+	unsigned long func_index = (unsigned long)ecma_obj;
+	destroy_object(ctx, func_index);
+}
+
+void* double2voidp(double d) {
+	return (void*)*((long*)&d);
+}
+
+double voidp2double(void* v) {
+	long l = (long)v;
+	return *((double*)(&l));
+}
+
+void js_add_module_loader(void *env, void *udd, const char *mod_ext, fn_load_module load_module, fn_get_methods_list get_methods_list, fn_get_attrs_list get_attrs_list, fn_module_finalizer finalizer)
+{
+	env_state_t *state = get_env_state((duk_context*)env);
+	if (state->loader_count == state->loader_cap) {
+		int cap = (state->loader_cap == 0) ? 4 : state->loader_cap * 2;
+		module_loader_t *loaders = (module_loader_t*)realloc(state->loaders, sizeof(module_loader_t)*cap);
+		if (loaders == NULL) {
+			return;
+		}
+		state->loaders = loaders;
+		state->loader_cap = cap;
 	}
 
-	duk_pop(ctx);
-	return 0;
+	const char *ext = skip_ext_dot(mod_ext);
+	char *ext_copy = strdup(ext != NULL ? ext : "");
+	if (ext_copy == NULL) {
+		return;
+	}
+
+	int index = state->loader_count++;
+	module_loader_t *loader = &state->loaders[index];
+	loader->udd = udd;
+	loader->mod_ext = ext_copy;
+	loader->load_module = load_module;
+	loader->get_methods = get_methods_list;
+	loader->get_attrs = get_attrs_list;
+	loader->finalizer = finalizer;
+	loader->next_same_bucket = -1;
+
+	// append to the bucket to keep the order of adding
+	int *next = &state->ext_buckets[ext_bucket(ext_copy, strlen(ext_copy))];
+	while (*next >= 0) {
+		next = &state->loaders[*next].next_same_bucket;
+	}
+	*next = index;
 }
 
-int js_unregister_func(void *env, const char *func_name)
+int js_create_ecmascript_object(void *env, void *udd, void *mod_handle, fn_get_methods_list get_methods_list, fn_get_attrs_list get_attrs_list, fn_module_finalizer finalizer)
 {
 	duk_context *ctx = (duk_context*)env;
-	duk_push_global_object(ctx);        // [ global ]
-	int rc = duk_del_prop_string(ctx, -1, func_name);
-	duk_pop(ctx);
-	return rc;
+	int ret = init_native_obj(ctx, udd, (const char*)mod_handle, NULL, NULL, NULL, get_methods_list, get_attrs_list, finalizer);
+	switch (ret) {
+	case init_obj_ok:
+		return 0;
+	case failed_to_init_obj:
+	default:
+		return -1;
+	}
 }
 
-static void call_result_callback(duk_context *ctx, fn_call_func_res call_func_res, void *udd) {
+/**
+ * the executor: a pool of threads, each of which owns an env and its queues of jobs. envs
+ * are never shared, so jobs run in parallel safely. a job is queued to the deque of a worker,
+ * and a worker with nothing to do steals half of the deque of a busy one, so a long job never
+ * holds up the jobs queued after it. jobs pinned to a worker are never stolen.
+ */
+enum {
+	job_func,
+	job_eval,
+	job_call
+};
+
+typedef struct {
+	int kind;
+	fn_executor_job func;
+	void *udd;
+	char *code;    // the copy of the code to eval, or the function name to call
 	size_t len;
-	void *res;
-	res_type_t res_type;
-	double d;
-	switch (duk_get_type(ctx, -1)) {
-	case DUK_TYPE_UNDEFINED:
-	case DUK_TYPE_NULL:
-		res_type = rt_none;
-		res = NULL;
-		break;
-	case DUK_TYPE_BOOLEAN:
-		res_type = rt_bool;
-		res = (void*)(long)duk_get_boolean(ctx, -1);
-		break;
-	case DUK_TYPE_NUMBER:
-		res_type = rt_double;
-		d = duk_get_number(ctx, -1);
-		res = double2voidp(d);
+	char *fmt;
+	void **argv;
+	fn_call_func_res call_func_res;
+} exec_job_t;
+
+// a ring of jobs, big enough to hold all the jobs of the executor.
+typedef struct {
+	exec_job_t *jobs;
+	int head;
+	int count;
+} job_ring_t;
+
+struct executor;
+
+typedef struct {
+	struct executor *e;
+	int index;
+	pthread_t thread;
+	pthread_mutex_t lock;  // guards the rings and the counters
+	job_ring_t deque;      // jobs which can be stolen by other workers
+	job_ring_t pinned;     // jobs which must run with the env of this worker
+	exec_job_t *stolen;    // buffer of jobs being stolen
+	struct timespec start;
+	unsigned long jobs_run;
+	unsigned long jobs_stolen;
+	unsigned long long busy_us;
+} exec_worker_t;
+
+typedef struct executor {
+	pthread_mutex_t lock;  // guards the fields below, never held with the lock of a worker
+	pthread_cond_t has_job;
+	pthread_cond_t not_full;
+	pthread_cond_t started_cond;
+	pthread_cond_t no_submitter;
+	int queue_size;
+	int pending;           // count of jobs queued but not taken
+	unsigned long seq;     // increased when a job is queued
+	unsigned int next;     // the worker to queue the next job, round robin
+	int closed;
+	int submitters;        // count of the callers in submit_job()
+	int started;
+	int failed;
+	char *mod_path;
+	fn_executor_init init;
+	void *init_udd;
+	int nthreads;
+	exec_worker_t *workers;
+} executor_t;
+
+static __thread exec_worker_t *cur_worker;
+
+static void ring_push(job_ring_t *r, int size, exec_job_t *job) {
+	r->jobs[(r->head + r->count) % size] = *job;
+	r->count++;
+}
+
+static void ring_pop(job_ring_t *r, int size, exec_job_t *job) {
+	*job = r->jobs[r->head];
+	r->head = (r->head + 1) % size;
+	r->count--;
+}
+
+typedef struct {
+	exec_job_t *job;
+	int called;
+} job_res_t;
+
+static void job_result_received(void *udd, res_type_t res_type, void *res, size_t res_len) {
+	job_res_t *r = (job_res_t*)udd;
+	r->called = 1;
+	if (r->job->call_func_res != NULL) {
+		r->job->call_func_res(r->job->udd, res_type, res, res_len);
+	}
+}
+
+// call_func_res of an eval/call job is called exactly once, with an error if it fails without a result.
+static void run_job(void *env, exec_job_t *job) {
+	job_res_t r = {job, 0};
+	int ret = 0;
+	switch (job->kind) {
+	case job_func:
+		job->func(job->udd, env);
+		r.called = 1;
 		break;
-	case DUK_TYPE_STRING:
-		res_type = rt_string;
-		res = (void*)duk_get_lstring(ctx, -1, &len);
+	case job_eval:
+		ret = js_eval(env, job->code, job->len, job_result_received, &r);
 		break;
-	case DUK_TYPE_BUFFER:
-		res_type = rt_buffer;
-		res = (void*)duk_get_buffer(ctx, -1, &len);
+	case job_call:
+		ret = js_call_registered_func(env, job->code, job_result_received, &r, job->fmt, job->argv);
 		break;
-	case DUK_TYPE_OBJECT:
-		if (duk_is_ecmascript_function(ctx, -1)) {
-			res_type = rt_func;
-			// copy the function to the top
-			duk_push_null(ctx);   // [ ... null ]
-			duk_copy(ctx, -2, -1); // [ ... func ]
-			unsigned long func_index = save_top_object(ctx); // [ ... ]
-			res = (void*)func_index; // which must be freed by calling js_destropy_ecmascript_func
-			break;
+	}
+	if (!r.called && job->call_func_res != NULL) {
+		char err[64];
+		int len = snprintf(err, sizeof(err), "failed to run the job: %d", ret);
+		job->call_func_res(job->udd, rt_error, err, len);
+	}
+	free(job->code);
+}
+
+// take a job of the worker itself, the pinned ones first.
+static int take_own_job(exec_worker_t *w, exec_job_t *job) {
+	int size = w->e->queue_size;
+	int found = 1;
+	pthread_mutex_lock(&w->lock);
+	if (w->pinned.count > 0) {
+		ring_pop(&w->pinned, size, job);
+	} else if (w->deque.count > 0) {
+		ring_pop(&w->deque, size, job);
+	} else {
+		found = 0;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return found;
+}
+
+// steal the older half of the deque of another worker, the 1st one is returned to run at once.
+static int steal_jobs(exec_worker_t *w, exec_job_t *job) {
+	executor_t *e = w->e;
+	int size = e->queue_size;
+	int i, n = 0;
+	for (i=1; i<e->nthreads && n==0; i++) {
+		exec_worker_t *v = &e->workers[(w->index + i) % e->nthreads];
+		pthread_mutex_lock(&v->lock);
+		n = (v->deque.count + 1) / 2;
+		int j;
+		for (j=0; j<n; j++) {
+			ring_pop(&v->deque, size, &w->stolen[j]);
 		}
-		if (duk_is_buffer_data(ctx, -1)) {
-			res_type = rt_buffer;
-			res = (void*)duk_get_buffer_data(ctx, -1, &len);
-			break;
+		pthread_mutex_unlock(&v->lock);
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	*job = w->stolen[0];
+	pthread_mutex_lock(&w->lock);
+	for (i=1; i<n; i++) {
+		ring_push(&w->deque, size, &w->stolen[i]);
+	}
+	w->jobs_stolen += n;
+	pthread_mutex_unlock(&w->lock);
+
+	if (n > 1) {
+		// the rest can be stolen again by a sleeping worker
+		pthread_mutex_lock(&e->lock);
+		e->seq++;
+		pthread_cond_signal(&e->has_job);
+		pthread_mutex_unlock(&e->lock);
+	}
+	return 1;
+}
+
+// pending counts the jobs which are neither taken nor stolen, the stolen ones left in a deque included.
+static void job_taken(executor_t *e) {
+	pthread_mutex_lock(&e->lock);
+	e->pending--;
+	pthread_cond_signal(&e->not_full);
+	if (e->closed && e->pending == 0) {
+		pthread_cond_broadcast(&e->has_job);
+	}
+	pthread_mutex_unlock(&e->lock);
+}
+
+static void *executor_worker(void *arg) {
+	exec_worker_t *w = (exec_worker_t*)arg;
+	executor_t *e = w->e;
+	cur_worker = w;
+	clock_gettime(CLOCK_MONOTONIC, &w->start);
+	void *env = js_create_env(e->mod_path);
+	if (env != NULL && e->init != NULL) {
+		e->init(e->init_udd, env);
+	}
+
+	pthread_mutex_lock(&e->lock);
+	e->started++;
+	if (env == NULL) {
+		e->failed++;
+	}
+	pthread_cond_broadcast(&e->started_cond);
+	pthread_mutex_unlock(&e->lock);
+
+	exec_job_t job;
+	while (env != NULL) {
+		pthread_mutex_lock(&e->lock);
+		unsigned long seq = e->seq;
+		pthread_mutex_unlock(&e->lock);
+
+		if (take_own_job(w, &job) || steal_jobs(w, &job)) {
+			job_taken(e);
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			run_job(env, &job);
+			long us = elapsed_us(&start);
+			pthread_mutex_lock(&w->lock);
+			w->jobs_run++;
+			w->busy_us += us;
+			pthread_mutex_unlock(&w->lock);
+			continue;
 		}
-		if (duk_is_error(ctx, -1)) {
-			res_type = rt_error;
-			res = (void*)duk_safe_to_lstring(ctx, -1, &len);
+
+		// nothing to do: sleep until a job is queued, or all the jobs are run after closed.
+		pthread_mutex_lock(&e->lock);
+		while (e->seq == seq && !(e->closed && e->pending == 0)) {
+			pthread_cond_wait(&e->has_job, &e->lock);
+		}
+		int quit = (e->seq == seq);
+		pthread_mutex_unlock(&e->lock);
+		if (quit) {
 			break;
 		}
-	default:
-		res_type = duk_is_array(ctx, -1) ? rt_array : rt_object;
-		duk_json_encode(ctx, -1);
-		res = (void*)duk_get_lstring(ctx, -1, &len);
-		break;
 	}
-	call_func_res(udd, res_type, res, len);
+
+	if (env != NULL) {
+		js_destroy_env(env);
+	}
+	cur_worker = NULL;
+	return NULL;
 }
 
-static int call_func(duk_context *ctx, int argc, const char *func_name, fn_call_func_res call_func_res, void *udd) {
-	// [ func, args ... ]
-	duk_int_t rc = duk_pcall(ctx, argc); // [ retval ]
-	if (call_func_res != NULL) {
-		call_result_callback(ctx, call_func_res, udd);
+static void free_executor(executor_t *e) {
+	int i;
+	for (i=0; i<e->nthreads; i++) {
+		exec_worker_t *w = &e->workers[i];
+		pthread_mutex_destroy(&w->lock);
+		free(w->deque.jobs);
+		free(w->pinned.jobs);
+		free(w->stolen);
 	}
-	duk_pop(ctx);
-	return (rc == DUK_EXEC_SUCCESS) ? 0 : -2;
+	pthread_mutex_destroy(&e->lock);
+	pthread_cond_destroy(&e->has_job);
+	pthread_cond_destroy(&e->not_full);
+	pthread_cond_destroy(&e->started_cond);
+	pthread_cond_destroy(&e->no_submitter);
+	free(e->workers);
+	free(e->mod_path);
+	free(e);
 }
 
-static int push_args_and_call_func(duk_context *ctx, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+// wait for the submitters to leave and the jobs queued to be run by the first nthreads workers, and free the executor.
+static void stop_executor(executor_t *e, int nthreads) {
+	pthread_mutex_lock(&e->lock);
+	e->closed = 1;
+	pthread_cond_broadcast(&e->has_job);
+	pthread_cond_broadcast(&e->not_full);
+	while (e->submitters > 0) {
+		pthread_cond_wait(&e->no_submitter, &e->lock);
+	}
+	pthread_mutex_unlock(&e->lock);
+
+	int i;
+	for (i=0; i<nthreads; i++) {
+		pthread_join(e->workers[i].thread, NULL);
+	}
+	free_executor(e);
+}
+
+void *js_create_executor(const char *mod_path, int nthreads, int queue_size, fn_executor_init init, void *init_udd)
 {
-	// [ func ]
-	if (fmt == NULL || *fmt == '\0') {
-		return call_func(ctx, 0, func_name, call_func_res, udd);
+	if (nthreads <= 0) {
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads <= 0) {
+			nthreads = 1;
+		}
+	}
+	if (queue_size <= 0) {
+		queue_size = nthreads * 16;
 	}
 
-	int argc = 0;
-	char *s;
-	size_t l;
-	int d;
-	int i = 0;
-	unsigned long func_index;
-	void *objUdd;
-	fn_create_ecmascript_instance create_ecmascript_instance;
-	while (*fmt) {
-		argc++;
-		switch (*fmt++) {
-		case af_none:
-			i++; //skip it
-			duk_push_null(ctx);
-			break;
-		case af_bool:
-			d = (int)(long)argv[i++];
-			duk_push_boolean(ctx, d);
-			break;
-		case af_int:
-			d = (int)(long)argv[i++];
-			duk_push_int(ctx, d);
-			break;
-		case af_double:
-			duk_push_number(ctx, voidp2double(argv[i++]));
-			break;
-		case af_zstring:
-			s = (char*)argv[i++];
-			duk_push_string(ctx, s);
-			break;
-		case af_lstring:
-			l = (size_t)argv[i++];
-			s = (char*)argv[i++];
-			duk_push_lstring(ctx, s, l);
-			break;
-		case af_error:
-			l = (size_t)argv[i++];
-			s = (char*)argv[i++];
-			duk_generic_error(ctx, "%.*s", (int)l, s);
-			break;
-		case af_buffer:
-			l = (size_t)argv[i++];
-			s = (char*)argv[i++];
-			duk_push_lstring(ctx, s, l);
-			duk_to_buffer(ctx, -1, NULL);
-			duk_push_buffer_object(ctx, -1, 0, l, DUK_BUFOBJ_NODEJS_BUFFER);
-			duk_remove(ctx, -2);
-			break;
-		case af_ecmafunc:
-			func_index = (unsigned long)argv[i++];
-			load_object(ctx, func_index); // now the top ctx is [ func ]
-			break;
-		case af_mobject:
-			objUdd = argv[i++];
-			create_ecmascript_instance = (fn_create_ecmascript_instance)argv[i++];
-			if (create_ecmascript_instance == NULL || create_ecmascript_instance(ctx, objUdd) != 0) {
-				duk_push_undefined(ctx);
-			}
+	executor_t *e = (executor_t*)calloc(1, sizeof(executor_t));
+	if (e == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->has_job, NULL);
+	pthread_cond_init(&e->not_full, NULL);
+	pthread_cond_init(&e->started_cond, NULL);
+	pthread_cond_init(&e->no_submitter, NULL);
+	e->queue_size = queue_size;
+	e->init = init;
+	e->init_udd = init_udd;
+	e->workers = (exec_worker_t*)calloc(nthreads, sizeof(exec_worker_t));
+	if (e->workers == NULL || (mod_path != NULL && (e->mod_path = strdup(mod_path)) == NULL)) {
+		free_executor(e);
+		return NULL;
+	}
+
+	// every ring holds queue_size jobs, so a worker never fails to queue a job or to keep the stolen ones.
+	int ok = 1;
+	for (e->nthreads=0; e->nthreads<nthreads; e->nthreads++) {
+		exec_worker_t *w = &e->workers[e->nthreads];
+		w->e = e;
+		w->index = e->nthreads;
+		pthread_mutex_init(&w->lock, NULL);
+		w->deque.jobs = (exec_job_t*)malloc(sizeof(exec_job_t)*queue_size);
+		w->pinned.jobs = (exec_job_t*)malloc(sizeof(exec_job_t)*queue_size);
+		w->stolen = (exec_job_t*)malloc(sizeof(exec_job_t)*queue_size);
+		if (w->deque.jobs == NULL || w->pinned.jobs == NULL || w->stolen == NULL) {
+			ok = 0;
+			e->nthreads++; // to be freed
 			break;
-		case af_jarray:
-		case af_jobject:
-		default:
-			l = (size_t)argv[i++];
-			s = (char*)argv[i++];
-			duk_push_lstring(ctx, s, l);
-			duk_json_decode(ctx, -1);
+		}
+	}
+	if (!ok) {
+		free_executor(e);
+		return NULL;
+	}
+
+	int created;
+	for (created=0; created<nthreads; created++) {
+		if (pthread_create(&e->workers[created].thread, NULL, executor_worker, &e->workers[created]) != 0) {
 			break;
 		}
 	}
-	// [ func arg1 arg2 ... argn ]
 
-	return call_func(ctx, argc, func_name, call_func_res, udd);
+	// wait for all the envs to be initialized
+	pthread_mutex_lock(&e->lock);
+	while (e->started < created) {
+		pthread_cond_wait(&e->started_cond, &e->lock);
+	}
+	ok = (created == nthreads && e->failed == 0);
+	pthread_mutex_unlock(&e->lock);
+	if (!ok) {
+		stop_executor(e, created);
+		return NULL;
+	}
+	return e;
 }
 
-int js_call_registered_func(void *env, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+void js_destroy_executor(void *executor)
 {
-	duk_context *ctx = (duk_context*)env;
-	if (!duk_get_global_string(ctx, func_name)) {
-		return -1;
+	executor_t *e = (executor_t*)executor;
+	stop_executor(e, e->nthreads);
+}
+
+// called with the lock of executor held, the executor may be freed after unlocking if it's closed.
+static int leave_submit(executor_t *e, exec_job_t *job, int res) {
+	if (res != 0) {
+		free(job->code);
 	}
-	// [ func ]
+	if (--e->submitters == 0 && e->closed) {
+		pthread_cond_signal(&e->no_submitter);
+	}
+	pthread_mutex_unlock(&e->lock);
+	return res;
+}
 
-	return push_args_and_call_func(ctx, func_name, call_func_res, udd, fmt, argv);
+/*
+ * a job pinned to a worker goes to its pinned queue. others go to the deque of the current
+ * worker if submitted by a job of the executor, otherwise to the deques round robin.
+ * a job of the executor never waits for the queue, which may be filled by the jobs waiting
+ * for the running jobs. the executor is not freed until all the submitters leave.
+ */
+static int submit_job(executor_t *e, int worker, exec_job_t *job) {
+	if (worker >= e->nthreads) {
+		free(job->code);
+		return -2;
+	}
+	int nested = (cur_worker != NULL && cur_worker->e == e);
+
+	pthread_mutex_lock(&e->lock);
+	e->submitters++;
+	if (nested && e->pending == e->queue_size && !e->closed) {
+		return leave_submit(e, job, -3);
+	}
+	while (e->pending == e->queue_size && !e->closed) {
+		pthread_cond_wait(&e->not_full, &e->lock);
+	}
+	if (e->closed) {
+		return leave_submit(e, job, -1);
+	}
+	e->pending++;
+	exec_worker_t *w;
+	if (worker >= 0) {
+		w = &e->workers[worker];
+	} else if (nested) {
+		w = cur_worker;
+	} else {
+		w = &e->workers[e->next++ % e->nthreads];
+	}
+	pthread_mutex_unlock(&e->lock);
+
+	pthread_mutex_lock(&w->lock);
+	ring_push(worker >= 0 ? &w->pinned : &w->deque, e->queue_size, job);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_mutex_lock(&e->lock);
+	e->seq++;
+	if (worker >= 0) {
+		pthread_cond_broadcast(&e->has_job); // the pinned worker must be woken up
+	} else {
+		pthread_cond_signal(&e->has_job);   // any worker can run it
+	}
+	return leave_submit(e, job, 0);
 }
 
-int js_call_file_func(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+int js_executor_submit(void *executor, fn_executor_job func, void *udd)
 {
-	duk_context *ctx = (duk_context*)env;
-	char *src;
-	size_t size;
-	int ret = readFileContent(script_file, &src, &size);
-	if (ret != 0) {
-		return ret;
+	return js_executor_submit_to(executor, -1, func, udd);
+}
+
+int js_executor_submit_to(void *executor, int worker, fn_executor_job func, void *udd)
+{
+	exec_job_t job = {job_func, func, udd, NULL, 0, NULL, NULL, NULL};
+	return submit_job((executor_t*)executor, worker, &job);
+}
+
+int js_executor_eval(void *executor, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd)
+{
+	exec_job_t job = {job_eval, NULL, udd, (char*)malloc(len), len, NULL, NULL, call_func_res};
+	if (job.code == NULL) {
+		return -1;
 	}
-	ret = duk_pcompile_lstring(ctx, DUK_COMPILE_FUNCTION, src, size);
-	free(src);
+	memcpy(job.code, js_code, len);
+	return submit_job((executor_t*)executor, -1, &job);
+}
 
-	if (ret != 0) {
-		fprintf(stderr, "failed to compile %s: %s\n", script_file, duk_safe_to_string(ctx, -1));
-		duk_pop(ctx);
+int js_executor_call(void *executor, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+{
+	exec_job_t job = {job_call, NULL, udd, strdup(func_name), 0, fmt, argv, call_func_res};
+	if (job.code == NULL) {
 		return -1;
 	}
-	// [ func ]
+	return submit_job((executor_t*)executor, -1, &job);
+}
 
-	return push_args_and_call_func(ctx, script_file, call_func_res, udd, fmt, argv);
+int js_executor_worker(void)
+{
+	return (cur_worker != NULL) ? cur_worker->index : -1;
 }
 
-int js_eval(void *env, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd)
+int js_executor_worker_of(void *executor)
 {
-	duk_context *ctx = (duk_context*)env;
-	duk_int_t ret = duk_peval_lstring(ctx, js_code, len); // [ retval ]
-	if (call_func_res != NULL) {
-		call_result_callback(ctx, call_func_res, udd);
-	}
-	duk_pop(ctx);
-	return (ret == 0) ? 0: -1;
+	return (cur_worker != NULL && cur_worker->e == (executor_t*)executor) ? cur_worker->index : -1;
 }
 
-int js_eval_file(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd)
+int js_executor_stats(void *executor, executor_stats_t *stats, int n)
 {
-	duk_context *ctx = (duk_context*)env;
-	char *src;
-	size_t size;
-	int ret = readFileContent(script_file, &src, &size);
-	if (ret != 0) {
-		if (ret == -1 && call_func_res != NULL) {
-			duk_push_error_object(ctx, DUK_ERR_ERROR, "%s not found", script_file);
-			call_result_callback(ctx, call_func_res, udd);
-			duk_pop(ctx);
+	executor_t *e = (executor_t*)executor;
+	int i;
+	for (i=0; i<n && i<e->nthreads; i++) {
+		exec_worker_t *w = &e->workers[i];
+		pthread_mutex_lock(&w->lock);
+		stats[i].jobs = w->jobs_run;
+		stats[i].stolen = w->jobs_stolen;
+		stats[i].busy_us = w->busy_us;
+		stats[i].up_us = elapsed_us(&w->start);
+		stats[i].queued = w->deque.count + w->pinned.count;
+		pthread_mutex_unlock(&w->lock);
+	}
+	return e->nthreads;
+}
+
+/**
+ * the event loop of an env, created by js_enable_loop(). timers are kept in a hashed wheel of
+ * WHEEL_SIZE slots of 1ms, each timer in the slot of its expiry. completions are pushed by any
+ * thread to a lock-free stack, which is taken as a whole by the thread running the loop. the
+ * lock is only used to wake up the loop sleeping.
+ */
+#define WHEEL_SIZE 256
+#define LOOP_TIMERS "_timers_" // timer id -> [ func, timer, args... ] in the heap stash
+#define LOOP_DRAIN  "_drain_"  // the function to run the reactions of promises, in the heap stash
+#define LOOP_DEFER  "_defer_"  // the function to create { promise, resolve, reject }, in the heap stash
+#define LOOP_CALLS  "_calls_"  // call id -> the result of _defer_ of an async native function, in the heap stash
+
+typedef struct loop_timer {
+	duk_uarridx_t id;
+	uint64_t expiry;       // ms since the loop is created
+	unsigned int interval; // 0 for a timeout
+	struct loop_timer *prev;
+	struct loop_timer *next;
+} loop_timer_t;
+
+typedef struct loop_task {
+	fn_loop_task task;
+	void *udd;
+	struct loop_task *next;
+} loop_task_t;
+
+typedef struct event_loop {
+	struct timespec start;
+	uint64_t tick;          // the timers expiring not after it are run
+	loop_timer_t *wheel[WHEEL_SIZE];
+	int timers;             // count of timers in the wheel
+	duk_uarridx_t last_id;
+	duk_uarridx_t last_call_id; // of async native functions
+	loop_task_t *tasks;     // completions pushed, the latest first. atomic
+	int asyncs;             // count of async operations not completed. atomic
+	int sleeping;           // the loop is waiting for tasks. atomic
+	pthread_mutex_t lock;
+	pthread_cond_t has_task;
+} event_loop_t;
+
+static uint64_t loop_now(event_loop_t *loop) {
+	return elapsed_us(&loop->start) / 1000;
+}
+
+static void add_timer(event_loop_t *loop, loop_timer_t *t) {
+	loop_timer_t **slot = &loop->wheel[t->expiry % WHEEL_SIZE];
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot != NULL) {
+		(*slot)->prev = t;
+	}
+	*slot = t;
+	loop->timers++;
+}
+
+static void remove_timer(event_loop_t *loop, loop_timer_t *t) {
+	if (t->prev != NULL) {
+		t->prev->next = t->next;
+	} else {
+		loop->wheel[t->expiry % WHEEL_SIZE] = t->next;
+	}
+	if (t->next != NULL) {
+		t->next->prev = t->prev;
+	}
+	loop->timers--;
+}
+
+// the earliest expiry, found in the slots of the next round first.
+static uint64_t next_expiry(event_loop_t *loop) {
+	uint64_t min = UINT64_MAX;
+	int k;
+	for (k=1; k<=WHEEL_SIZE; k++) {
+		loop_timer_t *t;
+		for (t=loop->wheel[(loop->tick + k) % WHEEL_SIZE]; t!=NULL; t=t->next) {
+			if (t->expiry == loop->tick + k) {
+				return t->expiry;
+			}
+			if (t->expiry < min) {
+				min = t->expiry;
+			}
 		}
-		return ret;
 	}
+	return min;
+}
 
-	ret = js_eval(env, src, size, call_func_res, udd);
-	free(src);
-	return ret;
+static duk_ret_t add_js_timer(duk_context *ctx, int repeat) {
+	duk_idx_t nargs = duk_get_top(ctx);
+	duk_require_function(ctx, 0);
+	duk_int_t delay = (nargs > 1) ? duk_to_int(ctx, 1) : 0;
+	if (delay < 1) {
+		delay = 1;
+	}
+	event_loop_t *loop = get_env_state(ctx)->loop;
+	loop_timer_t *t = (loop_timer_t*)malloc(sizeof(loop_timer_t));
+	if (t == NULL) {
+		return duk_generic_error(ctx, "no memory for timer");
+	}
+	if (++loop->last_id == 0) {
+		loop->last_id = 1;
+	}
+	t->id = loop->last_id;
+	t->interval = repeat ? delay : 0;
+	t->expiry = loop_now(loop) + delay;
+	add_timer(loop, t);
+
+	duk_push_heap_stash(ctx);                    // [ args..., stash ]
+	duk_get_prop_string(ctx, -1, LOOP_TIMERS);   // [ args..., stash, timers ]
+	duk_push_array(ctx);                         // [ args..., stash, timers, entry ]
+	duk_dup(ctx, 0);
+	duk_put_prop_index(ctx, -2, 0);
+	duk_push_pointer(ctx, t);
+	duk_put_prop_index(ctx, -2, 1);
+	duk_idx_t i;
+	for (i=2; i<nargs; i++) {
+		duk_dup(ctx, i);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_index(ctx, -2, t->id);          // [ args..., stash, timers ] with timers[id] = entry
+	duk_pop_2(ctx);
+	duk_push_uint(ctx, t->id);
+	return 1;
+}
+
+static duk_ret_t setTimeout(duk_context *ctx) {
+	return add_js_timer(ctx, 0);
+}
+
+static duk_ret_t setInterval(duk_context *ctx) {
+	return add_js_timer(ctx, 1);
+}
+
+static duk_ret_t clearTimer(duk_context *ctx) {
+	if (!duk_is_number(ctx, 0)) {
+		return 0;
+	}
+	duk_uarridx_t id = duk_to_uint32(ctx, 0);
+	duk_push_heap_stash(ctx);                    // [ id, stash ]
+	duk_get_prop_string(ctx, -1, LOOP_TIMERS);   // [ id, stash, timers ]
+	if (duk_get_prop_index(ctx, -1, id)) {       // [ id, stash, timers, entry ]
+		duk_get_prop_index(ctx, -1, 1);
+		loop_timer_t *t = (loop_timer_t*)duk_get_pointer(ctx, -1);
+		remove_timer(get_env_state(ctx)->loop, t);
+		free(t);
+		duk_pop(ctx);
+		duk_del_prop_index(ctx, -2, id);
+	}
+	return 0;
+}
+
+static void report_loop_error(duk_context *ctx, fn_call_func_res on_error, void *udd) {
+	if (on_error != NULL) {
+		size_t len;
+		const char *err = duk_safe_to_lstring(ctx, -1, &len);
+		on_error(udd, rt_error, (void*)err, len);
+	}
 }
 
-int js_check_syntax(void *env, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd)
-{
-	duk_context *ctx = (duk_context*)env;
-	duk_int_t ret = duk_pcompile_lstring(ctx, 0, js_code, len); // [ retval ]
-	if (call_func_res != NULL) {
-		if (ret == 0) {
-			// syntax ok, return undefined
-			duk_push_undefined(ctx);
-			duk_remove(ctx, -2);
-		} 
-		call_result_callback(ctx, call_func_res, udd);
+// run a timer if it is not cleared, an interval is put back to the wheel before running.
+static void run_timer(duk_context *ctx, event_loop_t *loop, duk_uarridx_t id, uint64_t now, fn_call_func_res on_error, void *udd) {
+	duk_push_heap_stash(ctx);                    // [ stash ]
+	duk_get_prop_string(ctx, -1, LOOP_TIMERS);   // [ stash, timers ]
+	if (!duk_get_prop_index(ctx, -1, id)) {      // [ stash, timers, entry ]
+		duk_pop_3(ctx);
+		return;
 	}
+	duk_get_prop_index(ctx, -1, 1);
+	loop_timer_t *t = (loop_timer_t*)duk_get_pointer(ctx, -1);
 	duk_pop(ctx);
-	return (ret == 0) ? 0: -1;
-}
+	remove_timer(loop, t);
+	if (t->interval > 0) {
+		t->expiry = now + t->interval;
+		add_timer(loop, t);
+	} else {
+		free(t);
+		duk_del_prop_index(ctx, -2, id);
+	}
 
-int js_check_syntax_file(void *env, const char *script_file, fn_call_func_res call_func_res, void *udd)
-{
-	duk_context *ctx = (duk_context*)env;
-	char *src;
-	size_t size;
-	int ret = readFileContent(script_file, &src, &size);
-	if (ret != 0) {
-		if (ret == -1 && call_func_res != NULL) {
-			duk_push_error_object(ctx, DUK_ERR_ERROR, "%s not found", script_file);
-			call_result_callback(ctx, call_func_res, udd);
-			duk_pop(ctx);
-		}
-		return ret;
+	duk_idx_t n = (duk_idx_t)duk_get_length(ctx, -1);
+	duk_idx_t i;
+	duk_get_prop_index(ctx, -1, 0);              // [ stash, timers, entry, func ]
+	for (i=2; i<n; i++) {
+		duk_get_prop_index(ctx, -i, i);          // [ stash, timers, entry, func, args... ]
 	}
+	if (duk_pcall(ctx, (n > 2) ? n-2 : 0) != DUK_EXEC_SUCCESS) { // [ stash, timers, entry, retval ]
+		report_loop_error(ctx, on_error, udd);
+	}
+	duk_pop_n(ctx, 4);
+}
 
-	ret = js_check_syntax(env, src, size, call_func_res, udd);
-	free(src);
-	return ret;
+// run the reactions of promises queued by the tasks and timers.
+static void run_microtasks(duk_context *ctx) {
+	duk_push_heap_stash(ctx);                    // [ stash ]
+	if (duk_get_prop_string(ctx, -1, LOOP_DRAIN)) {
+		duk_pcall(ctx, 0);                       // [ stash, retval ]
+	}
+	duk_pop_2(ctx);
 }
 
-static duk_ret_t native_func_bridge(duk_context *ctx)
-{
-	duk_idx_t nargs = duk_get_top(ctx);                           // [ ... ]
-	duk_push_current_function(ctx);                               // [ ..., native_func_bridge ]
-	duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_FUNC)); // [ ..., native_func_bridge, native_func ]
-	duk_get_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_UDD));  // [ ..., native_func_bridge, native_func, udd ]
-	fn_native_func native_func = (fn_native_func)duk_get_pointer(ctx, -2);
-	void *udd = duk_get_pointer(ctx, -1);	
-	duk_pop_3(ctx);               // [ ... ]
+// run the completions queued and the timers expired, return the count of them.
+static int run_ready(duk_context *ctx, event_loop_t *loop, fn_call_func_res on_error, void *udd) {
+	run_microtasks(ctx);
+
+	// take all the tasks, and reverse them to the order of completion.
+	loop_task_t *task = __atomic_exchange_n(&loop->tasks, NULL, __ATOMIC_ACQ_REL);
+	loop_task_t *fifo = NULL;
+	while (task != NULL) {
+		loop_task_t *next = task->next;
+		task->next = fifo;
+		fifo = task;
+		task = next;
+	}
+	int ran = 0;
+	while (fifo != NULL) {
+		loop_task_t *next = fifo->next;
+		fifo->task(fifo->udd, ctx);
+		free(fifo);
+		fifo = next;
+		__atomic_sub_fetch(&loop->asyncs, 1, __ATOMIC_ACQ_REL);
+		run_microtasks(ctx);
+		ran++;
+	}
 
-	void *cb_res;
-	res_type_t res_type;
-	size_t res_len;
-	fn_free_res free_res = NULL;
-	if (nargs == 0) {
-		native_func(udd, NULL, NULL, &cb_res, &res_type, &res_len, &free_res);
-	} else {
-		char *p = (char*)malloc(sizeof(void*) * 2 * nargs + nargs + 1);
-		if (p == NULL) {
-			return 0;
-		}
-		void **args = (void**)p;
-		char *fmt = p + (sizeof(void*) * 2 * nargs);
-		int i, j;
-		double d;
-		duk_int_t type;
-		duk_size_t len;
-		for (i=0, j=0; i<nargs; i++) {
-			switch (duk_get_type(ctx, i)) {
-			case DUK_TYPE_UNDEFINED:
-			case DUK_TYPE_NULL:
-				fmt[i] = af_none;
-				args[j++] = NULL;
-				break;
-			case DUK_TYPE_BOOLEAN:
-				fmt[i] = af_bool;
-				args[j++] = (void*)(long)duk_get_boolean(ctx, i);
-				break;
-			case DUK_TYPE_NUMBER:
-				fmt[i] = af_double;
-				d = duk_get_number(ctx, i);
-				args[j++] = double2voidp(d);
-				break;
-			case DUK_TYPE_STRING:
-				fmt[i] = af_lstring;
-				args[j+1] = (void*)duk_get_lstring(ctx, i, &len);
-				args[j] = (void*)len;
-				j += 2;
-				break;
-			case DUK_TYPE_BUFFER:
-				fmt[i] = af_buffer;
-				args[j+1] = (void*)duk_get_buffer(ctx, i, &len);
-				args[j] = (void*)len;
-				j += 2;
-				break;
-			case DUK_TYPE_OBJECT:
-				if (duk_is_ecmascript_function(ctx, i)) {
-					fmt[i] = af_ecmafunc;
-					// copy the function to the top
-					duk_push_null(ctx);   // [ ... null ]
-					duk_copy(ctx, i, -1); // [ ... func ]
-					unsigned long func_index = save_top_object(ctx); // [ ... ]
-					args[j++] = (void*)func_index; // which must be freed by calling js_destropy_ecmascript_func
-					break;
-				}
-				if (duk_is_buffer_data(ctx, i)) {
-					fmt[i] = af_buffer;
-					args[j+1] = duk_get_buffer_data(ctx, i, &len);
-					args[j] = (void*)len;
-					j += 2;
-					break;
+	// collect the ids due first, because a timer may clear others when it runs.
+	uint64_t now = loop_now(loop);
+	if (loop->timers == 0 || now <= loop->tick) {
+		loop->tick = now;
+		return ran;
+	}
+	duk_uarridx_t *due = NULL;
+	int n = 0, cap = 0;
+	uint64_t tick;
+	uint64_t last = (now - loop->tick >= WHEEL_SIZE) ? loop->tick + WHEEL_SIZE : now;
+	for (tick=loop->tick+1; tick<=last; tick++) {
+		loop_timer_t *t;
+		for (t=loop->wheel[tick % WHEEL_SIZE]; t!=NULL; t=t->next) {
+			if (t->expiry > now) {
+				continue;
+			}
+			if (n == cap) {
+				cap = (cap == 0) ? 16 : cap*2;
+				duk_uarridx_t *p = (duk_uarridx_t*)realloc(due, sizeof(duk_uarridx_t)*cap);
+				if (p == NULL) {
+					break; // the rest are run next time
 				}
-			default:
-				fmt[i] = duk_is_array(ctx, i) ? af_jarray : af_jobject;
-				duk_json_encode(ctx, i);
-				args[j+1] = (void*)duk_get_lstring(ctx, i, &len);
-				args[j] = (void*)len;
-				j += 2;
-				break;
+				due = p;
 			}
+			due[n++] = t->id;
 		}
+	}
+	loop->tick = now;
 
-		fmt[nargs] = '\0';
-		native_func(udd, fmt, args, &cb_res, &res_type, &res_len, &free_res);
-		free(p);
+	int i;
+	for (i=0; i<n; i++) {
+		run_timer(ctx, loop, due[i], now, on_error, udd);
+		run_microtasks(ctx);
 	}
+	free(due);
+	return ran + n;
+}
 
-	switch (res_type) {
-	case rt_none:
-		return 0;
-	case rt_bool:
-		duk_push_boolean(ctx, (duk_bool_t)(long)cb_res);
-		return 1;
-	case rt_int:
-		duk_push_int(ctx, (duk_int_t)(long)cb_res);
-		return 1;
-	case rt_double:
-		duk_push_number(ctx, (duk_double_t)voidp2double(cb_res));
-		return 1;
-	case rt_string:
-		duk_push_lstring(ctx, (const char*)cb_res, res_len);
-		if (free_res != NULL) {
-			free_res(cb_res);
-		}
-		return 1;
-	case rt_buffer:
-		duk_push_lstring(ctx, (const char*)cb_res, res_len);
-		duk_to_buffer(ctx, -1, NULL);
-		duk_push_buffer_object(ctx, -1, 0, res_len, DUK_BUFOBJ_NODEJS_BUFFER);
-		duk_remove(ctx, -2);
-		if (free_res != NULL) {
-			free_res(cb_res);
+// wait until a completion is queued, the next timer expires or timeout_ms passes.
+static void wait_loop(event_loop_t *loop, int timeout_ms) {
+	if (loop->timers > 0) {
+		uint64_t now = loop_now(loop);
+		uint64_t expiry = next_expiry(loop);
+		int due_ms = (expiry > now) ? (int)(expiry - now) : 0;
+		if (timeout_ms < 0 || due_ms < timeout_ms) {
+			timeout_ms = due_ms;
 		}
-		return 1;
-	case rt_func:
-		load_object(ctx, (unsigned long)cb_res); // now the top of ctx is [ func ]
-		return 1;
-	case rt_error:
-		return duk_generic_error(ctx, "%.*s", (int)res_len, (const char*)cb_res);
-	case rt_mobject:
-		{
-			fn_create_ecmascript_instance create_ecmascript_instance = (fn_create_ecmascript_instance)cb_res;
-			void *udd = (void*)res_len;
-			if (create_ecmascript_instance == NULL || create_ecmascript_instance(ctx, udd) != 0) {
-				duk_push_undefined(ctx);
-			}
-			return 1;
+	}
+	if (timeout_ms == 0) {
+		return;
+	}
+
+	// a task pushed after sleeping is set must find it set, and wake up the loop with the lock.
+	pthread_mutex_lock(&loop->lock);
+	__atomic_store_n(&loop->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (timeout_ms < 0) {
+		while (__atomic_load_n(&loop->tasks, __ATOMIC_SEQ_CST) == NULL) {
+			pthread_cond_wait(&loop->has_task, &loop->lock);
 		}
-	case rt_object:
-	case rt_array:
-	default:
-		duk_push_lstring(ctx, (const char*)cb_res, res_len);
-		duk_json_decode(ctx, -1);
-		if (free_res != NULL) {
-			free_res(cb_res);
+	} else if (__atomic_load_n(&loop->tasks, __ATOMIC_SEQ_CST) == NULL) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
 		}
-		return 1;
+		pthread_cond_timedwait(&loop->has_task, &loop->lock, &deadline);
 	}
+	__atomic_store_n(&loop->sleeping, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&loop->lock);
 }
 
-static void make_func_bridge(duk_context *ctx, const char *func_name, fn_native_func native_func, duk_idx_t nargs, void *udd)
-{
-	// [ obj ]
-	duk_push_string(ctx, func_name);                     // [ obj, func_name ]
-	duk_push_c_function(ctx, native_func_bridge, nargs); // [ obj, func_name, native_func_bridge ]
-	duk_push_pointer(ctx, native_func);                  // [ obj, func_name, natvie_func_bridge, native_func ]
-	duk_put_prop_string(ctx, -2, 
-	                    DUK_HIDDEN_SYMBOL(NATIVE_FUNC)); // [ obj, func_name, native_func_bridge ] with native_func_bridge[_nf_] = native_func
-	duk_push_pointer(ctx, udd);                          // [ obj, func_name, native_func_bridge, udd ]
-	duk_put_prop_string(ctx, -2, 
-	                    DUK_HIDDEN_SYMBOL(NATIVE_UDD));  // [ obj, func_name, native_func_bridge ] with native_func_bridge[_nu_] = udd
-	duk_put_prop(ctx, -3);                               // [ obj ] with obj[func_name] = native_func_bridge
+static int loop_pending(event_loop_t *loop) {
+	return loop->timers + __atomic_load_n(&loop->asyncs, __ATOMIC_ACQUIRE);
 }
 
-int js_register_native_func(void *env, const char *func_name, fn_native_func native_func, int param_num, void *udd)
+/*
+ * a small Promise for Duktape without one, whose reactions are run by _drain_ after every task
+ * and timer of the event loop. it returns { drain, defer } to be kept in the heap stash.
+ */
+static const char *promise_polyfill =
+	"(function(g) {\n"
+	"var queue = [];\n"
+	"function drain() { while (queue.length > 0) { queue.shift()(); } }\n"
+	"function defer() { var d = {}; d.promise = new g.Promise(function(res, rej) { d.resolve = res; d.reject = rej; }); return d; }\n"
+	"if (typeof g.Promise === 'function') { return { drain: drain, defer: defer }; }\n"
+	"function settle(p, s, v) {\n"
+	"  p._s = s; p._v = v;\n"
+	"  var r = p._r; p._r = null;\n"
+	"  for (var i=0; i<r.length; i++) { schedule(p, r[i]); }\n"
+	"}\n"
+	"function adopt(p, v) {\n"
+	"  if (v === p) { return settle(p, 2, new TypeError('a promise resolved with itself')); }\n"
+	"  if (v !== null && (typeof v === 'object' || typeof v === 'function')) {\n"
+	"    var then, called = false;\n"
+	"    try { then = v.then; } catch (e) { return settle(p, 2, e); }\n"
+	"    if (typeof then === 'function') {\n"
+	"      try {\n"
+	"        then.call(v, function(x) { if (!called) { called = true; adopt(p, x); } },\n"
+	"                     function(e) { if (!called) { called = true; settle(p, 2, e); } });\n"
+	"      } catch (e) { if (!called) { called = true; settle(p, 2, e); } }\n"
+	"      return;\n"
+	"    }\n"
+	"  }\n"
+	"  settle(p, 1, v);\n"
+	"}\n"
+	"function schedule(p, r) {\n"
+	"  queue.push(function() {\n"
+	"    var cb = (p._s === 1) ? r.f : r.j;\n"
+	"    if (typeof cb !== 'function') { if (p._s === 1) { adopt(r.p, p._v); } else { settle(r.p, 2, p._v); } return; }\n"
+	"    var x;\n"
+	"    try { x = cb(p._v); } catch (e) { return settle(r.p, 2, e); }\n"
+	"    adopt(r.p, x);\n"
+	"  });\n"
+	"}\n"
+	"function Promise(executor) {\n"
+	"  var self = this, done = false;\n"
+	"  this._s = 0; this._v = undefined; this._r = [];\n"
+	"  function resolve(v) { if (!done) { done = true; adopt(self, v); } }\n"
+	"  function reject(e) { if (!done) { done = true; settle(self, 2, e); } }\n"
+	"  try { executor(resolve, reject); } catch (e) { reject(e); }\n"
+	"}\n"
+	"Promise.prototype.then = function(f, j) {\n"
+	"  var r = { f: f, j: j, p: new Promise(function() {}) };\n"
+	"  if (this._s === 0) { this._r.push(r); } else { schedule(this, r); }\n"
+	"  return r.p;\n"
+	"};\n"
+	"Promise.prototype['catch'] = function(j) { return this.then(undefined, j); };\n"
+	"Promise.resolve = function(v) { return (v instanceof Promise) ? v : new Promise(function(res) { res(v); }); };\n"
+	"Promise.reject = function(e) { return new Promise(function(res, rej) { rej(e); }); };\n"
+	"Promise.all = function(a) {\n"
+	"  return new Promise(function(res, rej) {\n"
+	"    var n = a.length, out = new Array(n);\n"
+	"    if (n === 0) { return res(out); }\n"
+	"    a.forEach(function(x, i) { Promise.resolve(x).then(function(v) { out[i] = v; if (--n === 0) { res(out); } }, rej); });\n"
+	"  });\n"
+	"};\n"
+	"g.Promise = Promise;\n"
+	"return { drain: drain, defer: defer };\n"
+	"})(this)";
+
+static void free_loop(event_loop_t *loop) {
+	int i;
+	for (i=0; i<WHEEL_SIZE; i++) {
+		loop_timer_t *t = loop->wheel[i];
+		while (t != NULL) {
+			loop_timer_t *next = t->next;
+			free(t);
+			t = next;
+		}
+	}
+	loop_task_t *task = loop->tasks;
+	while (task != NULL) {
+		loop_task_t *next = task->next;
+		free(task);
+		task = next;
+	}
+	pthread_mutex_destroy(&loop->lock);
+	pthread_cond_destroy(&loop->has_task);
+	free(loop);
+}
+
+int js_enable_loop(void *env)
 {
 	duk_context *ctx = (duk_context*)env;
-	duk_idx_t nargs;
-	if (param_num < 0) {
-		nargs = DUK_VARARGS;
-	} else {
-		nargs = param_num;
+	env_state_t *state = get_env_state(ctx);
+	if (state->loop != NULL) {
+		return 0;
+	}
+	event_loop_t *loop = (event_loop_t*)calloc(1, sizeof(event_loop_t));
+	if (loop == NULL) {
+		return -1;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &loop->start);
+	pthread_mutex_init(&loop->lock, NULL);
+	pthread_cond_init(&loop->has_task, NULL);
+	state->loop = loop;
+
+	duk_push_heap_stash(ctx);                    // [ stash ]
+	duk_push_object(ctx);                        // [ stash, timers ]
+	duk_put_prop_string(ctx, -2, LOOP_TIMERS);   // [ stash ] with stash[_timers_] = timers
+	duk_push_object(ctx);                        // [ stash, calls ]
+	duk_put_prop_string(ctx, -2, LOOP_CALLS);    // [ stash ] with stash[_calls_] = calls
+	if (duk_peval_string(ctx, promise_polyfill) == 0) { // [ stash, { drain, defer } ]
+		duk_get_prop_string(ctx, -1, "drain");
+		duk_put_prop_string(ctx, -3, LOOP_DRAIN);
+		duk_get_prop_string(ctx, -1, "defer");
+		duk_put_prop_string(ctx, -3, LOOP_DEFER);
+	}
+	duk_pop_2(ctx);
 
-	duk_push_global_object(ctx);                               // [ global ]
-	make_func_bridge(ctx, func_name, native_func, nargs, udd); // [ global ] with global[func_name] = native_func_bridge
+	duk_push_global_object(ctx);                 // [ global ]
+	set_global_function(ctx, "setTimeout", setTimeout, DUK_VARARGS);
+	set_global_function(ctx, "setInterval", setInterval, DUK_VARARGS);
+	set_global_function(ctx, "clearTimeout", clearTimer, 1);
+	set_global_function(ctx, "clearInterval", clearTimer, 1);
 	duk_pop(ctx);
 	return 0;
 }
 
-int js_unregister_native_func(void *env, const char *func_name)
+int js_run_once(void *env, int timeout_ms, fn_call_func_res on_error, void *udd)
 {
 	duk_context *ctx = (duk_context*)env;
-	duk_push_global_object(ctx);   // [ global ]
-	if (!duk_get_prop_string(ctx, -1, func_name)) {
-		duk_pop_2(ctx);
+	event_loop_t *loop = get_env_state(ctx)->loop;
+	if (loop == NULL) {
 		return -1;
 	}
-	// [ global, func ]
-	if (!duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_FUNC))) {
-		duk_pop_3(ctx);
-		return -2;
+	if (run_ready(ctx, loop, on_error, udd) == 0 && timeout_ms != 0 && loop_pending(loop) > 0) {
+		wait_loop(loop, timeout_ms);
+		run_ready(ctx, loop, on_error, udd);
 	}
-	duk_pop_2(ctx); // [ global ]
-	duk_del_prop_string(ctx, -1, func_name);
-	duk_pop(ctx);
-	return 0;
+	return loop_pending(loop);
 }
 
-int js_call_ecmascript_func(void *env, void *ecma_func, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[])
+int js_run_loop(void *env, fn_call_func_res on_error, void *udd)
 {
-	duk_context *ctx = (duk_context*)env;
-	unsigned long func_index = (unsigned long)ecma_func;
-	load_object(ctx, func_index);  // now ctx contains [ func ]
-	return push_args_and_call_func(ctx, "_ecmafunc_", call_func_res, udd, fmt, argv);
+	int n;
+	while ((n = js_run_once(env, -1, on_error, udd)) > 0) {
+	}
+	return n;
 }
 
-void js_destroy_ecmascript_obj(void *env, void *ecma_obj) {
-	duk_context* ctx = (duk_context*)env;
-	unsigned long func_index = (unsigned long)ecma_obj;
-	destroy_object(ctx, func_index);
+void *js_loop_async(void *env)
+{
+	event_loop_t *loop = get_env_state((duk_context*)env)->loop;
+	if (loop == NULL) {
+		return NULL;
+	}
+	__atomic_add_fetch(&loop->asyncs, 1, __ATOMIC_ACQ_REL);
+	return loop;
 }
 
-void* double2voidp(double d) {
-	return (void*)*((long*)&d);
+int js_loop_complete(void *async, fn_loop_task task, void *udd)
+{
+	event_loop_t *loop = (event_loop_t*)async;
+	loop_task_t *t = (loop_task_t*)malloc(sizeof(loop_task_t));
+	if (t == NULL) {
+		return -1;
+	}
+	t->task = task;
+	t->udd = udd;
+	t->next = __atomic_load_n(&loop->tasks, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&loop->tasks, &t->next, t, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	}
+	if (__atomic_load_n(&loop->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&loop->lock);
+		pthread_cond_signal(&loop->has_task);
+		pthread_mutex_unlock(&loop->lock);
+	}
+	return 0;
 }
 
-double voidp2double(void* v) {
-	long l = (long)v;
-	return *((double*)(&l));
-}
+/* an async call of a native function registered by js_register_async_native_func() */
+typedef struct {
+	event_loop_t *loop;
+	duk_uarridx_t id;     // of the deferred promise in stash[_calls_]
+	res_type_t res_type;
+	void *res;
+	size_t res_len;
+	int res_copied;
+} async_call_t;
 
-void js_add_module_loader(void *env, void *udd, const char *mod_ext, fn_load_module load_module, fn_get_methods_list get_methods_list, fn_get_attrs_list get_attrs_list, fn_module_finalizer finalizer)
-{
+// settle the promise of an async call with its result, run by the event loop.
+static void settle_async_call(void *udd, void *env) {
 	duk_context *ctx = (duk_context*)env;
-	int loader_count = 0;
-	duk_push_global_object(ctx); // [ global ]
-	if (duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_MOD_COUNT))) {
-		loader_count = duk_require_int(ctx, -1);
+	async_call_t *call = (async_call_t*)udd;
+	duk_push_heap_stash(ctx);                    // [ stash ]
+	duk_get_prop_string(ctx, -1, LOOP_CALLS);    // [ stash, calls ]
+	duk_get_prop_index(ctx, -1, call->id);       // [ stash, calls, d ]
+	duk_del_prop_index(ctx, -2, call->id);
+	if (duk_is_object(ctx, -1)) {
+		if (call->res_type == rt_error) {
+			duk_get_prop_string(ctx, -1, "reject");  // [ stash, calls, d, reject ]
+			duk_push_error_object(ctx, DUK_ERR_ERROR, "%.*s", (int)call->res_len, (const char*)call->res);
+		} else {
+			duk_get_prop_string(ctx, -1, "resolve"); // [ stash, calls, d, resolve ]
+			if (push_native_result(ctx, call->res_type, call->res, call->res_len, NULL) == 0) {
+				duk_push_undefined(ctx);
+			}
+		}
+		duk_pcall(ctx, 1);                           // [ stash, calls, d, retval ]
+		duk_pop(ctx);
 	}
-	duk_pop(ctx);
-	duk_push_int(ctx, loader_count+1);
-	duk_put_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_MOD_COUNT));
-
-	duk_push_object(ctx);        // [ global, obj ]
-
-	duk_push_string(ctx, mod_ext);
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_EXT);
+	duk_pop_3(ctx);
+	if (call->res_copied) {
+		free(call->res);
+	}
+	free(call);
+}
 
-	duk_push_pointer(ctx, load_module);
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_LOADER);
+/* destroy the JS functions saved for the arguments, which are valid only during the call */
+static void release_ecmafunc_args(duk_context *ctx, const char *fmt, void **args)
+{
+	int i, j;
+	for (i=0, j=0; fmt[i] != '\0'; i++) {
+		switch (fmt[i]) {
+		case af_lstring:
+		case af_buffer:
+		case af_jarray:
+		case af_jobject:
+			j += 2;
+			break;
+		case af_ecmafunc:
+			destroy_object(ctx, (unsigned long)args[j]);
+			// fall through
+		default:
+			j += 1;
+			break;
+		}
+	}
+}
 
-	duk_push_pointer(ctx, get_methods_list);
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_METHODS);
+static duk_ret_t async_func_bridge(duk_context *ctx)
+{
+	duk_idx_t nargs = duk_get_top(ctx);                           // [ args... ]
+	duk_push_current_function(ctx);                               // [ args..., async_func_bridge ]
+	duk_get_prop_string(ctx, -1, DUK_HIDDEN_SYMBOL(NATIVE_FUNC)); // [ args..., async_func_bridge, native_func ]
+	duk_get_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_UDD));  // [ args..., async_func_bridge, native_func, udd ]
+	fn_async_native_func native_func = (fn_async_native_func)duk_get_pointer(ctx, -2);
+	void *udd = duk_get_pointer(ctx, -1);
+	duk_pop_3(ctx);                                               // [ args... ]
+
+	event_loop_t *loop = get_env_state(ctx)->loop;
+	async_call_t *call = (async_call_t*)calloc(1, sizeof(async_call_t));
+	if (call == NULL) {
+		return duk_generic_error(ctx, "no memory for async call");
+	}
+	call->loop = loop;
+	if (++loop->last_call_id == 0) {
+		loop->last_call_id = 1;
+	}
+	call->id = loop->last_call_id;
 
-	duk_push_pointer(ctx, get_attrs_list);
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_ATTRS);
+	duk_push_heap_stash(ctx);                    // [ args..., stash ]
+	duk_get_prop_string(ctx, -1, LOOP_DEFER);    // [ args..., stash, defer ]
+	if (duk_pcall(ctx, 0) != DUK_EXEC_SUCCESS || !duk_is_object(ctx, -1)) { // [ args..., stash, d ]
+		free(call);
+		return duk_generic_error(ctx, "no Promise for async call");
+	}
+	duk_get_prop_string(ctx, -2, LOOP_CALLS);    // [ args..., stash, d, calls ]
+	duk_dup(ctx, -2);
+	duk_put_prop_index(ctx, -2, call->id);       // [ args..., stash, d, calls ] with calls[id] = d
+	duk_pop(ctx);
+	duk_get_prop_string(ctx, -1, "promise");     // [ args..., stash, d, promise ]
 
-	duk_push_pointer(ctx, finalizer);
-	duk_put_prop_string(ctx, -2, NATIVE_MOD_FINALIZER);
+	js_loop_async(ctx);
+	if (nargs == 0) {
+		native_func(udd, NULL, NULL, call);
+	} else {
+		char *fmt;
+		void **args;
+		char *p = get_native_args(ctx, nargs, &fmt, &args);
+		if (p == NULL) {
+			const char *err = "no memory for arguments";
+			js_resolve_async(call, rt_error, (void*)err, strlen(err));
+		} else {
+			native_func(udd, fmt, args, call);
+			release_ecmafunc_args(ctx, fmt, args);
+			free(p);
+		}
+	}
+	return 1;
+}
 
+int js_register_async_native_func(void *env, const char *func_name, fn_async_native_func native_func, int param_num, void *udd)
+{
+	duk_context *ctx = (duk_context*)env;
+	if (js_enable_loop(env) != 0) {
+		return -1;
+	}
+	duk_push_global_object(ctx);                         // [ global ]
+	duk_push_string(ctx, func_name);                     // [ global, func_name ]
+	duk_push_c_function(ctx, async_func_bridge, (param_num < 0) ? DUK_VARARGS : param_num); // [ global, func_name, async_func_bridge ]
+	duk_push_pointer(ctx, (void*)native_func);
+	duk_put_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_FUNC));
 	duk_push_pointer(ctx, udd);
-	duk_put_prop_string(ctx, -2, NATIVE_UDD);
-
-	char *modNum = getNativeModNum(loader_count);
-	duk_put_prop_string(ctx, -2, modNum); // [ global ] with globa[modNum] = obj
-	free(modNum);
-
+	duk_put_prop_string(ctx, -2, DUK_HIDDEN_SYMBOL(NATIVE_UDD));
+	duk_put_prop(ctx, -3);                               // [ global ] with global[func_name] = async_func_bridge
 	duk_pop(ctx);
+	return 0;
 }
 
-int js_create_ecmascript_object(void *env, void *udd, void *mod_handle, fn_get_methods_list get_methods_list, fn_get_attrs_list get_attrs_list, fn_module_finalizer finalizer)
+int js_resolve_async(void *completion, res_type_t res_type, void *res, size_t res_len)
 {
-	duk_context *ctx = (duk_context*)env;
-	int ret = init_native_obj(ctx, udd, (const char*)mod_handle, NULL, NULL, NULL, get_methods_list, get_attrs_list, finalizer);
-	switch (ret) {
-	case init_obj_ok:
-		return 0;
-	case failed_to_init_obj:
+	async_call_t *call = (async_call_t*)completion;
+	call->res_type = res_type;
+	call->res_len = res_len;
+	switch (res_type) {
+	case rt_none:
+	case rt_bool:
+	case rt_int:
+	case rt_double:
+		call->res = res;
+		break;
+	case rt_string:
+	case rt_buffer:
+	case rt_object:
+	case rt_array:
+	case rt_error:
+		call->res = malloc(res_len + 1);
+		if (call->res == NULL) {
+			call->res_type = rt_error;
+			call->res = "no memory for async result";
+			call->res_len = strlen((const char*)call->res);
+			break;
+		}
+		memcpy(call->res, res, res_len);
+		call->res_copied = 1;
+		break;
 	default:
-		return -1;
+		call->res_type = rt_error;
+		call->res = "unsupported type of async result";
+		call->res_len = strlen((const char*)call->res);
+		break;
 	}
+	return js_loop_complete(call->loop, settle_async_call, call);
 }
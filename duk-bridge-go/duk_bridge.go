@@ -7,7 +7,7 @@ package duk_bridge
 
 /*
 #cgo CFLAGS: -I.. -I../duktape
-#cgo LDFLAGS: -ldl -lm
+#cgo LDFLAGS: -ldl -lm -lpthread
 #cgo darwin CFLAGS: -DDarwin
 #include "duk_bridge.h"
 #include <string.h>
@@ -29,6 +29,7 @@ import (
 type JSEnv struct {
 	env unsafe.Pointer
 	loaderKey []int64
+	goFuncs map[string]*interface{} // keep the registered go functions referenced by C alive
 }
 
 /**
@@ -37,7 +38,7 @@ type JSEnv struct {
  * @return a new JSEnv if ok, otherwise nil
  */
 func NewEnv(loader GoModuleLoader) *JSEnv {
-	jsEnv := &JSEnv{C.js_create_env(nil), make([]int64, 0, 3)}
+	jsEnv := &JSEnv{C.js_create_env(nil), make([]int64, 0, 3), make(map[string]*interface{})}
 	jsEnv.addGoModuleLoader(&GoPluginModuleLoader{})
 	if loader != nil {
 		jsEnv.addGoModuleLoader(loader)
@@ -49,7 +50,7 @@ func NewEnv(loader GoModuleLoader) *JSEnv {
  * destory a JS environment.
  */
 func (ctx *JSEnv) Destroy() {
-	delete(_firstLoaderKey, ctx.env)
+	removeFirstLoaderKey(ctx.env)
 	C.js_destroy_env(ctx.env)
 	if ctx.loaderKey != nil {
 		for i:=0; i<len(ctx.loaderKey); i++ {
@@ -145,6 +146,49 @@ func (ctx *JSEnv) SyntaxCheck(jsCode string) error {
 	}
 }
 
+/**
+ * mount a module bundle built by cmd/duk-bundle, modules in the bundle are required
+ * without reading files. the bundle `modules.bundle` beside the `modules` dir is mounted
+ * when the env is created.
+ * @param bundleFile  the bundle file
+ * @return nil if ok.
+ */
+func (ctx *JSEnv) MountBundle(bundleFile string) error {
+	f := C.CString(bundleFile)
+	defer C.free(unsafe.Pointer(f))
+
+	if C.js_mount_bundle(ctx.env, f) != 0 {
+		return fmt.Errorf("failed to mount bundle %s", bundleFile)
+	}
+	return nil
+}
+
+/**
+ * compile the source of a module to bytecode, which can be saved in a module bundle.
+ * @param src       the source of the module
+ * @param fileName  the file name of the module in error messages
+ * @return the bytecode
+ */
+func (ctx *JSEnv) DumpModule(src []byte, fileName string) ([]byte, error) {
+	var s *C.char
+	var l C.int
+	getBytesPtrLen(src, &s, &l)
+	f := C.CString(fileName)
+	defer C.free(unsafe.Pointer(f))
+
+	var res interface{} = nil // pointer to result
+	ret := C.js_dump_module(ctx.env, s, C.size_t(l), f, (*[0]byte)(C.go_resultReceived), unsafe.Pointer(&res))
+	r, err := parseResult(res, ret)
+	if err != nil {
+		return nil, err
+	}
+	b, ok := r.([]byte)
+	if !ok {
+		return nil, fmt.Errorf("no bytecode of %s", fileName)
+	}
+	return b, nil
+}
+
 /**
  * check syntax of JS codes in a file.
  * @param scriptFile  the script file
@@ -320,7 +364,11 @@ func (ctx *JSEnv) RegisterGoFunc(funcName string, fn interface{}) error {
 
 	funcN := C.CString(funcName)
 	defer C.free(unsafe.Pointer(funcN))
-	res := C.js_register_native_func(ctx.env, funcN, ((*[0]byte))(C.go_funcBridge), C.int(nargs), unsafe.Pointer(&fn))
+	pFn := &fn
+	res := C.js_register_native_func(ctx.env, funcN, ((*[0]byte))(C.go_funcBridge), C.int(nargs), unsafe.Pointer(pFn))
+	if res == 0 {
+		ctx.goFuncs[funcName] = pFn
+	}
 	return fromErrorCode(res)
 }
 
@@ -328,6 +376,9 @@ func (ctx *JSEnv) UnregisterGoFunc(funcName string) error {
 	funcN := C.CString(funcName)
 	defer C.free(unsafe.Pointer(funcN))
 	res := C.js_unregister_native_func(ctx.env, funcN)
+	if res == 0 {
+		delete(ctx.goFuncs, funcName)
+	}
 	return fromErrorCode(res)
 }
 
@@ -4,6 +4,13 @@ import (
 	"fmt"
 	"encoding/json"
 	"testing"
+	"sync"
+	"time"
+	"sort"
+	"sync/atomic"
+	"path/filepath"
+	"strings"
+	"os"
 )
 
 func adder(a1, a2 float64) float64 {
@@ -40,6 +47,7 @@ func (m *testDukModule) ToJson(args ...interface{}) interface{} {
 }
 
 type testModuleLoader struct {}
+func (loader *testModuleLoader) SetJSEnv(_ *JSEnv) {}
 func (loader *testModuleLoader) GetExtName() string {
 	return ".go.so"
 }
@@ -100,7 +108,7 @@ func Test_jsfunc(t *testing.T) {
 	// res := jsEnv.CallFunc("test", map[string]interface{}{"Hello":1, "name":"haha"})
 	// res := jsEnv.CallFunc("test", fmt.Sprintf("%s %s", "hello", "test"), 1.8)
 	// res := jsEnv.CallFunc("test", "hello", "test", 1.8)
-	res := jsEnv.CallFunc("test", "hello", "test", 1.8, []int{1, 3})
+	res, _ := jsEnv.CallFunc("test", "hello", "test", 1.8, []int{1, 3})
 	handleCallFuncResult(res)
 	jsEnv.UnregisterFunc("test")
 }
@@ -130,3 +138,534 @@ func Test_gomodule(t *testing.T) {
 		handleCallFuncResult(res)
 	}
 }
+
+type testPerson struct {
+	Name string `json:"name"`
+	Age  int    `json:"age"`
+	Tags []string `json:"tags"`
+}
+
+func Test_callAs(t *testing.T) {
+	if d, err := EvalAs[float64](jsEnv, "2 + 3"); err != nil || d != 5 {
+		t.Errorf("EvalAs[float64]: %v, %v\n", d, err)
+	}
+	if i, err := EvalAs[int](jsEnv, "40 + 2"); err != nil || i != 42 {
+		t.Errorf("EvalAs[int]: %v, %v\n", i, err)
+	}
+	if b, err := EvalAs[bool](jsEnv, "1 < 2"); err != nil || !b {
+		t.Errorf("EvalAs[bool]: %v, %v\n", b, err)
+	}
+	if s, err := EvalAs[string](jsEnv, "'hello' + ' world'"); err != nil || s != "hello world" {
+		t.Errorf("EvalAs[string]: %v, %v\n", s, err)
+	}
+	if _, err := EvalAs[bool](jsEnv, "'not a bool'"); err == nil {
+		t.Errorf("EvalAs[bool] with a string result should fail\n")
+	}
+
+	err := jsEnv.RegisterCodeFunc([]byte("function(n, a) { return {name: n, age: a, tags: ['x', 'y']} }"), "person")
+	if err != nil {
+		t.Fatalf("failed to register code func: %v\n", err)
+	}
+	defer jsEnv.UnregisterFunc("person")
+	p, err := CallAs[testPerson](jsEnv, "person", "rosbit", 20)
+	if err != nil || p.Name != "rosbit" || p.Age != 20 || len(p.Tags) != 2 {
+		t.Errorf("CallAs[testPerson]: %v, %v\n", p, err)
+	}
+	pp, err := CallAs[*testPerson](jsEnv, "person", "duk", 3)
+	if err != nil || pp == nil || pp.Name != "duk" {
+		t.Errorf("CallAs[*testPerson]: %v, %v\n", pp, err)
+	}
+	m, err := CallAs[map[string]interface{}](jsEnv, "person", "duk", 3)
+	if err != nil || m["name"] != "duk" {
+		t.Errorf("CallAs[map]: %v, %v\n", m, err)
+	}
+	if _, err = EvalAs[int](jsEnv, "throw new Error('oops')"); err == nil {
+		t.Errorf("EvalAs should return the js error\n")
+	}
+}
+
+func testEnvPool(t *testing.T, lockOSThread bool) {
+	pool, err := NewJSEnvPool(&JSEnvPoolConfig{
+		Size: 4,
+		LockOSThread: lockOSThread,
+		GoFuncs: map[string]interface{}{"adder": adder},
+		MaxWait: 5 * time.Second,
+	})
+	if err != nil {
+		t.Fatalf("failed to create pool: %v\n", err)
+	}
+	defer pool.Close()
+
+	const n = 64
+	var wg sync.WaitGroup
+	errs := make(chan error, n)
+	for i:=0; i<n; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			err := pool.Do(func(env *JSEnv) {
+				r, err := EvalAs[int](env, fmt.Sprintf("adder(%d, 1)", i))
+				if err == nil && r != i+1 {
+					err = fmt.Errorf("adder(%d, 1) = %d", i, r)
+				}
+				if err != nil {
+					errs <- err
+				}
+			})
+			if err != nil {
+				errs <- err
+			}
+		}(i)
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		t.Errorf("%v\n", err)
+	}
+	if stats := pool.Stats(); stats.Calls != n || stats.Busy != 0 {
+		t.Errorf("unexpected stats: %+v\n", stats)
+	}
+}
+
+func Test_envPool(t *testing.T) {
+	testEnvPool(t, false)
+	testEnvPool(t, true)
+}
+
+func Test_executor(t *testing.T) {
+	e, err := NewExecutor(&ExecutorConfig{
+		Threads: 4,
+		QueueSize: 2,
+		GoFuncs: map[string]interface{}{"adder": func(a, b float64) float64 { return a + b }},
+	})
+	if err != nil {
+		t.Fatalf("failed to create executor: %v\n", err)
+	}
+
+	var wg sync.WaitGroup
+	for i:=0; i<32; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			if err := e.Do(func(ctx *JSEnv) {
+				if r, err := EvalAs[int](ctx, fmt.Sprintf("adder(%d, 1)", i)); err != nil || r != i+1 {
+					t.Errorf("unexpected result: %v, %v\n", r, err)
+				}
+			}); err != nil {
+				t.Errorf("failed to run job: %v\n", err)
+			}
+		}(i)
+	}
+	wg.Wait()
+
+	// the state kept in an env is found by the jobs pinned to its thread
+	worker := -1
+	e.Do(func(ctx *JSEnv) {
+		worker = e.Worker(ctx)
+		ctx.Eval("var kept = 10")
+	})
+	for i:=0; i<8; i++ {
+		if err := e.DoOn(worker, func(ctx *JSEnv) {
+			if w := e.Worker(ctx); w != worker {
+				t.Errorf("job run by worker %d, not %d\n", w, worker)
+			}
+			if r, err := EvalAs[int](ctx, "kept++"); err != nil || r != 10+i {
+				t.Errorf("unexpected result: %v, %v\n", r, err)
+			}
+		}); err != nil {
+			t.Errorf("failed to run job: %v\n", err)
+		}
+	}
+	if err := e.DoOn(4, func(ctx *JSEnv) {}); err == nil {
+		t.Errorf("job run by a worker not existing\n")
+	}
+
+	// a job waiting for another job of the executor is refused instead of deadlocking
+	e.Do(func(ctx *JSEnv) {
+		if err := e.DoOn(e.Worker(ctx), func(*JSEnv) {}); err != ErrNestedJob {
+			t.Errorf("unexpected error of nested DoOn: %v\n", err)
+		}
+		if err := e.Do(func(*JSEnv) {}); err != ErrNestedJob {
+			t.Errorf("unexpected error of nested Do: %v\n", err)
+		}
+	})
+
+	var jobs uint64
+	stats := e.Stats()
+	for _, s := range stats {
+		jobs += s.Jobs
+	}
+	if len(stats) != 4 || jobs != 32+1+8+1 {
+		t.Errorf("unexpected stats: %+v\n", stats)
+	}
+
+	e.Close()
+	if err := e.Do(func(ctx *JSEnv) {}); err != ErrExecutorClosed {
+		t.Errorf("unexpected error: %v\n", err)
+	}
+
+	// closed while jobs are being submitted to a full queue
+	e, err = NewExecutor(&ExecutorConfig{Threads: 2, QueueSize: 1})
+	if err != nil {
+		t.Fatalf("failed to create executor: %v\n", err)
+	}
+	for i:=0; i<16; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			if err := e.Do(func(ctx *JSEnv) { time.Sleep(time.Millisecond) }); err != nil && err != ErrExecutorClosed {
+				t.Errorf("unexpected error: %v\n", err)
+			}
+		}()
+	}
+	time.Sleep(2*time.Millisecond)
+	e.Close()
+	wg.Wait()
+}
+
+var loopEnv *JSEnv
+
+func sleepAsync(ms float64, cb *EcmaObject) {
+	done := loopEnv.Async()
+	go func() {
+		time.Sleep(time.Duration(ms) * time.Millisecond)
+		done(func(ctx *JSEnv) {
+			ctx.CallEcmascriptFunc(cb, ms)
+			ctx.DestroyEcmascriptFunc(cb)
+		})
+	}()
+}
+
+func Test_eventLoop(t *testing.T) {
+	ctx := NewEnv(nil)
+	defer ctx.Destroy()
+	if err := ctx.EnableLoop(); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	loopEnv = ctx
+	ctx.RegisterGoFunc("sleepAsync", sleepAsync)
+
+	// the 2 sleeps are overlapped
+	ctx.Eval(`var log = [];
+		setTimeout(function(a) { log.push('t' + a) }, 5, 5);
+		clearTimeout(setTimeout(function() { log.push('cleared') }, 1));
+		var n = 0, iv = setInterval(function() { if (++n == 3) { clearInterval(iv); log.push('iv' + n) } }, 1);
+		sleepAsync(50, function(ms) { log.push('s' + ms) });
+		sleepAsync(50, function(ms) { log.push('s' + ms) });`)
+	start := time.Now()
+	if err := ctx.RunLoop(); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	if elapsed := time.Since(start); elapsed >= 90*time.Millisecond {
+		t.Errorf("async operations not overlapped: %v\n", elapsed)
+	}
+	if res, _ := ctx.Eval("log.join()"); res != "iv3,t5,s50,s50" {
+		t.Errorf("unexpected log: %v\n", res)
+	}
+
+	ctx.Eval(`setTimeout(function() { throw new Error('boom') }, 1)`)
+	if err := ctx.RunLoop(); err == nil {
+		t.Errorf("error of timer expected\n")
+	}
+}
+
+func slowLookup(key string) (map[string]interface{}, error) {
+	time.Sleep(30 * time.Millisecond)
+	if key == "bad" {
+		return nil, fmt.Errorf("%s not found", key)
+	}
+	return map[string]interface{}{"key": key}, nil
+}
+
+func Test_asyncFunc(t *testing.T) {
+	ctx := NewEnv(nil)
+	defer ctx.Destroy()
+	if err := ctx.RegisterGoAsyncFunc("lookup", slowLookup); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+
+	// 10 lookups run in parallel
+	ctx.Eval(`var res = [];
+		var keys = []; for (var i=0; i<10; i++) { keys.push('k' + i); }
+		Promise.all(keys.map(function(k) { return lookup(k); })).then(function(a) {
+			res.push(a.map(function(r) { return r.key; }).join(''));
+		});
+		lookup('bad')['catch'](function(e) { res.push(e.message); });`)
+	start := time.Now()
+	if err := ctx.RunLoop(); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	if elapsed := time.Since(start); elapsed >= 150*time.Millisecond {
+		t.Errorf("lookups not in parallel: %v\n", elapsed)
+	}
+	if r, _ := ctx.Eval("res.sort().join()"); r != "bad not found,k0k1k2k3k4k5k6k7k8k9" {
+		t.Errorf("unexpected result: %v\n", r)
+	}
+}
+
+func Test_asyncFuncTypes(t *testing.T) {
+	ctx := NewEnv(nil)
+	defer ctx.Destroy()
+	if err := ctx.RegisterGoAsyncFunc("withCallback", func(cb *EcmaObject) {}); err == nil {
+		t.Errorf("JS function argument should be refused\n")
+	}
+	if err := ctx.RegisterGoAsyncFunc("newPerson", func() *testBindPerson { return nil }); err == nil {
+		t.Errorf("struct result should be refused\n")
+	}
+
+	// a JS function given through interface{} rejects the Promise
+	ctx.RegisterGoAsyncFunc("anyArg", func(v interface{}) bool { return v != nil })
+	ctx.Eval(`var res = [];
+		anyArg(function() {})['catch'](function(e) { res.push(e.message); });`)
+	if err := ctx.RunLoop(); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	if r, _ := ctx.Eval("res.join()"); r != "JS function argument not supported by async function" {
+		t.Errorf("unexpected result: %v\n", r)
+	}
+}
+
+// strings given to go functions are decoded with their length, and keep embedded NULs and UTF-8.
+func Test_stringArgs(t *testing.T) {
+	ctx := NewEnv(nil)
+	defer ctx.Destroy()
+	quote := func(s string, b []byte) string { return fmt.Sprintf("%q %q", s, b) }
+	ctx.RegisterGoFunc("quote", quote)
+	ctx.RegisterGoAsyncFunc("quoteAsync", quote)
+	expected := `"" "a\x00b",` + `"中文" "x"`
+	if r, err := ctx.Eval(`[quote('', 'a\u0000b'), quote('中文', 'x')].join()`); err != nil || r != expected {
+		t.Errorf("unexpected result: %v, %v\n", r, err)
+	}
+	ctx.Eval(`var res;
+		Promise.all([quoteAsync('', 'a\u0000b'), quoteAsync('中文', 'x')]).then(function(a) { res = a.join(); });`)
+	if err := ctx.RunLoop(); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	if r, err := ctx.Eval("res"); err != nil || r != expected {
+		t.Errorf("unexpected async result: %v, %v\n", r, err)
+	}
+}
+
+// every 20th job runs 100 times longer than others.
+const skewedJob = `(function(n) { var s = 0; for (var i=0; i<n; i++) { s += i; } return s; })(%d)`
+
+func runSkewed(b *testing.B, do func(fn func(*JSEnv)) error) {
+	var mu sync.Mutex
+	lats := make([]time.Duration, 0, b.N)
+	var i int64
+	b.SetParallelism(4)
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			n := 1000
+			if atomic.AddInt64(&i, 1) % 20 == 0 {
+				n = 100000
+			}
+			code := fmt.Sprintf(skewedJob, n)
+			start := time.Now()
+			do(func(ctx *JSEnv) { ctx.Eval(code) })
+			lat := time.Since(start)
+			mu.Lock()
+			lats = append(lats, lat)
+			mu.Unlock()
+		}
+	})
+	b.StopTimer()
+	sort.Slice(lats, func(i, j int) bool { return lats[i] < lats[j] })
+	b.ReportMetric(float64(lats[len(lats)/2].Microseconds()), "p50-us")
+	b.ReportMetric(float64(lats[len(lats)*99/100].Microseconds()), "p99-us")
+}
+
+// go test -run none -bench Benchmark_skewed -benchtime 5000x
+func Benchmark_skewed(b *testing.B) {
+	b.Run("fifo", func(b *testing.B) {
+		pool, err := NewJSEnvPool(&JSEnvPoolConfig{Size: 4, LockOSThread: true})
+		if err != nil {
+			b.Fatalf("%v\n", err)
+		}
+		defer pool.Close()
+		runSkewed(b, pool.Do)
+	})
+	b.Run("stealing", func(b *testing.B) {
+		e, err := NewExecutor(&ExecutorConfig{Threads: 4})
+		if err != nil {
+			b.Fatalf("%v\n", err)
+		}
+		defer e.Close()
+		runSkewed(b, e.Do)
+	})
+}
+
+type testBindPerson struct {
+	Name string
+	Age  int
+	Tags []string
+	secret string
+}
+
+func (p *testBindPerson) Greet(who string) string {
+	return fmt.Sprintf("%s greets %s", p.Name, who)
+}
+
+func (p *testBindPerson) Older(years int) int {
+	p.Age += years
+	return p.Age
+}
+
+func Test_goStructBinding(t *testing.T) {
+	newPerson := func(name string, age int) *testBindPerson {
+		return &testBindPerson{name, age, []string{"a", "b"}, "hidden"}
+	}
+	if err := jsEnv.RegisterGoFunc("newPerson", newPerson); err != nil {
+		t.Fatalf("failed to register: %v\n", err)
+	}
+	defer jsEnv.UnregisterGoFunc("newPerson")
+
+	for i:=0; i<3; i++ {
+		r, err := EvalAs[string](jsEnv, fmt.Sprintf(`
+			var p = newPerson('p%d', 20);
+			[p.greet('js'), p.older(2), p.name, p.age, p.tags.length, typeof p.secret].join(',')`, i))
+		expected := fmt.Sprintf("p%d greets js,22,p%d,20,2,undefined", i, i)
+		if err != nil || r != expected {
+			t.Errorf("unexpected result: %v, %v\n", r, err)
+		}
+	}
+
+	// a method detached from a finalized instance returns undefined.
+	if r, err := EvalAs[string](jsEnv, `
+		var g = newPerson('a', 1).greet;
+		Duktape.gc(); Duktape.gc();
+		typeof g('x')`); err != nil || r != "undefined" {
+		t.Errorf("unexpected result of detached method: %v, %v\n", r, err)
+	}
+
+	if r, err := EvalAs[float64](jsEnv, "require('anymod').adder(1, 2)"); err != nil || r != 3 {
+		t.Errorf("failed to call module method: %v, %v\n", r, err)
+	}
+	// the loader of ".go.so" is found by the extension with two dots, and loaders not matching
+	// the extension are still tried after the plugin loader of ".so" declines.
+	for _, id := range []string{"x.go.so", "plain.so"} {
+		if r, err := EvalAs[float64](jsEnv, fmt.Sprintf("require('%s').adder(1, 2)", id)); err != nil || r != 3 {
+			t.Errorf("failed to load %s: %v, %v\n", id, r, err)
+		}
+	}
+}
+
+type testLivePerson struct {
+	LiveAttrs
+	Name string
+	Age  int
+	Tags []string
+	Code [4]byte
+}
+
+func (p *testLivePerson) Older(years int) int {
+	p.Age += years
+	return p.Age
+}
+
+var livePerson = &testLivePerson{Name: "live", Age: 20, Tags: []string{"a"}}
+
+func getLivePerson() *testLivePerson {
+	return livePerson
+}
+
+func Test_liveAttrs(t *testing.T) {
+	person := livePerson
+	if err := jsEnv.RegisterGoFunc("getPerson", getLivePerson); err != nil {
+		t.Fatalf("failed to register: %v\n", err)
+	}
+	defer jsEnv.UnregisterGoFunc("getPerson")
+
+	r, err := EvalAs[string](jsEnv, `
+		var p = getPerson();
+		var before = p.age;
+		p.older(2);
+		p.name = 'changed';
+		p.tags = ['x', 'y'];
+		[before, p.age, p.name, p.tags.join('+'), Object.keys(p).indexOf('name') >= 0].join(',')`)
+	if err != nil || r != "20,22,changed,x+y,true" {
+		t.Errorf("unexpected result: %v, %v\n", r, err)
+	}
+	if person.Name != "changed" || len(person.Tags) != 2 || person.Tags[1] != "y" {
+		t.Errorf("assignment in JS not written back: %+v\n", person)
+	}
+
+	person.Age = 50
+	if r, err := EvalAs[int](jsEnv, "p.age"); err != nil || r != 50 {
+		t.Errorf("change in Go not visible: %v, %v\n", r, err)
+	}
+	if _, err := EvalAs[interface{}](jsEnv, "p.age = 'not a number'"); err == nil {
+		t.Errorf("error expected when assigning a string to an int attribute\n")
+	}
+	// a [N]byte attribute takes N bytes only
+	for _, code := range []string{"'ab'", "new Uint8Array([1, 2])", "'abcde'"} {
+		if _, err := EvalAs[interface{}](jsEnv, "p.code = " + code); err == nil {
+			t.Errorf("error expected when assigning %s to a [4]byte attribute\n", code)
+		}
+	}
+	if r, err := EvalAs[string](jsEnv, "p.code = 'abcd'; p.code = new Uint8Array([65, 66, 67, 68]); p.code"); err != nil || r != "ABCD" || string(person.Code[:]) != "ABCD" {
+		t.Errorf("unexpected [4]byte attribute: %v, %v, %v\n", r, err, person.Code)
+	}
+
+	// accessors detached from a finalized instance do nothing.
+	if r, err := EvalAs[string](jsEnv, `
+		var d = Object.getOwnPropertyDescriptor(getPerson(), 'name');
+		Duktape.gc(); Duktape.gc();
+		d.set('detached');
+		typeof d.get()`); err != nil || r != "undefined" || person.Name != "changed" {
+		t.Errorf("unexpected result of detached accessor: %v, %v, %s\n", r, err, person.Name)
+	}
+}
+
+func Test_hotReload(t *testing.T) {
+	exe, err := os.Executable()
+	if err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	modDir := filepath.Join(filepath.Dir(exe), "modules", "reload")
+	if err = os.MkdirAll(modDir, 0755); err != nil {
+		t.Fatalf("%v\n", err)
+	}
+	defer os.RemoveAll(modDir)
+	// a large module is rewritten in place, which must not be mapped when it is read.
+	pad := "/*" + strings.Repeat("x", 70*1024) + "*/\n"
+	writeMod := func(v string) {
+		if err := os.WriteFile(filepath.Join(modDir, "m.js"), []byte(pad + "exports.v = '" + v + "';"), 0644); err != nil {
+			t.Fatalf("%v\n", err)
+		}
+	}
+	requireV := func(expected string) {
+		if r, err := EvalAs[string](jsEnv, "require('reload/m').v"); err != nil || r != expected {
+			t.Errorf("unexpected module value: %v, %v, %s expected\n", r, err, expected)
+		}
+	}
+
+	writeMod("old")
+	requireV("old")
+	writeMod("new")
+	requireV("old") // the loaded module is kept
+	if !jsEnv.InvalidateModule("reload/m") {
+		t.Errorf("module not invalidated\n")
+	}
+	requireV("new")
+	if jsEnv.InvalidateModule("reload/none") {
+		t.Errorf("a module not loaded should not be invalidated\n")
+	}
+
+	w, err := WatchModules("")
+	if err != nil {
+		t.Skipf("module watcher not supported: %v\n", err)
+	}
+	defer w.Close()
+	writeMod("watched")
+	n := 0
+	for i:=0; i<100 && n == 0; i++ {
+		time.Sleep(10 * time.Millisecond)
+		n = jsEnv.ApplyModuleChanges(w)
+	}
+	if n != 1 {
+		t.Errorf("changed module not invalidated: %d\n", n)
+	}
+	requireV("watched")
+}
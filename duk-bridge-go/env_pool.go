@@ -0,0 +1,276 @@
+package duk_bridge
+/**
+ * a pool of JS environments which can be shared by goroutines.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+import (
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+	"errors"
+	"fmt"
+)
+
+var (
+	ErrPoolTimeout = errors.New("timeout to wait for a free JSEnv")
+	ErrPoolClosed  = errors.New("JSEnvPool closed")
+)
+
+/**
+ * configuration of a JSEnvPool.
+ */
+type JSEnvPoolConfig struct {
+	Size         int                     // count of envs, runtime.NumCPU() if <= 0
+	NewLoader    func() GoModuleLoader   // to create a module loader for every env, nil if none
+	LockOSThread bool                    // each env is owned by a goroutine locked to an OS thread
+	GoFuncs      map[string]interface{}  // funcName -> go function, registered in every env
+	FileFuncs    map[string]string       // funcName -> script file, registered in every env
+	MaxWait      time.Duration           // the max time Do() waits for a free env, 0 to wait forever
+	Watcher      *ModuleWatcher          // changed modules are reloaded before every job, nil if none
+}
+
+/**
+ * metrics of a JSEnvPool.
+ */
+type JSEnvPoolStats struct {
+	Size        int           // count of envs
+	Busy        int           // count of envs running a job
+	Calls       uint64        // count of jobs run by Do()
+	Timeouts    uint64        // count of Do() failed to wait for a free env
+	WaitTime    time.Duration // total time of waiting for a free env
+	MaxWaitTime time.Duration // max time of waiting for a free env
+}
+
+type poolJob struct {
+	fn    func(*JSEnv)
+	done  chan interface{} // nil or the value of panic
+}
+
+/**
+ * a pool of JSEnv. Every env is used by one goroutine at a time.
+ */
+type JSEnvPool struct {
+	cfg    JSEnvPoolConfig
+	idle   chan *JSEnv   // free envs, used when cfg.LockOSThread is false
+	jobs   chan *poolJob // jobs for the env owners, used when cfg.LockOSThread is true
+	closed chan struct{}
+	wg     sync.WaitGroup
+	closeOnce sync.Once
+	created int // count of envs created in idle
+
+	busy        int64
+	calls       uint64
+	timeouts    uint64
+	waitTime    int64
+	maxWaitTime int64
+}
+
+/**
+ * create a pool of JSEnv.
+ * @param cfg  the configuration of pool
+ * @return a new JSEnvPool if ok
+ */
+func NewJSEnvPool(cfg *JSEnvPoolConfig) (*JSEnvPool, error) {
+	p := &JSEnvPool{closed: make(chan struct{})}
+	if cfg != nil {
+		p.cfg = *cfg
+	}
+	if p.cfg.Size <= 0 {
+		p.cfg.Size = runtime.NumCPU()
+	}
+
+	if !p.cfg.LockOSThread {
+		p.idle = make(chan *JSEnv, p.cfg.Size)
+		for i:=0; i<p.cfg.Size; i++ {
+			env, err := p.newEnv()
+			if err != nil {
+				p.Close()
+				return nil, err
+			}
+			p.idle <- env
+			p.created++
+		}
+		return p, nil
+	}
+
+	p.jobs = make(chan *poolJob)
+	initRes := make(chan error, p.cfg.Size)
+	for i:=0; i<p.cfg.Size; i++ {
+		p.wg.Add(1)
+		go p.envOwner(initRes)
+	}
+	var err error
+	for i:=0; i<p.cfg.Size; i++ {
+		if e := <-initRes; e != nil && err == nil {
+			err = e
+		}
+	}
+	if err != nil {
+		p.Close()
+		return nil, err
+	}
+	return p, nil
+}
+
+func (p *JSEnvPool) newEnv() (*JSEnv, error) {
+	var loader GoModuleLoader
+	if p.cfg.NewLoader != nil {
+		loader = p.cfg.NewLoader()
+	}
+	env := NewEnv(loader)
+	for funcName, fn := range p.cfg.GoFuncs {
+		if err := env.RegisterGoFunc(funcName, fn); err != nil {
+			env.Destroy()
+			return nil, fmt.Errorf("failed to register go func %s: %v", funcName, err)
+		}
+	}
+	for funcName, scriptFile := range p.cfg.FileFuncs {
+		if err := env.RegisterFileFunc(scriptFile, funcName); err != nil {
+			env.Destroy()
+			return nil, fmt.Errorf("failed to register %s in %s: %v", funcName, scriptFile, err)
+		}
+	}
+	return env, nil
+}
+
+// the goroutine owning an env when cfg.LockOSThread is true.
+func (p *JSEnvPool) envOwner(initRes chan<- error) {
+	defer p.wg.Done()
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	env, err := p.newEnv()
+	initRes <- err
+	if err != nil {
+		return
+	}
+	defer env.Destroy()
+
+	for {
+		select {
+		case job := <-p.jobs:
+			p.applyModuleChanges(env)
+			job.done <- runJob(env, job.fn)
+		case <-p.closed:
+			return
+		}
+	}
+}
+
+func runJob(env *JSEnv, fn func(*JSEnv)) (panicVal interface{}) {
+	defer func() {
+		panicVal = recover()
+	}()
+	fn(env)
+	return
+}
+
+func (p *JSEnvPool) applyModuleChanges(env *JSEnv) {
+	if p.cfg.Watcher != nil {
+		env.ApplyModuleChanges(p.cfg.Watcher)
+	}
+}
+
+func (p *JSEnvPool) waited(start time.Time) {
+	w := int64(time.Since(start))
+	atomic.AddInt64(&p.waitTime, w)
+	for {
+		m := atomic.LoadInt64(&p.maxWaitTime)
+		if w <= m || atomic.CompareAndSwapInt64(&p.maxWaitTime, m, w) {
+			return
+		}
+	}
+}
+
+func (p *JSEnvPool) timeout() <-chan time.Time {
+	if p.cfg.MaxWait <= 0 {
+		return nil
+	}
+	return time.After(p.cfg.MaxWait)
+}
+
+/**
+ * run fn with a free env in the pool. the env must not be used after fn returns.
+ * @param fn  the function to use the env
+ * @return ErrPoolTimeout if no env is free in cfg.MaxWait, ErrPoolClosed if the pool is closed.
+ */
+func (p *JSEnvPool) Do(fn func(*JSEnv)) error {
+	start := time.Now()
+	if p.idle != nil {
+		var env *JSEnv
+		select {
+		case env = <-p.idle:
+		default:
+			select {
+			case env = <-p.idle:
+			case <-p.timeout():
+				atomic.AddUint64(&p.timeouts, 1)
+				return ErrPoolTimeout
+			case <-p.closed:
+				return ErrPoolClosed
+			}
+		}
+		p.waited(start)
+		atomic.AddInt64(&p.busy, 1)
+		defer func() {
+			atomic.AddInt64(&p.busy, -1)
+			atomic.AddUint64(&p.calls, 1)
+			p.idle <- env
+		}()
+		p.applyModuleChanges(env)
+		fn(env)
+		return nil
+	}
+
+	job := &poolJob{fn, make(chan interface{}, 1)}
+	select {
+	case p.jobs <- job:
+	case <-p.timeout():
+		atomic.AddUint64(&p.timeouts, 1)
+		return ErrPoolTimeout
+	case <-p.closed:
+		return ErrPoolClosed
+	}
+	p.waited(start)
+	atomic.AddInt64(&p.busy, 1)
+	panicVal := <-job.done
+	atomic.AddInt64(&p.busy, -1)
+	atomic.AddUint64(&p.calls, 1)
+	if panicVal != nil {
+		panic(panicVal)
+	}
+	return nil
+}
+
+/**
+ * get the metrics of the pool.
+ */
+func (p *JSEnvPool) Stats() JSEnvPoolStats {
+	return JSEnvPoolStats{
+		Size:        p.cfg.Size,
+		Busy:        int(atomic.LoadInt64(&p.busy)),
+		Calls:       atomic.LoadUint64(&p.calls),
+		Timeouts:    atomic.LoadUint64(&p.timeouts),
+		WaitTime:    time.Duration(atomic.LoadInt64(&p.waitTime)),
+		MaxWaitTime: time.Duration(atomic.LoadInt64(&p.maxWaitTime)),
+	}
+}
+
+/**
+ * destroy all the envs in the pool. running jobs are waited to finish.
+ */
+func (p *JSEnvPool) Close() {
+	p.closeOnce.Do(func() {
+		close(p.closed)
+		if p.idle == nil {
+			p.wg.Wait()
+			return
+		}
+		for i:=0; i<p.created; i++ {
+			env := <-p.idle // wait for the busy ones
+			env.Destroy()
+		}
+	})
+}
@@ -0,0 +1,263 @@
+package duk_bridge
+/**
+ * the event loop of a JSEnv: timers of JS and async operations completed by goroutines.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+#include <string.h>
+extern void go_loopTask(void*, void*);
+extern void go_loopError(void*, int, void*, size_t);
+extern void go_asyncFuncBridge(void*, char*, void**, void*);
+*/
+import "C"
+
+import (
+	"unsafe"
+	"bytes"
+	"runtime/cgo"
+	"reflect"
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+/**
+ * enable the event loop of the env, which adds setTimeout()/setInterval()/clearTimeout()/clearInterval()
+ * to JS. timers and async operations are run by RunOnce() or RunLoop().
+ */
+func (ctx *JSEnv) EnableLoop() error {
+	if C.js_enable_loop(ctx.env) != 0 {
+		return fmt.Errorf("failed to enable event loop")
+	}
+	return nil
+}
+
+//export go_loopError
+func go_loopError(udd unsafe.Pointer, resType C.int, res unsafe.Pointer, resLen C.size_t) {
+	err := (*error)(udd)
+	if *err == nil {
+		*err = errors.New(C.GoStringN((*C.char)(res), C.int(resLen)))
+	}
+}
+
+/**
+ * run the timers expired and the async operations completed, waiting for one of them if none is ready.
+ * @param timeout  the max time to wait, 0 not to wait, <0 to wait until one is ready
+ * @return count of timers and async operations pending, and the first error thrown by timers.
+ */
+func (ctx *JSEnv) RunOnce(timeout time.Duration) (pending int, err error) {
+	timeoutMs := -1
+	if timeout >= 0 {
+		timeoutMs = int(timeout / time.Millisecond)
+	}
+	n := C.js_run_once(ctx.env, C.int(timeoutMs), (*[0]byte)(C.go_loopError), unsafe.Pointer(&err))
+	if n < 0 {
+		return 0, fmt.Errorf("event loop not enabled")
+	}
+	return int(n), err
+}
+
+/**
+ * run the event loop until no timers and async operations are pending, or an error is thrown by a timer.
+ */
+func (ctx *JSEnv) RunLoop() error {
+	for {
+		n, err := ctx.RunOnce(-1)
+		if err != nil || n == 0 {
+			return err
+		}
+	}
+}
+
+type loopTask struct {
+	ctx *JSEnv
+	fn  func(*JSEnv)
+}
+
+//export go_loopTask
+func go_loopTask(udd unsafe.Pointer, env unsafe.Pointer) {
+	h := *(*cgo.Handle)(udd)
+	C.free(udd)
+	task := h.Value().(*loopTask)
+	h.Delete()
+	if task.fn != nil {
+		task.fn(task.ctx)
+	}
+}
+
+/**
+ * start an async operation in a go function called by JS, so the go function can return at once
+ * and leave the work to a goroutine. the returned function must be called once by any goroutine
+ * when the work is done, fn is run by the event loop with the env later, e.g. to call the
+ * callback from JS:
+ *   done := ctx.Async()
+ *   go func() {
+ *      res := doIO()
+ *      done(func(ctx *JSEnv) {
+ *         ctx.CallEcmascriptFunc(cb, res)
+ *         ctx.DestroyEcmascriptFunc(cb)
+ *      })
+ *   }()
+ * @return nil if the event loop is not enabled.
+ */
+func (ctx *JSEnv) Async() func(fn func(*JSEnv)) {
+	async := C.js_loop_async(ctx.env)
+	if async == nil {
+		return nil
+	}
+	var once sync.Once
+	return func(fn func(*JSEnv)) {
+		once.Do(func() {
+			h := cgo.NewHandle(&loopTask{ctx, fn})
+			// the handle is kept in C memory, because the task is queued. freed by go_loopTask().
+			ph := (*cgo.Handle)(C.malloc(C.size_t(unsafe.Sizeof(h))))
+			*ph = h
+			if C.js_loop_complete(async, (*[0]byte)(C.go_loopTask), unsafe.Pointer(ph)) != 0 {
+				C.free(unsafe.Pointer(ph))
+				h.Delete()
+			}
+		})
+	}
+}
+
+/*
+ * a JS function can't be used by the goroutine, and a struct result is bound to the env by
+ * the goroutine.
+ */
+func checkAsyncFuncType(funType reflect.Type) error {
+	for i:=0; i<funType.NumIn(); i++ {
+		t := funType.In(i)
+		if funType.IsVariadic() && i == funType.NumIn()-1 {
+			t = t.Elem()
+		}
+		if t == ecmaObjectType {
+			return fmt.Errorf("JS function argument not supported by async function")
+		}
+	}
+	for i:=0; i<funType.NumOut(); i++ {
+		t := funType.Out(i)
+		if t == ecmaObjectType || (t.Kind() == reflect.Ptr && t.Elem().Kind() == reflect.Struct) {
+			return fmt.Errorf("%v result not supported by async function", t)
+		}
+	}
+	return nil
+}
+
+/**
+ * register a go function called by JS asynchronously: JS gets a Promise at once, and fn is run
+ * in a goroutine, then its result resolves the Promise, or its error rejects it. So slow lookups
+ * called by a script run in parallel. The event loop is enabled, and Promise is added to JS if
+ * it has none. The arguments and results of fn are limited as RegisterGoFunc(), but a struct
+ * result or a JS function argument is not supported: fn with them is refused, and the Promise
+ * is rejected if a JS function is given through interface{}.
+ * @param funcName  the function name to be registered
+ * @param fn        the golang function, which must be safe to run in parallel
+ */
+func (ctx *JSEnv) RegisterGoAsyncFunc(funcName string, fn interface{}) error {
+	fun := reflect.ValueOf(fn)
+	if fun.Kind() != reflect.Func {
+		return fmt.Errorf("go function expected")
+	}
+	funType := fun.Type()
+	if err := checkAsyncFuncType(funType); err != nil {
+		return err
+	}
+	var nargs int
+	if funType.IsVariadic() {
+		nargs = -1
+	} else {
+		nargs = funType.NumIn()
+	}
+
+	funcN := C.CString(funcName)
+	defer C.free(unsafe.Pointer(funcN))
+	pFn := &fn
+	res := C.js_register_async_native_func(ctx.env, funcN, (*[0]byte)(C.go_asyncFuncBridge), C.int(nargs), unsafe.Pointer(pFn))
+	if res == 0 {
+		ctx.goFuncs[funcName] = pFn
+	}
+	return fromErrorCode(res)
+}
+
+/*
+ * copy the arguments of a native function, which are valid only during the call, to C memory.
+ */
+func copyNativeArgs(ft *C.char, args *unsafe.Pointer) (*C.char, []unsafe.Pointer, []unsafe.Pointer) {
+	if ft == (*C.char)(C.NULL) {
+		return ft, nil, nil
+	}
+	nargs := int(C.strlen(ft))
+	bft := toBytes(ft, nargs)
+	arrArgs := toPointerArray(args, 2*nargs)
+	argsCopy := make([]unsafe.Pointer, 2*nargs)
+	mem := make([]unsafe.Pointer, 0, nargs+1)
+	j := 0
+	for i:=0; i<nargs; i++ {
+		switch bft[i] {
+		case C.af_lstring, C.af_buffer, C.af_jarray, C.af_jobject:
+			l := uintptr(arrArgs[j])
+			p := C.malloc(C.size_t(l + 1))
+			C.memcpy(p, arrArgs[j+1], C.size_t(l))
+			argsCopy[j], argsCopy[j+1] = arrArgs[j], p
+			mem = append(mem, p)
+			j += 2
+		default:
+			argsCopy[j] = arrArgs[j]
+			j += 1
+		}
+	}
+	ftCopy := C.CString(string(bft))
+	mem = append(mem, unsafe.Pointer(ftCopy))
+	return ftCopy, argsCopy, mem
+}
+
+/*
+ * a JS function argument is destroyed after go_asyncFuncBridge returns, so it can't be used
+ * by the goroutine.
+ */
+func hasEcmaFuncArg(ft *C.char) bool {
+	if ft == (*C.char)(C.NULL) {
+		return false
+	}
+	return bytes.IndexByte(toBytes(ft, int(C.strlen(ft))), C.af_ecmafunc) >= 0
+}
+
+func rejectAsync(completion unsafe.Pointer, msg string) {
+	var cs *C.char
+	var cl C.int
+	getStrPtrLen(&msg, &cs, &cl)
+	C.js_resolve_async(completion, C.rt_error, unsafe.Pointer(cs), C.size_t(cl))
+}
+
+//export go_asyncFuncBridge
+func go_asyncFuncBridge(udd unsafe.Pointer, ft *C.char, args *unsafe.Pointer, completion unsafe.Pointer) {
+	if hasEcmaFuncArg(ft) {
+		rejectAsync(completion, "JS function argument not supported by async function")
+		return
+	}
+	fn := *((*interface{})(udd))
+	fun := reflect.ValueOf(fn)
+	ftCopy, argsCopy, mem := copyNativeArgs(ft, args)
+
+	go func() {
+		defer func() {
+			for _, p := range mem {
+				C.free(p)
+			}
+		}()
+		var pArgs *unsafe.Pointer
+		if len(argsCopy) > 0 {
+			pArgs = &argsCopy[0]
+		}
+		var out_res unsafe.Pointer
+		var res_type C.int
+		var res_len C.size_t
+		var free_res C.fn_free_res
+		callGoFunc(fun, ftCopy, pArgs, &out_res, &res_type, &res_len, &free_res)
+		C.js_resolve_async(completion, C.res_type_t(res_type), out_res, res_len)
+	}()
+}
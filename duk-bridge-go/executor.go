@@ -0,0 +1,265 @@
+package duk_bridge
+/**
+ * binding of the executor of the C bridge: jobs are run by C threads each owning a JSEnv.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+extern void go_executorInit(void*, void*);
+extern void go_executorJob(void*, void*);
+*/
+import "C"
+
+import (
+	"unsafe"
+	"runtime/cgo"
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+)
+
+var ErrExecutorClosed = errors.New("Executor closed")
+var ErrNestedJob = errors.New("Executor job can't wait for another job of the executor")
+
+/**
+ * configuration of an Executor.
+ */
+type ExecutorConfig struct {
+	ModPath   string                  // the path with a subdir of `modules`, "" for the dir of the executive
+	Threads   int                     // count of threads and JSEnvs, count of CPUs if <= 0
+	QueueSize int                     // max count of jobs waiting, 16 times of Threads if <= 0
+	GoFuncs   map[string]interface{}  // funcName -> go function, registered in every env
+	FileFuncs map[string]string       // funcName -> script file, registered in every env
+}
+
+/**
+ * the utilization of a thread of Executor.
+ */
+type ExecutorWorkerStats struct {
+	Jobs        uint64        // count of jobs run
+	Stolen      uint64        // count of jobs stolen from other threads
+	Busy        time.Duration // time of running jobs
+	Up          time.Duration // time since the thread started
+	Queued      int           // count of jobs waiting in the queues of the thread
+	Utilization float64       // Busy/Up
+}
+
+/**
+ * an executor whose jobs are run in parallel by C threads, each of which owns a JSEnv.
+ * Jobs are queued to the threads round robin, and idle threads steal jobs from busy ones.
+ * Go module loaders are not added to the JSEnvs.
+ */
+type Executor struct {
+	exec    unsafe.Pointer
+	cfg     ExecutorConfig
+	envs    sync.Map // C env -> *executorEnv
+	initErr error
+	mu      sync.RWMutex // exec is not destroyed while a job is being submitted
+}
+
+type executorEnv struct {
+	ctx    *JSEnv
+	worker int
+}
+
+/**
+ * create an executor.
+ * @param cfg  the configuration of executor
+ */
+func NewExecutor(cfg *ExecutorConfig) (*Executor, error) {
+	e := &Executor{}
+	if cfg != nil {
+		e.cfg = *cfg
+	}
+	var p *C.char
+	if e.cfg.ModPath != "" {
+		p = C.CString(e.cfg.ModPath)
+		defer C.free(unsafe.Pointer(p))
+	}
+
+	h := cgo.NewHandle(e)
+	defer h.Delete()
+	e.exec = C.js_create_executor(p, C.int(e.cfg.Threads), C.int(e.cfg.QueueSize), (*[0]byte)(C.go_executorInit), unsafe.Pointer(&h)) // init is called before returning
+	if e.exec == nil {
+		return nil, fmt.Errorf("failed to create executor")
+	}
+	if e.initErr != nil {
+		e.Close()
+		return nil, e.initErr
+	}
+	return e, nil
+}
+
+// called in the C thread owning env
+//export go_executorInit
+func go_executorInit(udd unsafe.Pointer, env unsafe.Pointer) {
+	e := (*(*cgo.Handle)(udd)).Value().(*Executor)
+	ctx := &JSEnv{env, nil, make(map[string]*interface{})}
+	e.envs.Store(env, &executorEnv{ctx, int(C.js_executor_worker())})
+
+	var err error
+	for funcName, fn := range e.cfg.GoFuncs {
+		if err = ctx.RegisterGoFunc(funcName, fn); err != nil {
+			err = fmt.Errorf("failed to register go func %s: %v", funcName, err)
+			break
+		}
+	}
+	if err == nil {
+		for funcName, scriptFile := range e.cfg.FileFuncs {
+			if err = ctx.RegisterFileFunc(scriptFile, funcName); err != nil {
+				err = fmt.Errorf("failed to register %s in %s: %v", funcName, scriptFile, err)
+				break
+			}
+		}
+	}
+	if err != nil {
+		e.mu.Lock()
+		if e.initErr == nil {
+			e.initErr = err
+		}
+		e.mu.Unlock()
+	}
+}
+
+type executorJob struct {
+	e    *Executor
+	fn   func(*JSEnv)
+	done chan interface{} // nil or the value of panic
+}
+
+//export go_executorJob
+func go_executorJob(udd unsafe.Pointer, env unsafe.Pointer) {
+	job := (*(*cgo.Handle)(udd)).Value().(*executorJob)
+	ee, _ := job.e.envs.Load(env)
+	job.done <- runJob(ee.(*executorEnv).ctx, job.fn)
+}
+
+/**
+ * run fn with a JSEnv of the executor, which blocks while the queue is full.
+ * fn runs in a C thread, and the env must not be used after fn returns.
+ * a job must not wait for another job of the executor, which may never run while every thread
+ * is waiting, so it's refused if called by a job. it's not detected if called by a goroutine
+ * the job waits for, which must be avoided.
+ * @param fn  the function to use the env
+ * @return ErrExecutorClosed if the executor is closed, ErrNestedJob if called by a job of the executor.
+ */
+func (e *Executor) Do(fn func(*JSEnv)) error {
+	return e.DoOn(-1, fn)
+}
+
+/**
+ * run fn with the JSEnv of a thread, e.g. to use the state kept in the env by former jobs.
+ * like Do(), it's refused if called by a job of the executor.
+ * @param worker  index of the thread, from Worker(). -1 for any thread as Do()
+ * @param fn      the function to use the env
+ * @return ErrExecutorClosed if the executor is closed, ErrNestedJob if called by a job of the executor.
+ */
+func (e *Executor) DoOn(worker int, fn func(*JSEnv)) error {
+	e.mu.RLock()
+	exec := e.exec
+	if exec == nil {
+		e.mu.RUnlock()
+		return ErrExecutorClosed
+	}
+	// a job runs in the C thread of its worker.
+	if C.js_executor_worker_of(exec) >= 0 {
+		e.mu.RUnlock()
+		return ErrNestedJob
+	}
+
+	job := &executorJob{e, fn, make(chan interface{}, 1)}
+	h := cgo.NewHandle(job)
+	defer h.Delete()
+	// the handle is kept in C memory, because the job is queued after submitting.
+	ph := (*cgo.Handle)(C.malloc(C.size_t(unsafe.Sizeof(h))))
+	defer C.free(unsafe.Pointer(ph))
+	*ph = h
+	r := C.js_executor_submit_to(exec, C.int(worker), (*[0]byte)(C.go_executorJob), unsafe.Pointer(ph))
+	e.mu.RUnlock()
+	if r != 0 {
+		if r == -2 {
+			return fmt.Errorf("no worker %d", worker)
+		}
+		return ErrExecutorClosed
+	}
+	if panicVal := <-job.done; panicVal != nil {
+		panic(panicVal)
+	}
+	return nil
+}
+
+/**
+ * evaluate JS code with a JSEnv of the executor.
+ */
+func (e *Executor) Eval(jsCode string) (res interface{}, err error) {
+	if e2 := e.Do(func(ctx *JSEnv) { res, err = ctx.Eval(jsCode) }); e2 != nil {
+		return nil, e2
+	}
+	return
+}
+
+/**
+ * call a function registered by ExecutorConfig.FileFuncs with a JSEnv of the executor.
+ */
+func (e *Executor) CallFunc(funcName string, args ...interface{}) (res interface{}, err error) {
+	if e2 := e.Do(func(ctx *JSEnv) { res, err = ctx.CallFunc(funcName, args...) }); e2 != nil {
+		return nil, e2
+	}
+	return
+}
+
+/**
+ * get the index of the thread owning ctx, which is given to a job of the executor.
+ * @return -1 if ctx is not an env of the executor.
+ */
+func (e *Executor) Worker(ctx *JSEnv) int {
+	if ee, ok := e.envs.Load(ctx.env); ok {
+		return ee.(*executorEnv).worker
+	}
+	return -1
+}
+
+/**
+ * get the utilization of every thread of the executor.
+ */
+func (e *Executor) Stats() []ExecutorWorkerStats {
+	e.mu.RLock()
+	defer e.mu.RUnlock()
+	if e.exec == nil {
+		return nil
+	}
+	n := C.js_executor_stats(e.exec, nil, 0)
+	c_stats := make([]C.executor_stats_t, int(n))
+	C.js_executor_stats(e.exec, &c_stats[0], n)
+	stats := make([]ExecutorWorkerStats, len(c_stats))
+	for i, s := range c_stats {
+		stats[i] = ExecutorWorkerStats{
+			Jobs:   uint64(s.jobs),
+			Stolen: uint64(s.stolen),
+			Busy:   time.Duration(s.busy_us) * time.Microsecond,
+			Up:     time.Duration(s.up_us) * time.Microsecond,
+			Queued: int(s.queued),
+		}
+		if s.up_us > 0 {
+			stats[i].Utilization = float64(s.busy_us) / float64(s.up_us)
+		}
+	}
+	return stats
+}
+
+/**
+ * destroy the executor after the jobs in queue are run. it waits for the jobs being submitted by Do(),
+ * and later ones return ErrExecutorClosed.
+ */
+func (e *Executor) Close() {
+	e.mu.Lock()
+	exec := e.exec
+	e.exec = nil
+	e.mu.Unlock()
+	if exec != nil {
+		C.js_destroy_executor(exec)
+	}
+}
@@ -198,7 +198,7 @@ func parseArg(arg interface{}, argType *C.arg_format_t, val *uint64, p **C.char,
 		if v.Kind() == reflect.Ptr && v.Elem().Kind() == reflect.Struct {
 			*argType = C.af_mobject
 			*p = (*C.char)(unsafe.Pointer((*[0]byte)(C.go_createEcmascriptObject)))
-			modKey, _ := createMethodKeys(arg, v)
+			modKey := createModuleKey(arg, v)
 			*pLen = C.size_t(modKey)
 			break
 		}
@@ -289,6 +289,100 @@ func getFuncArgType(funType reflect.Type, argIndex int, funNargs int) reflect.Ty
 	return funType.In(argIndex)
 }
 
+/**
+ * convert an argument transfered from C to the value of argType.
+ * @param format   the format of the argument
+ * @param arrArgs  the argument list
+ * @param j        the index of the argument in arrArgs
+ * @param argType  the expected type
+ * @return the value and the index of the next argument in arrArgs
+ */
+func cArgToValue(format byte, arrArgs []unsafe.Pointer, j int, argType reflect.Type) (reflect.Value, int) {
+	var v reflect.Value
+	switch format {
+	case C.af_none:
+		v = reflect.Zero(argType)
+		j += 1
+	case C.af_bool:
+		v = reflect.ValueOf(int(uintptr(arrArgs[j])) != 0)
+		j += 1
+	case C.af_double:
+		p := uint64(uintptr(arrArgs[j]))
+		d := uint64_2double(p)
+		var n interface{}
+		switch argType.Kind() {
+		case reflect.Int8:
+			n = int8(d)
+		case reflect.Uint8:
+			n = uint8(d)
+		case reflect.Int16:
+			n = int16(d)
+		case reflect.Uint16:
+			n = uint16(d)
+		case reflect.Int32:
+			n = int32(d)
+		case reflect.Uint32:
+			n = uint32(d)
+		case reflect.Int:
+			n = int(d)
+		case reflect.Uint:
+			n = uint(d)
+		case reflect.Int64:
+			n = int64(d)
+		case reflect.Uint64:
+			n = uint64(d)
+		case reflect.Float32:
+			n = float32(d)
+		default:
+			n = d
+		}
+		v = reflect.ValueOf(n)
+		j += 1
+	case C.af_lstring:
+		l := int(uintptr(arrArgs[j]))
+		s := (*C.char)(arrArgs[j+1])
+		j += 2
+		switch argType.Kind() {
+		case reflect.Slice:
+			v = reflect.ValueOf(toBytes(s, l))
+		default:
+			v = reflect.ValueOf(*(toString(s, l)))
+		}
+	case C.af_buffer:
+		l := int(uintptr(arrArgs[j]))
+		s := (*C.char)(arrArgs[j+1])
+		j += 2
+		switch argType.Kind() {
+		case reflect.String:
+			v = reflect.ValueOf(*(toString(s, l)))
+		default:
+			v = reflect.ValueOf(toBytes(s, l))
+		}
+	case C.af_jobject, C.af_jarray:
+		l := int(uintptr(arrArgs[j]))
+		s := (*C.char)(arrArgs[j+1])
+		j += 2
+		switch argType.Kind() {
+		case reflect.String:
+			v = reflect.ValueOf(*(toString(s, l)))
+		case reflect.Slice:
+			v = reflect.ValueOf(toBytes(s, l))
+		default:
+			b := toBytes(s, l)
+			var o interface{}
+			if json.Unmarshal(b, &o) == nil {
+				v = reflect.ValueOf(o)
+			} else {
+				v = reflect.Zero(argType)
+			}
+		}
+	case C.af_ecmafunc:
+		v = reflect.ValueOf(wrapEcmaObject(arrArgs[j], true))
+		j += 1
+	}
+	return v, j
+}
+
 func callGoFunc(fun reflect.Value, ft *C.char, args *unsafe.Pointer, out_res *unsafe.Pointer, res_type *C.int, res_len *C.size_t, free_res *C.fn_free_res) {
 	funType := fun.Type()
 	funNargs := funType.NumIn()
@@ -327,87 +421,7 @@ func callGoFunc(fun reflect.Value, ft *C.char, args *unsafe.Pointer, out_res *un
 			j := 0
 			for i:=0; i<nargs; i++ {
 				funArgType := getFuncArgType(funType, i, funNargs)
-				switch bft[i] {
-				case C.af_none:
-					argv[i] = reflect.Zero(funArgType)
-					j += 1
-				case C.af_bool:
-					argv[i] = reflect.ValueOf(int(uintptr(arrArgs[j])) != 0)
-					j += 1
-				case C.af_double:
-					p := uint64(uintptr(arrArgs[j]))
-					d := uint64_2double(p)
-					var v interface{}
-					switch funArgType.Kind() {
-					case reflect.Int8:
-						v = int8(d)
-					case reflect.Uint8:
-						v = uint8(d)
-					case reflect.Int16:
-						v = int16(d)
-					case reflect.Uint16:
-						v = uint16(d)
-					case reflect.Int32:
-						v = int32(d)
-					case reflect.Uint32:
-						v = uint32(d)
-					case reflect.Int:
-						v = int(d)
-					case reflect.Uint:
-						v = uint(d)
-					case reflect.Int64:
-						v = int64(d)
-					case reflect.Uint64:
-						v = uint64(d)
-					case reflect.Float32:
-						v = float32(d)
-					default:
-						v = d
-					}
-					argv[i] = reflect.ValueOf(v)
-					j += 1
-				case C.af_lstring:
-					l := int(uintptr(arrArgs[j]))
-					s := (*C.char)(arrArgs[j+1])
-					j += 2
-					switch funArgType.Kind() {
-					case reflect.Slice:
-						argv[i] = reflect.ValueOf(toBytes(s, l))
-					default:
-						argv[i] = reflect.ValueOf(*(toString(s, l)))
-					}
-				case C.af_buffer:
-					l := int(uintptr(arrArgs[j]))
-					s := (*C.char)(arrArgs[j+1])
-					j += 2
-					switch funArgType.Kind() {
-					case reflect.String:
-						argv[i] = reflect.ValueOf(*(toString(s, l)))
-					default:
-						argv[i] = reflect.ValueOf(toBytes(s, l))
-					}
-				case C.af_jobject, C.af_jarray:
-					l := int(uintptr(arrArgs[j]))
-					s := (*C.char)(arrArgs[j+1])
-					j += 2
-					switch funArgType.Kind() {
-					case reflect.String:
-						argv[i] = reflect.ValueOf(*(toString(s, l)))
-					case reflect.Slice:
-						argv[i] = reflect.ValueOf(toBytes(s, l))
-					default:
-						b := toBytes(s, l)
-						var o interface{}
-						if json.Unmarshal(b, &o) == nil {
-							argv[i] = reflect.ValueOf(o)
-						} else {
-							argv[i] = reflect.Zero(funArgType)
-						}
-					}
-				case C.af_ecmafunc:
-					argv[i] = reflect.ValueOf(wrapEcmaObject(arrArgs[j], true))
-					j += 1
-				}
+				argv[i], j = cArgToValue(bft[i], arrArgs, j, funArgType)
 
 				if !argv[i].Type().ConvertibleTo(funArgType) {
 					*res_type = C.rt_none
@@ -483,7 +497,7 @@ func callGoFunc(fun reflect.Value, ft *C.char, args *unsafe.Pointer, out_res *un
 		if resV.Kind() == reflect.Ptr && resV.Elem().Kind() == reflect.Struct {
 			*res_type = C.rt_mobject
 			*out_res = unsafe.Pointer((*[0]byte)(C.go_createEcmascriptObject))
-			modKey, _ := createMethodKeys(res, resV)
+			modKey := createModuleKey(res, resV)
 			*res_len = C.size_t(modKey)
 			break
 		}
@@ -0,0 +1,73 @@
+package duk_bridge
+/**
+ * reloading of changed modules without recreating JSEnvs.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+*/
+import "C"
+
+import (
+	"unsafe"
+	"fmt"
+)
+
+/**
+ * a watcher of the changed .js files in `modPath`/modules. .so modules can't be reloaded.
+ */
+type ModuleWatcher struct {
+	watcher unsafe.Pointer
+}
+
+/**
+ * watch the changes of modules with inotify.
+ * @param modPath  the path with a subdir of `modules`, "" for the dir of the executive
+ */
+func WatchModules(modPath string) (*ModuleWatcher, error) {
+	var p *C.char
+	if modPath != "" {
+		p = C.CString(modPath)
+		defer C.free(unsafe.Pointer(p))
+	}
+	w := C.js_watch_modules(p)
+	if w == nil {
+		return nil, fmt.Errorf("failed to watch modules")
+	}
+	return &ModuleWatcher{w}, nil
+}
+
+/**
+ * stop watching. JSEnvs must not apply the changes of the watcher after it.
+ */
+func (w *ModuleWatcher) Close() {
+	if w.watcher != nil {
+		C.js_unwatch_modules(w.watcher)
+		w.watcher = nil
+	}
+}
+
+/**
+ * invalidate a required module, the next `require(id)` loads the latest file.
+ * a module in the mounted bundle is required instead of its file, and a .so module is kept
+ * loaded by dlopen(), so they are not invalidated.
+ * @param id  the resolved module id, e.g. "lib/a"
+ * @return true if the module was loaded, false if not loaded, in the bundle or a .so module
+ */
+func (ctx *JSEnv) InvalidateModule(id string) bool {
+	s := C.CString(id)
+	defer C.free(unsafe.Pointer(s))
+	return C.js_invalidate_module(ctx.env, s) == 0
+}
+
+/**
+ * invalidate the modules changed since the last calling. it is cheap if nothing changed,
+ * so it can be called before every use of the env. changes of the modules in the mounted
+ * bundle are ignored.
+ * @return count of the loaded modules invalidated
+ */
+func (ctx *JSEnv) ApplyModuleChanges(w *ModuleWatcher) int {
+	return int(C.js_apply_module_changes(ctx.env, w.watcher))
+}
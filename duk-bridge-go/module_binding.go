@@ -0,0 +1,369 @@
+package duk_bridge
+/**
+ * bindings of go struct types to JS modules, which are created once per type
+ * and shared by all the instances of the type.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+
+extern void go_modBridge(void*, char*, void**, void**, int*, size_t*, fn_free_res*);
+extern void go_attrGetter(void*, char*, void**, void**, int*, size_t*, fn_free_res*);
+extern void go_attrSetter(void*, char*, void**, void**, int*, size_t*, fn_free_res*);
+
+// the udd of a module method, refering to a method of a module instance.
+typedef struct {
+	long long mod_key;
+	int index;
+} go_method_ref_t;
+
+static module_method_t *alloc_mod_methods(int n) {
+	return (module_method_t*)calloc(n+1, sizeof(module_method_t));
+}
+// the udd of a method is owned by the JS function of the method, which may outlive the instance.
+static int set_method_ref(module_method_t *method, long long mod_key, int index) {
+	go_method_ref_t *ref = (go_method_ref_t*)malloc(sizeof(go_method_ref_t));
+	if (ref == NULL) {
+		return -1;
+	}
+	ref->mod_key = mod_key;
+	ref->index = index;
+	method->udd = ref;
+	method->free_udd = free;
+	return 0;
+}
+
+static module_accessor_t *alloc_mod_accessors(int n) {
+	return (module_accessor_t*)calloc(n, sizeof(module_accessor_t));
+}
+// the udd of an accessor is owned by its JS getter and setter.
+static int set_accessor_ref(module_accessor_t *accessor, long long mod_key, int index) {
+	go_method_ref_t *ref = (go_method_ref_t*)malloc(sizeof(go_method_ref_t));
+	if (ref == NULL) {
+		return -1;
+	}
+	ref->mod_key = mod_key;
+	ref->index = index;
+	accessor->udd = ref;
+	accessor->free_udd = free;
+	return 0;
+}
+static void add_mod_accessors(void *env, module_accessor_t *accessors, int n) {
+	int i;
+	for (i=0; i<n; i++) {
+		js_add_module_accessor(env, accessors+i);
+	}
+}
+*/
+import "C"
+
+import (
+	"unsafe"
+	"reflect"
+	"strings"
+	"sync"
+	"encoding/json"
+	"fmt"
+)
+
+/**
+ * embed LiveAttrs in a struct to bind its exported fields as live attributes:
+ * a field is converted only when it is read in JS, and an assignment in JS is
+ * written back to the field. So changes in both sides are visible to each other.
+ * Without LiveAttrs, fields are copied to JS once when the module/object is created.
+ *   type Test struct {
+ *      js.LiveAttrs
+ *      Name string
+ *   }
+ * Fields are writable only if the module/object is a pointer to struct.
+ */
+type LiveAttrs struct{}
+
+/**
+ * the attribute plan of an exported struct field.
+ */
+type goAttrBinding struct {
+	index int          // field index in struct
+	name  *C.char      // attribute name with the first letter in lowercase
+	kind  reflect.Kind // kind of the field
+	isBytes bool       // []byte or [N]byte
+}
+
+/**
+ * the binding of a struct type, methods and attributes are resolved once.
+ */
+type goTypeBinding struct {
+	nMethods    int
+	methodNames []*C.char // method names with the first letter in lowercase
+	methodNargs []C.int   // -1 for variadic method
+	attrs       []goAttrBinding
+	live        bool // LiveAttrs embedded
+}
+
+var (
+	typeBindings sync.Map // reflect.Type -> *goTypeBinding
+	liveAttrsType = reflect.TypeOf(LiveAttrs{})
+)
+
+// the names are never freed, because they are shared by all instances of the type.
+func lowerFirstCName(name string) *C.char {
+	return C.CString(strings.ToLower(name[:1]) + name[1:])
+}
+
+func getTypeBinding(structT reflect.Type) *goTypeBinding {
+	if b, ok := typeBindings.Load(structT); ok {
+		return b.(*goTypeBinding)
+	}
+
+	b := &goTypeBinding{}
+	b.nMethods = structT.NumMethod()
+	b.methodNames = make([]*C.char, b.nMethods)
+	b.methodNargs = make([]C.int, b.nMethods)
+	for i:=0; i<b.nMethods; i++ {
+		method := structT.Method(i)
+		b.methodNames[i] = lowerFirstCName(method.Name)
+		funType := method.Type // the receiver is the 1st argument
+		if funType.IsVariadic() {
+			b.methodNargs[i] = C.int(-1)
+		} else {
+			b.methodNargs[i] = C.int(funType.NumIn() - 1)
+		}
+	}
+
+	fieldsT := structT
+	if fieldsT.Kind() == reflect.Ptr {
+		fieldsT = fieldsT.Elem()
+	}
+	if fieldsT.Kind() == reflect.Struct {
+		nFields := fieldsT.NumField()
+		for i:=0; i<nFields; i++ {
+			fieldV := fieldsT.Field(i)
+			if fieldV.Anonymous && fieldV.Type == liveAttrsType {
+				b.live = true
+				continue
+			}
+			if fieldV.PkgPath != "" {
+				continue // not exported
+			}
+
+			kind := fieldV.Type.Kind()
+			switch kind {
+			case reflect.Bool,
+				reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64,
+				reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64,
+				reflect.Float32, reflect.Float64, reflect.String,
+				reflect.Slice, reflect.Array, reflect.Map:
+			default:
+				continue
+			}
+			isBytes := (kind == reflect.Slice || kind == reflect.Array) && fieldV.Type.Elem().Kind() == reflect.Uint8
+			b.attrs = append(b.attrs, goAttrBinding{i, lowerFirstCName(fieldV.Name), kind, isBytes})
+		}
+	}
+
+	actual, loaded := typeBindings.LoadOrStore(structT, b)
+	if loaded {
+		b.free()
+	}
+	return actual.(*goTypeBinding)
+}
+
+func (b *goTypeBinding) free() {
+	for _, name := range b.methodNames {
+		C.free(unsafe.Pointer(name))
+	}
+	for _, attr := range b.attrs {
+		C.free(unsafe.Pointer(attr.name))
+	}
+}
+
+/**
+ * create the module_method_t list of a module instance, with the udd of every
+ * method refering to (instance, method index). the list is freed by calling
+ * freeModuleMethods(), but the udd of a method is freed when its JS function
+ * is finalized, so a method detached from the instance is still safe to call.
+ */
+func (b *goTypeBinding) createModuleMethods(modKey int64) unsafe.Pointer {
+	n := b.nMethods
+	c_methods := C.alloc_mod_methods(C.int(n))
+	if c_methods == nil {
+		return nil
+	}
+	methods := unsafe.Slice(c_methods, n+1)
+	for i:=0; i<n; i++ {
+		if C.set_method_ref(&methods[i], C.longlong(modKey), C.int(i)) != 0 {
+			for j:=0; j<i; j++ {
+				C.free(methods[j].udd)
+			}
+			freeModuleMethods(unsafe.Pointer(c_methods))
+			return nil
+		}
+		methods[i].name = b.methodNames[i]
+		methods[i].method = (*[0]byte)(C.go_modBridge)
+		methods[i].nargs = b.methodNargs[i]
+	}
+	// methods[n] is zeroed by calloc
+	return unsafe.Pointer(c_methods)
+}
+
+// the udd of the methods are not freed, which are owned by their JS functions.
+func freeModuleMethods(methods unsafe.Pointer) {
+	C.free(methods)
+}
+
+/**
+ * create the module_accessor_t list of a module instance, with the udd of every
+ * accessor refering to (instance, attribute index). the list is freed by calling
+ * freeModuleAccessors(), the udd of an accessor is freed when its JS getter and
+ * setter are finalized, as methods do.
+ */
+func (b *goTypeBinding) createModuleAccessors(modKey int64) unsafe.Pointer {
+	n := len(b.attrs)
+	c_accessors := C.alloc_mod_accessors(C.int(n))
+	if c_accessors == nil {
+		return nil
+	}
+	accessors := unsafe.Slice(c_accessors, n)
+	for i:=0; i<n; i++ {
+		if C.set_accessor_ref(&accessors[i], C.longlong(modKey), C.int(i)) != 0 {
+			for j:=0; j<i; j++ {
+				C.free(accessors[j].udd)
+			}
+			freeModuleAccessors(unsafe.Pointer(c_accessors))
+			return nil
+		}
+		accessors[i].name = b.attrs[i].name
+		accessors[i].getter = (*[0]byte)(C.go_attrGetter)
+		accessors[i].setter = (*[0]byte)(C.go_attrSetter)
+	}
+	return unsafe.Pointer(c_accessors)
+}
+
+func (b *goTypeBinding) addModuleAccessors(env unsafe.Pointer, accessors unsafe.Pointer) {
+	C.add_mod_accessors(env, (*C.module_accessor_t)(accessors), C.int(len(b.attrs)))
+}
+
+// the udd of the accessors are not freed, which are owned by their JS getters and setters.
+func freeModuleAccessors(accessors unsafe.Pointer) {
+	C.free(accessors)
+}
+
+func getMethodRef(udd unsafe.Pointer) (modKey int64, index int) {
+	ref := (*C.go_method_ref_t)(udd)
+	return int64(ref.mod_key), int(ref.index)
+}
+
+func getAttrField(udd unsafe.Pointer) (reflect.Value, *goAttrBinding, bool) {
+	modKey, index := getMethodRef(udd)
+	modInfo := getModInfo(modKey)
+	if modInfo == nil {
+		return reflect.Value{}, nil, false
+	}
+	attr := &modInfo.binding.attrs[index]
+	return reflect.Indirect(modInfo.structP).Field(attr.index), attr, true
+}
+
+/*
+ * the getter of a live attribute, the field is converted as go_getAttrsList() does.
+ */
+//export go_attrGetter
+func go_attrGetter(udd unsafe.Pointer, ft *C.char, args *unsafe.Pointer, out_res *unsafe.Pointer, res_type *C.int, res_len *C.size_t, free_res *C.fn_free_res) {
+	*res_type = C.rt_none
+	*out_res = unsafe.Pointer(nil)
+	field, attr, ok := getAttrField(udd)
+	if !ok {
+		return
+	}
+
+	var c_attr C.module_attr_t
+	fillModuleAttr(&c_attr, field, attr)
+	switch c_attr.fmt {
+	case C.af_bool:
+		*res_type = C.rt_bool
+	case C.af_int:
+		*res_type = C.rt_int
+	case C.af_double:
+		*res_type = C.rt_double
+	case C.af_lstring:
+		*res_type = C.rt_string
+	case C.af_jarray:
+		*res_type = C.rt_array
+	case C.af_jobject:
+		*res_type = C.rt_object
+	default:
+		return
+	}
+	*out_res = c_attr.val
+	*res_len = c_attr.val_len
+}
+
+/*
+ * the setter of a live attribute, the value is converted to the type of the field.
+ */
+//export go_attrSetter
+func go_attrSetter(udd unsafe.Pointer, ft *C.char, args *unsafe.Pointer, out_res *unsafe.Pointer, res_type *C.int, res_len *C.size_t, free_res *C.fn_free_res) {
+	*res_type = C.rt_none
+	*out_res = unsafe.Pointer(nil)
+	field, attr, ok := getAttrField(udd)
+	if !ok || ft == (*C.char)(C.NULL) {
+		return
+	}
+	if !field.CanSet() {
+		setBuffer(fmt.Errorf("attribute %s is read only", C.GoString(attr.name)), out_res, res_type, res_len)
+		return
+	}
+
+	format := byte(*ft)
+	arrArgs := toPointerArray(args, 2)
+	fieldT := field.Type()
+	if (format == C.af_jobject || format == C.af_jarray) && attr.kind != reflect.String && !attr.isBytes {
+		b := toBytes((*C.char)(arrArgs[1]), int(uintptr(arrArgs[0])))
+		v := reflect.New(fieldT)
+		if err := json.Unmarshal(b, v.Interface()); err != nil {
+			setBuffer(err, out_res, res_type, res_len)
+			return
+		}
+		field.Set(v.Elem())
+		return
+	}
+
+	v, _ := cArgToValue(format, arrArgs, 0, fieldT)
+	if attr.kind == reflect.Array && attr.isBytes && v.IsValid() {
+		// converting bytes of another length to [N]byte panics.
+		var b []byte
+		switch v.Kind() {
+		case reflect.String:
+			b = []byte(v.String())
+		case reflect.Slice:
+			b = v.Bytes()
+		}
+		if b == nil || len(b) != field.Len() {
+			setBuffer(fmt.Errorf("cannot assign %d bytes to attribute %s of type %v", len(b), C.GoString(attr.name), fieldT), out_res, res_type, res_len)
+			return
+		}
+		reflect.Copy(field, reflect.ValueOf(b))
+		return
+	}
+	if !v.IsValid() || !v.Type().ConvertibleTo(fieldT) {
+		setBuffer(fmt.Errorf("cannot assign to attribute %s of type %v", C.GoString(attr.name), fieldT), out_res, res_type, res_len)
+		return
+	}
+	// strings and bytes from C are only valid in this callback.
+	switch attr.kind {
+	case reflect.String:
+		field.SetString(strings.Clone(v.Convert(fieldT).String()))
+	case reflect.Slice:
+		if attr.isBytes {
+			b := v.Bytes()
+			c := make([]byte, len(b))
+			copy(c, b)
+			field.SetBytes(c)
+			break
+		}
+		field.Set(v.Convert(fieldT))
+	default:
+		field.Set(v.Convert(fieldT))
+	}
+}
@@ -10,18 +10,16 @@ package duk_bridge
 #include <stdlib.h>
 #include <ctype.h>
 
-extern void go_modBridge(void*, char*, void**, void**, int*, size_t*, fn_free_res*);
-
 extern void* go_loadModule(void*,char*,char*);
 extern module_method_t* go_getMethodsList(void*, char*, void*);
 extern module_attr_t* go_getAttrsList(void*, char*, void*);
 extern void go_finalizeModule(void*, char*, void*);
-static int mod_method_size() {
-	return sizeof(module_method_t);
-}
 static int mod_attr_size() {
 	return sizeof(module_attr_t);
 }
+static void set_attr_int(module_attr_t *attr, long v) {
+	attr->val = (void*)v;
+}
 */
 import "C"
 
@@ -29,6 +27,7 @@ import (
 	"unsafe"
 	"fmt"
 	"reflect"
+	"sync"
 )
 
 type GoModuleLoader interface {
@@ -40,14 +39,14 @@ type GoModuleLoader interface {
 
 //export go_modBridge
 func go_modBridge(udd unsafe.Pointer, ft *C.char, args *unsafe.Pointer, out_res *unsafe.Pointer, res_type *C.int, res_len *C.size_t, free_res *C.fn_free_res) {
-	methodKey := int64(uintptr(udd))
-	fun, err := getMethodType(methodKey)
-	if err != nil {
+	modKey, index := getMethodRef(udd)
+	modInfo := getModInfo(modKey)
+	if modInfo == nil {
 		*res_type = C.rt_none
 		*out_res = unsafe.Pointer(uintptr(0))
 		return
 	}
-	callGoFunc(*fun, ft, args, out_res, res_type, res_len, free_res)
+	callGoFunc(modInfo.structP.Method(index), ft, args, out_res, res_type, res_len, free_res)
 }
 
 //export go_loadModule
@@ -78,7 +77,7 @@ func go_loadModule(udd unsafe.Pointer, modHome *C.char, modName *C.char) unsafe.
 		// structP = structP.Elem() // strucP is not pointer in such case
 	}
 
-	modKey, _ := createMethodKeys(structPtr, structP)
+	modKey := createModuleKey(structPtr, structP)
 	return unsafe.Pointer(uintptr(modKey))
 }
 
@@ -86,47 +85,110 @@ func go_loadModule(udd unsafe.Pointer, modHome *C.char, modName *C.char) unsafe.
 func go_getMethodsList(udd unsafe.Pointer, modName *C.char, modHandle unsafe.Pointer) *C.module_method_t {
 	modKey := int64(uintptr(modHandle))
 	modInfo := getModInfo(modKey)
-	if modInfo == nil {
+	if modInfo == nil || modInfo.binding.nMethods == 0 {
 		return (*C.module_method_t)(nil)
 	}
 
-	c_method := (*C.module_method_t)(C.malloc(C.size_t(int(C.mod_method_size()))))
-	if c_method == nil {
-		fmt.Printf("failed to allocate memory for module_method_t")
-		return (*C.module_method_t)(nil)
+	if modInfo.methods == nil {
+		modInfo.methods = modInfo.binding.createModuleMethods(modKey)
+		if modInfo.methods == nil {
+			fmt.Printf("failed to allocate memory for module_method_t")
+		}
 	}
-	defer C.free(unsafe.Pointer(c_method))
-
-	loaderKey := int64(uintptr(udd))
-	_, env, _ := getModuleLoader(loaderKey)
-	structT := modInfo.structP.Type()
-	methodKeys := modInfo.methodKeys
-	for i:=0; i<modInfo.nMethods; i++ {
-		methodF := modInfo.structP.Method(i)
-		funType := methodF.Type()
-		methodV := structT.Method(i)
+	// the list will be attached to the module by the caller.
+	return (*C.module_method_t)(modInfo.methods)
+}
 
-		c_method.name = C.CString(methodV.Name)
-		*(c_method.name) = C.char(C.tolower(C.int(*(c_method.name))))
-		defer C.free(unsafe.Pointer(c_method.name))
+/**
+ * convert the value of a struct field to a module attribute.
+ */
+func fillModuleAttr(c_attr *C.module_attr_t, field reflect.Value, attr *goAttrBinding) {
+	c_attr.name = attr.name
+	c_attr.val_len = 0
 
-		c_method.method = (*[0]byte)(C.go_modBridge)
-		if funType.IsVariadic() {
-			c_method.nargs = C.int(-1)
+	var cs *C.char
+	var l C.int
+	switch (attr.kind) {
+	case reflect.Bool:
+		c_attr.fmt = C.af_bool
+		if field.Bool() {
+			C.set_attr_int(c_attr, 1)
 		} else {
-			c_method.nargs = C.int(funType.NumIn())
+			C.set_attr_int(c_attr, 0)
+		}
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32:
+		c_attr.fmt = C.af_int
+		C.set_attr_int(c_attr, C.long(field.Int()))
+	case reflect.Int64:
+		c_attr.fmt = C.af_double
+		c_attr.val = C.double2voidp(C.double(field.Int()))
+	case reflect.Uint8, reflect.Uint16:
+		c_attr.fmt = C.af_int
+		C.set_attr_int(c_attr, C.long(field.Uint()))
+	case reflect.Uint, reflect.Uint32, reflect.Uint64:
+		c_attr.fmt = C.af_double
+		c_attr.val = C.double2voidp(C.double(field.Uint()))
+	case reflect.Float32, reflect.Float64:
+		c_attr.fmt = C.af_double
+		c_attr.val = C.double2voidp(C.double(field.Float()))
+	case reflect.String:
+		c_attr.fmt = C.af_lstring
+		s := field.String()
+		getStrPtrLen(&s, &cs, &l)
+		c_attr.val = unsafe.Pointer(cs)
+		c_attr.val_len = C.size_t(l)
+	case reflect.Slice, reflect.Array:
+		if attr.kind == reflect.Slice && field.IsNil() {
+			c_attr.fmt = C.af_none
+			break
+		}
+		if attr.isBytes {
+			c_attr.fmt = C.af_lstring
+			var s []byte
+			if attr.kind == reflect.Slice {
+				s = field.Bytes()
+			} else {
+				s = field.Slice(0, field.Len()).Bytes()
+			}
+			getBytesPtrLen(s, &cs, &l)
+		} else {
+			c_attr.fmt = C.af_jarray
+			argToJson(field.Interface(), &cs, &l)
+		}
+		c_attr.val = unsafe.Pointer(cs)
+		c_attr.val_len = C.size_t(l)
+	case reflect.Map:
+		if field.IsNil() {
+			c_attr.fmt = C.af_none
+		} else {
+			c_attr.fmt = C.af_jobject
+			argToJson(field.Interface(), &cs, &l)
+			c_attr.val = unsafe.Pointer(cs)
+			c_attr.val_len = C.size_t(l)
 		}
-		c_method.udd = unsafe.Pointer(uintptr(methodKeys[i]))
-		C.js_add_module_method(env, c_method)
 	}
-	return (*C.module_method_t)(nil)
 }
 
 //export go_getAttrsList
 func go_getAttrsList(udd unsafe.Pointer, modName *C.char, modHandle unsafe.Pointer) *C.module_attr_t {
 	modKey := int64(uintptr(modHandle))
 	modInfo := getModInfo(modKey)
-	if modInfo == nil {
+	if modInfo == nil || len(modInfo.binding.attrs) == 0 {
+		return (*C.module_attr_t)(nil)
+	}
+
+	loaderKey := int64(uintptr(udd))
+	_, env, _ := getModuleLoader(loaderKey)
+	if modInfo.binding.live {
+		// values are converted only when they are touched in JS.
+		if modInfo.accessors == nil {
+			modInfo.accessors = modInfo.binding.createModuleAccessors(modKey)
+			if modInfo.accessors == nil {
+				fmt.Printf("failed to allocate memory for module_accessor_t")
+				return (*C.module_attr_t)(nil)
+			}
+		}
+		modInfo.binding.addModuleAccessors(env, modInfo.accessors)
 		return (*C.module_attr_t)(nil)
 	}
 
@@ -137,88 +199,10 @@ func go_getAttrsList(udd unsafe.Pointer, modName *C.char, modHandle unsafe.Point
 	}
 	defer C.free(unsafe.Pointer(c_attr))
 
-	loaderKey := int64(uintptr(udd))
-	_, env, _ := getModuleLoader(loaderKey)
-	structP := modInfo.structP.Elem()
-	nFields := structP.NumField()
-	structT := structP.Type()
-	for i:=0; i<nFields; i++ {
-		field := structP.Field(i)
-		fieldV := structT.Field(i)
-
-		firstLetter := fieldV.Name[0]
-		if firstLetter == '_' || (firstLetter >= 'a' && firstLetter <= 'z') {
-			continue
-		}
-
-		c_attr.name = C.CString(fieldV.Name)
-		*(c_attr.name) = C.char(C.tolower(C.int(*(c_attr.name))))
-		defer C.free(unsafe.Pointer(c_attr.name))
-
-		var cs *C.char
-		var l C.int
-		switch (field.Kind()) {
-		case reflect.Bool:
-			c_attr.fmt = C.af_bool
-			if field.Bool() {
-				c_attr.val = unsafe.Pointer(uintptr(1))
-			} else {
-				c_attr.val = unsafe.Pointer(uintptr(0))
-			}
-		case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32:
-			c_attr.fmt = C.af_int
-			c_attr.val = unsafe.Pointer(uintptr(field.Int()))
-		case reflect.Int64:
-			c_attr.fmt = C.af_double
-			c_attr.val = C.double2voidp(C.double(field.Int()))
-		case reflect.Uint8, reflect.Uint16:
-			c_attr.fmt = C.af_int
-			c_attr.val = unsafe.Pointer(uintptr(field.Uint()))
-		case reflect.Uint, reflect.Uint32, reflect.Uint64:
-			c_attr.fmt = C.af_double
-			c_attr.val = C.double2voidp(C.double(field.Uint()))
-		case reflect.Float32, reflect.Float64:
-			c_attr.fmt = C.af_double
-			c_attr.val = C.double2voidp(C.double(field.Float()))
-		case reflect.String:
-			c_attr.fmt = C.af_lstring
-			s := field.String()
-			getStrPtrLen(&s, &cs, &l)
-			c_attr.val = unsafe.Pointer(cs)
-			c_attr.val_len = C.size_t(l)
-		case reflect.Slice:
-			if field.IsNil() {
-				c_attr.fmt = C.af_none
-				break
-			}
-			fallthrough
-		case reflect.Array:
-			c_attr.fmt = C.af_jarray
-			t := field.Type()
-			if t.Elem().Kind() == reflect.Uint8 {
-				c_attr.fmt = C.af_lstring
-				s := field.Bytes()
-				getBytesPtrLen(s, &cs, &l)
-				c_attr.val = unsafe.Pointer(cs)
-				c_attr.val_len = C.size_t(l)
-			} else {
-				argToJson(field.Interface(), &cs, &l)
-				c_attr.val = unsafe.Pointer(cs)
-				c_attr.val_len = C.size_t(l)
-			}
-		case reflect.Map:
-			if field.IsNil() {
-				c_attr.fmt = C.af_none
-			} else {
-				c_attr.fmt = C.af_jobject
-				argToJson(field.Interface(), &cs, &l)
-				c_attr.val = unsafe.Pointer(cs)
-				c_attr.val_len = C.size_t(l)
-			}
-		default:
-			continue
-		}
-
+	structP := reflect.Indirect(modInfo.structP)
+	for i := range modInfo.binding.attrs {
+		attr := &modInfo.binding.attrs[i]
+		fillModuleAttr(c_attr, structP.Field(attr.index), attr)
 		C.js_add_module_attr(env, c_attr)
 	}
 	return (*C.module_attr_t)(nil)
@@ -240,15 +224,35 @@ func go_finalizeModule(udd unsafe.Pointer, modName *C.char, modHandle unsafe.Poi
 
 var (
 	_firstLoaderKey = make(map[unsafe.Pointer]int64)
+	_firstLoaderKeyLock sync.RWMutex
 )
 
+func getFirstLoaderKey(env unsafe.Pointer) (int64, bool) {
+	_firstLoaderKeyLock.RLock()
+	defer _firstLoaderKeyLock.RUnlock()
+	loaderKey, ok := _firstLoaderKey[env]
+	return loaderKey, ok
+}
+
+func setFirstLoaderKey(env unsafe.Pointer, loaderKey int64) {
+	_firstLoaderKeyLock.Lock()
+	_firstLoaderKey[env] = loaderKey
+	_firstLoaderKeyLock.Unlock()
+}
+
+func removeFirstLoaderKey(env unsafe.Pointer) {
+	_firstLoaderKeyLock.Lock()
+	delete(_firstLoaderKey, env)
+	_firstLoaderKeyLock.Unlock()
+}
+
 func (ctx *JSEnv) addGoModuleLoader(loader GoModuleLoader) {
 	if loader == nil {
 		return
 	}
 	loaderKey := saveModuleLoader(loader, ctx.env)
 	if len(ctx.loaderKey) == 0 {
-		_firstLoaderKey[ctx.env] = loaderKey
+		setFirstLoaderKey(ctx.env, loaderKey)
 	}
 	ctx.loaderKey = append(ctx.loaderKey, loaderKey)
 
@@ -262,7 +266,7 @@ func (ctx *JSEnv) addGoModuleLoader(loader GoModuleLoader) {
 
 //export go_createEcmascriptObject
 func go_createEcmascriptObject(env unsafe.Pointer, udd unsafe.Pointer) C.int {
-	loaderKey, ok := _firstLoaderKey[env]
+	loaderKey, ok := getFirstLoaderKey(env)
 	if !ok {
 		return C.int(-1)
 	}
@@ -16,8 +16,9 @@ import (
 type goModuleInfo struct {
 	structPtr interface{}
 	structP reflect.Value
-	nMethods int
-	methodKeys []int64
+	binding *goTypeBinding
+	methods unsafe.Pointer // module_method_t list in C, created when the instance is bound
+	accessors unsafe.Pointer // module_accessor_t list in C, created when the instance of a LiveAttrs type is bound
 }
 
 type moduleLoaderEnv struct {
@@ -30,8 +31,16 @@ var (
 )
 
 func init() {
+	// keyGenerator is only called in the goroutine of V2KPool, keys are kept
+	// increasing even if 2 keys are generated in the same nanosecond.
+	var lastKey int64
 	keyGenerator := func(interface{}) (interface{}, error) {
-		return time.Now().UnixNano(), nil
+		key := time.Now().UnixNano()
+		if key <= lastKey {
+			key = lastKey + 1
+		}
+		lastKey = key
+		return key, nil
 	}
 	methodKeyGenerator = NewV2KPool(keyGenerator, false)
 }
@@ -66,32 +75,14 @@ func getModInfo(modKey int64) *goModuleInfo {
 	}
 }
 
-func createMethodKeys(structPtr interface{}, structP reflect.Value) (int64, []int64) {
-	var methodKeys []int64
-
-	nMethods := structP.NumMethod()
-	if nMethods > 0 {
-		methodKeys = make([]int64, nMethods)
-		for i:=0; i<nMethods; i++ {
-			methodF := structP.Method(i)
-			methodKey, _ := methodKeyGenerator.V2K(&methodF)
-			methodKeys[i] = methodKey.(int64)
-		}
-	}
-
-	goModule := &goModuleInfo{structPtr, structP, nMethods, methodKeys}
+/**
+ * save a module instance and return the key of it. The methods and attributes of
+ * the instance type are resolved only once.
+ */
+func createModuleKey(structPtr interface{}, structP reflect.Value) int64 {
+	goModule := &goModuleInfo{structPtr, structP, getTypeBinding(structP.Type()), nil, nil}
 	modKey, _ := methodKeyGenerator.V2K(goModule)
-	return modKey.(int64), methodKeys
-}
-
-func getMethodType(methodKey int64) (*reflect.Value, error) {
-	v := methodKeyGenerator.GetVal(methodKey)
-	switch v.(type) {
-	case *reflect.Value:
-		return v.(*reflect.Value), nil
-	default:
-		return nil, fmt.Errorf("no such methodKey: %v", methodKey)
-	}
+	return modKey.(int64)
 }
 
 func removeModule(modKey int64) {
@@ -106,7 +97,12 @@ func removeModule(modKey int64) {
 	modInfo := v.(*goModuleInfo)
 	methodKeyGenerator.RemoveKey(modKey)
 
-	for i:=0; i<modInfo.nMethods; i++ {
-		methodKeyGenerator.RemoveKey(modInfo.methodKeys[i])
+	if modInfo.methods != nil {
+		freeModuleMethods(modInfo.methods)
+		modInfo.methods = nil
+	}
+	if modInfo.accessors != nil {
+		freeModuleAccessors(modInfo.accessors)
+		modInfo.accessors = nil
 	}
 }
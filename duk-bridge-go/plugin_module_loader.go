@@ -8,12 +8,45 @@ package duk_bridge
 import (
 	"plugin"
 	"fmt"
+	"sync"
 )
 
 type GoPluginModuleLoader struct{}
 
 const _ext = ".so"
 
+type newGoModuleFunc = func()interface{}
+
+var (
+	// Go plugins can't be closed, so NewGoModule of a plugin is looked up once
+	// and shared by all the loaders in the process.
+	pluginInits = make(map[string]newGoModuleFunc)
+	pluginInitsLock sync.Mutex
+)
+
+func lookupPluginInit(modPath string) newGoModuleFunc {
+	pluginInitsLock.Lock()
+	defer pluginInitsLock.Unlock()
+	if initFunc, ok := pluginInits[modPath]; ok {
+		return initFunc
+	}
+
+	plug, err := plugin.Open(modPath)
+	if err != nil {
+		return nil
+	}
+	sym, err := plug.Lookup("NewGoModule")
+	if err != nil {
+		return nil
+	}
+	initFunc, ok := sym.(newGoModuleFunc)
+	if !ok {
+		return nil
+	}
+	pluginInits[modPath] = initFunc
+	return initFunc
+}
+
 func (loader *GoPluginModuleLoader) SetJSEnv(_ *JSEnv) () {}
 
 func (loader *GoPluginModuleLoader) GetExtName() string {
@@ -23,16 +56,11 @@ func (loader *GoPluginModuleLoader) GetExtName() string {
 func (loader *GoPluginModuleLoader) LoadModule(modHome string, modName string) interface{} {
 	// fmt.Printf("GoPluginModuleLoader::LoadModule(%s) called\n", modName)
 	modPath := fmt.Sprintf("%s/%s%s", modHome, modName, _ext)
-	plug, err := plugin.Open(modPath)
-	if err != nil {
-		return nil
-	}
-
-	initFunc, err := plug.Lookup("NewGoModule")
-	if err != nil {
+	initFunc := lookupPluginInit(modPath)
+	if initFunc == nil {
 		return nil
 	}
-	structP := initFunc.(func()interface{})()
+	structP := initFunc()
 	return structP
 }
 
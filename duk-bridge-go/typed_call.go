@@ -0,0 +1,303 @@
+package duk_bridge
+/**
+ * typed wrappers of Eval()/CallFunc()/CallEcmascriptFunc(), results are
+ * decoded straight into the type given by the caller.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+extern void go_typedResultReceived(void*, int, void*, size_t);
+*/
+import "C"
+
+import (
+	"unsafe"
+	"reflect"
+	"runtime/cgo"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"sync"
+)
+
+// the receiver of a typed result, which is held by a cgo.Handle during calling.
+type typedReceiver interface {
+	received(res_type C.int, res unsafe.Pointer, res_len C.size_t)
+}
+
+type typedResult[T any] struct {
+	val T
+	err error
+}
+
+/**
+ * the decoding plan of a result type. plans are created once per reflect.Type.
+ */
+type typedPlan struct {
+	t        reflect.Type
+	kind     reflect.Kind
+	isBytes  bool // []byte
+	isJson   bool // struct, map, slice, array or pointer, which is decoded from JSON directly
+	isEcmaObj bool // *EcmaObject
+}
+
+var (
+	typedPlans sync.Map // reflect.Type -> *typedPlan
+	ecmaObjectType = reflect.TypeOf((*EcmaObject)(nil))
+)
+
+func getTypedPlan(t reflect.Type) *typedPlan {
+	if p, ok := typedPlans.Load(t); ok {
+		return p.(*typedPlan)
+	}
+
+	p := &typedPlan{t: t, kind: t.Kind()}
+	switch p.kind {
+	case reflect.Slice:
+		if t.Elem().Kind() == reflect.Uint8 {
+			p.isBytes = true
+		} else {
+			p.isJson = true
+		}
+	case reflect.Ptr:
+		if t == ecmaObjectType {
+			p.isEcmaObj = true
+		} else {
+			p.isJson = true
+		}
+	case reflect.Struct, reflect.Map, reflect.Array:
+		p.isJson = true
+	}
+	actual, _ := typedPlans.LoadOrStore(t, p)
+	return actual.(*typedPlan)
+}
+
+func resTypeName(res_type C.int) string {
+	switch res_type {
+	case C.rt_bool:
+		return "boolean"
+	case C.rt_int, C.rt_double:
+		return "number"
+	case C.rt_string:
+		return "string"
+	case C.rt_buffer:
+		return "buffer"
+	case C.rt_object:
+		return "object"
+	case C.rt_array:
+		return "array"
+	case C.rt_func:
+		return "function"
+	default:
+		return "unknown"
+	}
+}
+
+func resToDouble(res_type C.int, res unsafe.Pointer) float64 {
+	if res_type == C.rt_int {
+		return float64(int(uintptr(res)))
+	}
+	return float64(C.voidp2double(res))
+}
+
+func (p *typedPlan) mismatch(res_type C.int) error {
+	return fmt.Errorf("cannot decode js %s into %v", resTypeName(res_type), p.t)
+}
+
+// decode the result to dst, which must be addressable and of type p.t
+func (p *typedPlan) decode(dst reflect.Value, res_type C.int, res unsafe.Pointer, res_len C.size_t) error {
+	switch res_type {
+	case C.rt_none:
+		dst.Set(reflect.Zero(p.t))
+		return nil
+	case C.rt_bool:
+		if p.kind != reflect.Bool {
+			return p.mismatch(res_type)
+		}
+		dst.SetBool(uintptr(res) != 0)
+		return nil
+	case C.rt_int, C.rt_double:
+		d := resToDouble(res_type, res)
+		switch p.kind {
+		case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+			dst.SetInt(int64(d))
+		case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+			dst.SetUint(uint64(d))
+		case reflect.Float32, reflect.Float64:
+			dst.SetFloat(d)
+		default:
+			return p.mismatch(res_type)
+		}
+		return nil
+	case C.rt_func:
+		if !p.isEcmaObj {
+			return p.mismatch(res_type)
+		}
+		dst.Set(reflect.ValueOf(wrapEcmaObject(res, true)))
+		return nil
+	}
+
+	// rt_string, rt_buffer, rt_object, rt_array
+	b := toBytes((*C.char)(res), int(res_len)) // valid only in this callback
+	switch {
+	case p.kind == reflect.String:
+		dst.SetString(string(b))
+	case p.isBytes:
+		c := make([]byte, len(b))
+		copy(c, b)
+		dst.SetBytes(c)
+	case p.isJson && (res_type == C.rt_object || res_type == C.rt_array):
+		return json.Unmarshal(b, dst.Addr().Interface())
+	default:
+		return p.mismatch(res_type)
+	}
+	return nil
+}
+
+func (r *typedResult[T]) received(res_type C.int, res unsafe.Pointer, res_len C.size_t) {
+	if res_type == C.rt_error {
+		b := toBytes((*C.char)(res), int(res_len))
+		r.err = errors.New(string(b))
+		return
+	}
+
+	// fast paths without reflection
+	switch p := any(&r.val).(type) {
+	case *interface{}:
+		go_resultReceived(unsafe.Pointer(p), res_type, res, res_len)
+		if err, ok := (*p).(error); ok {
+			*p = nil
+			r.err = err
+		}
+		return
+	case *float64:
+		if res_type == C.rt_double || res_type == C.rt_int {
+			*p = resToDouble(res_type, res)
+			return
+		}
+	case *int:
+		if res_type == C.rt_double || res_type == C.rt_int {
+			*p = int(resToDouble(res_type, res))
+			return
+		}
+	case *int64:
+		if res_type == C.rt_double || res_type == C.rt_int {
+			*p = int64(resToDouble(res_type, res))
+			return
+		}
+	case *bool:
+		if res_type == C.rt_bool {
+			*p = uintptr(res) != 0
+			return
+		}
+	case *string:
+		switch res_type {
+		case C.rt_string, C.rt_buffer, C.rt_object, C.rt_array:
+			*p = string(toBytes((*C.char)(res), int(res_len)))
+			return
+		}
+	}
+
+	plan := getTypedPlan(reflect.TypeOf(&r.val).Elem())
+	r.err = plan.decode(reflect.ValueOf(&r.val).Elem(), res_type, res, res_len)
+}
+
+func (r *typedResult[T]) result(ret C.int) (T, error) {
+	if r.err != nil {
+		var zero T
+		return zero, r.err
+	}
+	if ret != C.int(0) {
+		var zero T
+		return zero, fromErrorCode(ret)
+	}
+	return r.val, nil
+}
+
+/*
+ * a bridge callback like go_resultReceived(), but the result is decoded to the type
+ * of the receiver held by the handle which udd points to.
+ */
+//export go_typedResultReceived
+func go_typedResultReceived(udd unsafe.Pointer, res_type C.int, res unsafe.Pointer, res_len C.size_t) {
+	h := *(*cgo.Handle)(udd)
+	h.Value().(typedReceiver).received(res_type, res, res_len)
+}
+
+/**
+ * evaluate any lines of JS codes, the result will be decoded to type T.
+ * @param ctx     the JS environment
+ * @param jsCode  JS syntax satisfied codes.
+ * @return the result in type T
+ */
+func EvalAs[T any](ctx *JSEnv, jsCode string) (T, error) {
+	var s *C.char
+	var l C.int
+	getStrPtrLen(&jsCode, &s, &l)
+
+	r := &typedResult[T]{}
+	h := cgo.NewHandle(r)
+	defer h.Delete()
+	ret := C.js_eval(ctx.env, s, C.size_t(l), (*[0]byte)(C.go_typedResultReceived), unsafe.Pointer(&h))
+	return r.result(ret)
+}
+
+/**
+ * call a JS function registered by JSEnv::RegisterFileFunc()/RegisterCodeFunc(),
+ * the result will be decoded to type T.
+ * @param ctx       the JS environment
+ * @param funcName  the registered function name
+ * @param args      any count of array of anything
+ * @return the result in type T
+ */
+func CallAs[T any](ctx *JSEnv, funcName string, args ...interface{}) (T, error) {
+	fn := C.CString(funcName)
+	defer C.free(unsafe.Pointer(fn))
+
+	r := &typedResult[T]{}
+	h := cgo.NewHandle(r)
+	defer h.Delete()
+
+	var ret C.int
+	if args == nil {
+		ret = C.js_call_registered_func(ctx.env, fn, (*[0]byte)(C.go_typedResultReceived), unsafe.Pointer(&h), (*C.char)(C.NULL), (*unsafe.Pointer)(unsafe.Pointer(nil)))
+	} else {
+		_, fmt, argv := parseArgs(args)
+
+		var f *C.char
+		getBytesPtr(fmt, &f)  // f -> fmt
+		var a *unsafe.Pointer
+		getArgsPtr(argv, &a)  // a -> argv
+		ret = C.js_call_registered_func(ctx.env, fn, (*[0]byte)(C.go_typedResultReceived), unsafe.Pointer(&h), f, a)
+	}
+	return r.result(ret)
+}
+
+/**
+ * call an ecmascript function, the result will be decoded to type T.
+ * @param ctx       the JS environment
+ * @param ecmaFunc  the ecmascript function transfered from JS
+ * @param args      any count of array of anything
+ * @return the result in type T
+ */
+func CallEcmascriptAs[T any](ctx *JSEnv, ecmaFunc *EcmaObject, args ...interface{}) (T, error) {
+	r := &typedResult[T]{}
+	h := cgo.NewHandle(r)
+	defer h.Delete()
+
+	var ret C.int
+	if args == nil {
+		ret = C.js_call_ecmascript_func(ctx.env, ecmaFunc.ecmaObj, (*[0]byte)(C.go_typedResultReceived), unsafe.Pointer(&h), (*C.char)(C.NULL), (*unsafe.Pointer)(unsafe.Pointer(nil)))
+	} else {
+		_, fmt, argv := parseArgs(args)
+
+		var f *C.char
+		getBytesPtr(fmt, &f)  // f -> fmt
+		var a *unsafe.Pointer
+		getArgsPtr(argv, &a)  // a -> argv
+		ret = C.js_call_ecmascript_func(ctx.env, ecmaFunc.ecmaObj, (*[0]byte)(C.go_typedResultReceived), unsafe.Pointer(&h), f, a)
+	}
+	return r.result(ret)
+}
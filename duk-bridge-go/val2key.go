@@ -5,7 +5,9 @@
  */
 package duk_bridge
 
-// import "fmt"
+import (
+	"sync"
+)
 
 const (
 	removeV = 0
@@ -29,6 +31,7 @@ type V2KPool struct {
 	od         chan opWithData   // internal usage
 	res        chan interface{}
 	valHashable bool
+	mu         sync.Mutex        // pairs a request in od with its response in res
 }
 
 func NewV2KPool(val2key Val2KeyFunc, valHashable bool) *V2KPool {
@@ -38,6 +41,7 @@ func NewV2KPool(val2key Val2KeyFunc, valHashable bool) *V2KPool {
 		make(chan opWithData),
 		make(chan interface{}),
 		valHashable,
+		sync.Mutex{},
 	}
 	go p.bgLoop()
 	return p
@@ -116,8 +120,10 @@ func (p *V2KPool) bgLoop() {
 }
 
 func (p *V2KPool) V2K(val interface{}) (interface{}, error) {
+	p.mu.Lock()
 	p.od <- opWithData{v2k, val}
 	res := <-p.res
+	p.mu.Unlock()
 	switch res.(type) {
 	case error:
 		return nil, res.(error)
@@ -126,8 +132,11 @@ func (p *V2KPool) V2K(val interface{}) (interface{}, error) {
 }
 
 func (p *V2KPool) GetVal(key interface{}) interface{} {
+	p.mu.Lock()
 	p.od <- opWithData{k2v, key}
-	return <-p.res
+	res := <-p.res
+	p.mu.Unlock()
+	return res
 }
 
 func (p *V2KPool) RemoveKey(key interface{}) {
@@ -0,0 +1,85 @@
+package duk_bridge
+/**
+ * warming of the modules required by a script, which are compiled in background
+ * to the code cache shared by all the JSEnvs.
+ * Rosbit Xu <me@rosbit.cn>
+ */
+
+/*
+#include "duk_bridge.h"
+#include <stdlib.h>
+extern void go_warmReport(void*, char*, char*, int, long, long);
+*/
+import "C"
+
+import (
+	"unsafe"
+	"runtime/cgo"
+	"time"
+	"fmt"
+)
+
+/**
+ * the result of warming a module.
+ */
+type ModuleWarmResult struct {
+	Id          string
+	File        string
+	Status      int // 0 if warmed, -1 if the file is not found, -2 if it has syntax error
+	ReadTime    time.Duration
+	CompileTime time.Duration
+}
+
+type ModuleWarmer struct {
+	warm unsafe.Pointer
+}
+
+/**
+ * start warming the modules required by entryScript in background. modules required by
+ * `require('...')` literals are found recursively, read and compiled by a pool of threads,
+ * so `require()` in JSEnvs needn't compile them. JSEnvs created by NewEnv() use the modules
+ * beside the executive, which is the modPath "".
+ * @param modPath      the path with a subdir of `modules`, "" for the dir of the executive
+ * @param entryScript  the script file to find the required modules
+ * @param threads      count of threads, <=0 for the default count
+ */
+func WarmModules(modPath string, entryScript string, threads int) (*ModuleWarmer, error) {
+	var p *C.char
+	if modPath != "" {
+		p = C.CString(modPath)
+		defer C.free(unsafe.Pointer(p))
+	}
+	e := C.CString(entryScript)
+	defer C.free(unsafe.Pointer(e))
+
+	warm := C.js_warm_modules(p, e, C.int(threads))
+	if warm == nil {
+		return nil, fmt.Errorf("failed to warm modules of %s", entryScript)
+	}
+	return &ModuleWarmer{warm}, nil
+}
+
+/**
+ * wait for the warming to finish, it can be called only once.
+ * @return the results of all the modules found
+ */
+func (w *ModuleWarmer) Wait() []ModuleWarmResult {
+	var res []ModuleWarmResult
+	h := cgo.NewHandle(&res)
+	defer h.Delete()
+	C.js_warm_modules_wait(w.warm, (*[0]byte)(C.go_warmReport), unsafe.Pointer(&h))
+	w.warm = nil
+	return res
+}
+
+//export go_warmReport
+func go_warmReport(udd unsafe.Pointer, modId *C.char, modFile *C.char, status C.int, readUs C.long, compileUs C.long) {
+	res := (*(*cgo.Handle)(udd)).Value().(*[]ModuleWarmResult)
+	*res = append(*res, ModuleWarmResult{
+		Id: C.GoString(modId),
+		File: C.GoString(modFile),
+		Status: int(status),
+		ReadTime: time.Duration(readUs) * time.Microsecond,
+		CompileTime: time.Duration(compileUs) * time.Microsecond,
+	})
+}
@@ -1,6 +1,11 @@
-public class DukBridge
+import java.nio.ByteBuffer;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
+
+public class DukBridge implements AutoCloseable
 {
 	private long env;
+	// calls hold the read lock, so close() waits for the calls in flight
+	private final ReentrantReadWriteLock lifecycle = new ReentrantReadWriteLock();
 
 	public DukBridge(String modPath, NativeModuleLoader modLoader) throws Exception {
 		long env = jsCreateEnv(modPath);
@@ -17,75 +22,337 @@ public class DukBridge
 		this.env = env;
 	}
 
+	/**
+	 * destroy the JS env after the calls in flight return, the native memory is freed at once.
+	 * the DukBridge must not be used after it is closed, an IllegalStateException is thrown then.
+	 * @throws IllegalStateException if called during a call of the DukBridge, e.g. by a Java function called by JS.
+	 */
+	public void close() {
+		if (lifecycle.getReadHoldCount() > 0) {
+			throw new IllegalStateException("DukBridge can't be closed during a call");
+		}
+		lifecycle.writeLock().lock();
+		try {
+			if (this.env != 0L) {
+				jsDestroyEnv(this.env);
+				this.env = 0L;
+			}
+		} finally {
+			lifecycle.writeLock().unlock();
+		}
+	}
+
+	// the last resort if close() is not called
 	protected void finalize() {
-		jsDestroyEnv(this.env);
+		close();
+	}
+
+	// the env for a call, which is not closed until release() is called
+	private long acquire() {
+		lifecycle.readLock().lock();
+		if (this.env == 0L) {
+			lifecycle.readLock().unlock();
+			throw new IllegalStateException("DukBridge closed");
+		}
+		return this.env;
+	}
+
+	private void release() {
+		lifecycle.readLock().unlock();
+	}
+
+	/**
+	 * get the memory stats of the Duktape heap, which can be called by any thread.
+	 */
+	public HeapStats heapStats() {
+		lifecycle.readLock().lock();
+		try {
+			if (this.env == 0L) {
+				return new HeapStats(0L, 0L, 0L);
+			}
+			long[] s = jsGetHeapStats(this.env);
+			return new HeapStats(s[0], s[1], s[2]);
+		} finally {
+			lifecycle.readLock().unlock();
+		}
 	}
 
 	public void setFileReader(FileReader fr) {
-		jsSetFileReader(this.env, fr);
+		long env = acquire();
+		try {
+			jsSetFileReader(env, fr);
+		} finally {
+			release();
+		}
 	}
 
 	public Object eval(String jsCode) {
+		long env = acquire();
 		try {
 			byte[] b = jsCode.getBytes("utf-8");
-			return jsEval(this.env, b);
+			return jsEval(env, b);
 		} catch (Exception e) {
 			return null;
+		} finally {
+			release();
 		}
 	}
 
 	public Object evalBytes(byte[] jsCode) {
-		return jsEval(this.env, jsCode);
+		long env = acquire();
+		try {
+			return jsEval(env, jsCode);
+		} finally {
+			release();
+		}
+	}
+
+	// the code in the direct ByteBuffer, from position to limit, is run without copying
+	public Object eval(ByteBuffer jsCode) {
+		long env = acquire();
+		try {
+			J2CHelper.checkDirect(jsCode);
+			return jsEvalBuffer(env, jsCode.slice());
+		} finally {
+			release();
+		}
 	}
 
 	public Object evalFile(String scriptFile) {
-		return jsEvalFile(this.env, scriptFile);
+		long env = acquire();
+		try {
+			return jsEvalFile(env, scriptFile);
+		} finally {
+			release();
+		}
 	}
 
 	public boolean registerFileFunc(String scriptFile, String funcName) {
-		int res = jsRegisterFileFunc(this.env, scriptFile, funcName);
-		return (res == 0);
+		long env = acquire();
+		try {
+			int res = jsRegisterFileFunc(env, scriptFile, funcName);
+			return (res == 0);
+		} finally {
+			release();
+		}
 	}
 
 	public boolean registerCodeFunc(String jsCode, String funcName) {
-		int res = jsRegisterCodeFunc(this.env, jsCode, funcName);
-		return (res == 0);
+		long env = acquire();
+		try {
+			int res = jsRegisterCodeFunc(env, jsCode, funcName);
+			return (res == 0);
+		} finally {
+			release();
+		}
 	}
 
 	public void unregisterFunc(String funcName) {
-		jsUnregisterFunc(this.env, funcName);
+		long env = acquire();
+		try {
+			jsUnregisterFunc(env, funcName);
+		} finally {
+			release();
+		}
 	}
 
 	public Object callFunc(String funcName, Object ...args) throws Exception {
-		NormalizedArgs nargs = J2CHelper.normalizeArgs(args);
-		return jsCallFunc(this.env, funcName, nargs.fmt, nargs.args);
+		long env = acquire();
+		try {
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return jsCallFunc(env, funcName, nargs.fmt, nargs.marshalled());
+		} finally {
+			release();
+		}
 	}
 
 	public Object callFileFunc(String scriptFile, Object ...args) throws Exception {
-		NormalizedArgs nargs = J2CHelper.normalizeArgs(args);
-		return jsCallFileFunc(this.env, scriptFile, nargs.fmt, nargs.args);
+		long env = acquire();
+		try {
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return jsCallFileFunc(env, scriptFile, nargs.fmt, nargs.marshalled());
+		} finally {
+			release();
+		}
+	}
+
+	/**
+	 * call a registered function, a string, buffer, array or object result is written to
+	 * the direct ByteBuffer out without creating a byte[]. direct ByteBuffer arguments are
+	 * passed to JS without copying, with callFunc() too.
+	 * @return out with position 0 and limit set to the result length, null if no result.
+	 * @throws BufferOverflowException if out is too small to hold the result
+	 */
+	public ByteBuffer callFunc(ByteBuffer out, String funcName, Object ...args) throws Exception {
+		long env = acquire();
+		try {
+			J2CHelper.checkDirect(out);
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return J2CHelper.bufferResult(out, jsCallFuncBuffer(env, funcName, nargs.fmt, nargs.marshalled(), out));
+		} finally {
+			release();
+		}
+	}
+
+	public ByteBuffer callFileFunc(ByteBuffer out, String scriptFile, Object ...args) throws Exception {
+		long env = acquire();
+		try {
+			J2CHelper.checkDirect(out);
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return J2CHelper.bufferResult(out, jsCallFileFuncBuffer(env, scriptFile, nargs.fmt, nargs.marshalled(), out));
+		} finally {
+			release();
+		}
+	}
+
+	/**
+	 * call a registered function returning a number or boolean, the result is not boxed.
+	 * a JS error or a result of other type is thrown as an Exception.
+	 * the *N variants pass all the arguments as numbers without boxing, they are named apart
+	 * because primitive arguments would be ambiguous between double... and Object...
+	 */
+	public double callFuncDouble(String funcName, Object ...args) throws Exception {
+		long env = acquire();
+		try {
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return jsCallFuncDouble(env, funcName, nargs.fmt, nargs.marshalled());
+		} finally {
+			release();
+		}
+	}
+
+	public double callFuncDoubleN(String funcName, double ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncDouble(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public double callFuncDoubleN(String funcName, int ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncDouble(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public long callFuncLong(String funcName, Object ...args) throws Exception {
+		long env = acquire();
+		try {
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return jsCallFuncLong(env, funcName, nargs.fmt, nargs.marshalled());
+		} finally {
+			release();
+		}
+	}
+
+	public long callFuncLongN(String funcName, double ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncLong(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public long callFuncLongN(String funcName, int ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncLong(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public boolean callFuncBoolean(String funcName, Object ...args) throws Exception {
+		long env = acquire();
+		try {
+			NormalizedArgs nargs = J2CHelper.packArgs(args);
+			return jsCallFuncBoolean(env, funcName, nargs.fmt, nargs.marshalled());
+		} finally {
+			release();
+		}
+	}
+
+	public boolean callFuncBooleanN(String funcName, double ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncBoolean(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public boolean callFuncBooleanN(String funcName, int ...args) throws Exception {
+		long env = acquire();
+		try {
+			return jsCallFuncBoolean(env, funcName, null, args);
+		} finally {
+			release();
+		}
+	}
+
+	public double evalDouble(String jsCode) throws Exception {
+		long env = acquire();
+		try {
+			return jsEvalDouble(env, jsCode.getBytes("utf-8"));
+		} finally {
+			release();
+		}
 	}
 
 	public boolean registerJavaFunc(String funcName, NativeFunc nativeFunc) {
-		int ret = jsRegisterJavaFunc(this.env, funcName, nativeFunc);
-		return (ret == 0);
+		long env = acquire();
+		try {
+			int ret = jsRegisterJavaFunc(env, funcName, nativeFunc);
+			return (ret == 0);
+		} finally {
+			release();
+		}
+	}
+
+	// all the arguments are passed as double without boxing
+	public boolean registerJavaNumberFunc(String funcName, NativeNumberFunc nativeFunc) {
+		long env = acquire();
+		try {
+			int ret = jsRegisterJavaFunc(env, funcName, nativeFunc);
+			return (ret == 0);
+		} finally {
+			release();
+		}
 	}
 
 	public void unregisterJavaFunc(String funcName) {
-		jsUnregisterJavaFunc(this.env, funcName);
+		long env = acquire();
+		try {
+			jsUnregisterJavaFunc(env, funcName);
+		} finally {
+			release();
+		}
 	}
 
 	private native long jsCreateEnv(String modPath);
 	private native void jsDestroyEnv(long env);
+	private native long[] jsGetHeapStats(long env);
 	private native void jsSetFileReader(long env, FileReader fr);
 	private native Object jsEval(long env, byte[] jsCode);
 	private native Object jsEvalFile(long env, String scriptFile);
 	private native int jsRegisterFileFunc(long env, String scriptFile, String funcName);
 	private native int jsRegisterCodeFunc(long env, String jsCode, String funcName);
 	private native void jsUnregisterFunc(long env, String funcName);
-	private native Object jsCallFunc(long env, String funcName, String fmt, Object[] args);
-	private native Object jsCallFileFunc(long env, String scriptFile, String fmt, Object[] args);
-	private native int jsRegisterJavaFunc(long env, String funcName, NativeFunc nativeFunc);
+	private native Object jsCallFunc(long env, String funcName, String fmt, Object args);
+	private native Object jsCallFileFunc(long env, String scriptFile, String fmt, Object args);
+	private native double jsCallFuncDouble(long env, String funcName, String fmt, Object args);
+	private native long jsCallFuncLong(long env, String funcName, String fmt, Object args);
+	private native boolean jsCallFuncBoolean(long env, String funcName, String fmt, Object args);
+	private native double jsEvalDouble(long env, byte[] jsCode);
+	private native Object jsEvalBuffer(long env, ByteBuffer jsCode);
+	private native int jsCallFuncBuffer(long env, String funcName, String fmt, Object args, ByteBuffer out);
+	private native int jsCallFileFuncBuffer(long env, String scriptFile, String fmt, Object args, ByteBuffer out);
+	private native int jsRegisterJavaFunc(long env, String funcName, Object nativeFunc);
 	private native void jsUnregisterJavaFunc(long env, String funcName);
 	private native int jsAddModuleLoader(long env, NativeModuleLoader modLoader);
 
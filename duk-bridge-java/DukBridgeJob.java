@@ -0,0 +1,7 @@
+/**
+ * a job run with a DukBridge of DukBridgePool.
+ */
+public interface DukBridgeJob<T>
+{
+	public T run(DukBridge js) throws Exception;
+}
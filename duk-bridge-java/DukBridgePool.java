@@ -0,0 +1,190 @@
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.SynchronousQueue;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.function.Consumer;
+
+/**
+ * a pool of DukBridge. Every DukBridge is created, warmed up, used and closed by
+ * a worker thread owning it, so it is never used by more than one thread.
+ */
+public class DukBridgePool implements AutoCloseable
+{
+	private static final Consumer<DukBridge> QUIT = js -> {};
+
+	private final SynchronousQueue<Consumer<DukBridge>> jobs = new SynchronousQueue<Consumer<DukBridge>>();
+	private final DukBridge[] envs;
+	private final Thread[] workers;
+	private final long maxWaitMillis;
+	private volatile boolean closed = false;
+
+	private final AtomicInteger busy = new AtomicInteger();
+	private final AtomicLong calls = new AtomicLong();
+	private final AtomicLong timeouts = new AtomicLong();
+
+	/**
+	 * create a pool of DukBridge.
+	 * @param size           count of envs
+	 * @param modPath        the module path of every env
+	 * @param modLoader      the module loader of every env, null if none
+	 * @param init           run once with every env to register functions and warm it up, null if none
+	 * @param maxWaitMillis  the max time call() waits for a free env, 0 to wait forever
+	 */
+	public DukBridgePool(int size, String modPath, NativeModuleLoader modLoader, DukBridgeJob<?> init, long maxWaitMillis) throws Exception {
+		if (size <= 0) {
+			size = Runtime.getRuntime().availableProcessors();
+		}
+		this.envs = new DukBridge[size];
+		this.workers = new Thread[size];
+		this.maxWaitMillis = maxWaitMillis;
+
+		CountDownLatch started = new CountDownLatch(size);
+		Exception[] initErrs = new Exception[size];
+		for (int i=0; i<size; i++) {
+			final int index = i;
+			workers[i] = new Thread(() -> work(index, modPath, modLoader, init, started, initErrs), "dukbridge-pool-" + i);
+			workers[i].setDaemon(true);
+			workers[i].start();
+		}
+		started.await();
+
+		for (Exception e : initErrs) {
+			if (e != null) {
+				close();
+				throw e;
+			}
+		}
+	}
+
+	// the loop of a worker thread owning envs[index]
+	private void work(int index, String modPath, NativeModuleLoader modLoader, DukBridgeJob<?> init, CountDownLatch started, Exception[] initErrs) {
+		DukBridge js = null;
+		try {
+			js = new DukBridge(modPath, modLoader);
+			if (init != null) {
+				init.run(js);
+			}
+		} catch (Exception e) {
+			initErrs[index] = e;
+			if (js != null) {
+				js.close();
+			}
+			started.countDown();
+			return;
+		}
+		synchronized (this) {
+			envs[index] = js;
+		}
+		started.countDown();
+
+		try {
+			while (true) {
+				Consumer<DukBridge> job = jobs.take();
+				if (job == QUIT) {
+					break;
+				}
+				job.accept(js);
+			}
+		} catch (InterruptedException e) {
+			// quit
+		} finally {
+			synchronized (this) {
+				envs[index] = null;
+				js.close();
+			}
+		}
+	}
+
+	/**
+	 * run job with a free env in the pool, the env must not be used after job returns.
+	 * @return the result of job
+	 * @throws TimeoutException if no env is free in maxWaitMillis.
+	 * @throws IllegalStateException if the pool is closed.
+	 */
+	public <T> T call(DukBridgeJob<T> job) throws Exception {
+		if (closed) {
+			throw new IllegalStateException("DukBridgePool closed");
+		}
+
+		CompletableFuture<T> res = new CompletableFuture<T>();
+		Consumer<DukBridge> task = js -> {
+			busy.incrementAndGet();
+			try {
+				res.complete(job.run(js));
+			} catch (Throwable e) {
+				res.completeExceptionally(e);
+			} finally {
+				busy.decrementAndGet();
+				calls.incrementAndGet();
+			}
+		};
+
+		if (maxWaitMillis <= 0) {
+			while (!jobs.offer(task, 100, TimeUnit.MILLISECONDS)) {
+				if (closed) {
+					throw new IllegalStateException("DukBridgePool closed");
+				}
+			}
+		} else if (!jobs.offer(task, maxWaitMillis, TimeUnit.MILLISECONDS)) {
+			timeouts.incrementAndGet();
+			throw new TimeoutException("timeout to wait for a free DukBridge");
+		}
+
+		try {
+			return res.get();
+		} catch (ExecutionException e) {
+			Throwable cause = e.getCause();
+			if (cause instanceof Exception) {
+				throw (Exception)cause;
+			}
+			throw (Error)cause;
+		}
+	}
+
+	/**
+	 * get the metrics of the pool, with the heap stats of all envs.
+	 */
+	public synchronized DukBridgePoolStats stats() {
+		DukBridgePoolStats s = new DukBridgePoolStats();
+		s.size = envs.length;
+		s.busy = busy.get();
+		s.calls = calls.get();
+		s.timeouts = timeouts.get();
+		for (DukBridge js : envs) {
+			if (js != null) {
+				HeapStats h = js.heapStats();
+				s.heapBytes += h.heapBytes;
+				s.peakBytes += h.peakBytes;
+			}
+		}
+		return s;
+	}
+
+	/**
+	 * close all the envs in the pool. running jobs are waited to finish.
+	 */
+	public void close() throws InterruptedException {
+		int alive = 0;
+		synchronized (this) {
+			if (closed) {
+				return;
+			}
+			closed = true;
+			for (DukBridge js : envs) {
+				if (js != null) {
+					alive++;
+				}
+			}
+		}
+		for (int i=0; i<alive; i++) {
+			jobs.put(QUIT); // taken by a worker after its running job
+		}
+		for (Thread w : workers) {
+			w.join();
+		}
+	}
+}
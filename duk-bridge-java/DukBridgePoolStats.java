@@ -0,0 +1,17 @@
+/**
+ * metrics of a DukBridgePool.
+ */
+public class DukBridgePoolStats
+{
+	public int size;         // count of envs
+	public int busy;         // count of envs running a job
+	public long calls;       // count of jobs run by call()
+	public long timeouts;    // count of call() failed to wait for a free env
+	public long heapBytes;   // sum of the bytes allocated by the heaps of envs
+	public long peakBytes;   // sum of the peak bytes of the heaps of envs
+
+	public String toString() {
+		return "DukBridgePoolStats{size=" + size + ", busy=" + busy + ", calls=" + calls + ", timeouts=" + timeouts +
+			", heapBytes=" + heapBytes + ", peakBytes=" + peakBytes + "}";
+	}
+}
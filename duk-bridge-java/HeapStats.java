@@ -0,0 +1,19 @@
+/**
+ * memory stats of the Duktape heap of a DukBridge.
+ */
+public class HeapStats
+{
+	final public long heapBytes;  // bytes allocated by the heap now
+	final public long peakBytes;  // max of heapBytes
+	final public long allocCount; // count of allocations, including reallocations
+
+	public HeapStats(long heapBytes, long peakBytes, long allocCount) {
+		this.heapBytes = heapBytes;
+		this.peakBytes = peakBytes;
+		this.allocCount = allocCount;
+	}
+
+	public String toString() {
+		return "HeapStats{heapBytes=" + heapBytes + ", peakBytes=" + peakBytes + ", allocCount=" + allocCount + "}";
+	}
+}
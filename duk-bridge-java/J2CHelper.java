@@ -1,11 +1,30 @@
+import java.lang.reflect.Method;
+import java.lang.reflect.Modifier;
+import java.nio.BufferOverflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.HashSet;
+
 class NormalizedArgs {
 	String fmt;
 	Object[] args;
+	byte[] packed; // all the args packed by J2CHelper.packArgs(), null if not packed
 
 	NormalizedArgs(String fmt, Object[] args) {
 		this.fmt = fmt;
 		this.args = args;
 	}
+
+	NormalizedArgs(String fmt, byte[] packed) {
+		this.fmt = fmt;
+		this.packed = packed;
+	}
+
+	// the args given to native methods
+	Object marshalled() {
+		return (packed != null) ? packed : args;
+	}
 }
 
 class J2CHelper
@@ -18,6 +37,7 @@ class J2CHelper
 	final private static char af_buffer  = 'B';
 	final private static char af_jarray  = 'a';
 	final private static char af_jobject = 'o';
+	final private static char af_xbuffer = 'X';
 
 	public static NormalizedArgs normalizeArgs(Object ...args) throws Exception {
 		if (args == null) {
@@ -40,6 +60,18 @@ class J2CHelper
 			} else if (obj instanceof byte[]) {
 				fmt.append(af_lstring);
 				res[i] = obj;
+			} else if (obj instanceof ByteBuffer) {
+				ByteBuffer buf = (ByteBuffer)obj;
+				if (buf.isDirect()) {
+					// the remaining bytes are used by JS without copying
+					fmt.append(af_xbuffer);
+					res[i] = buf.slice();
+				} else {
+					fmt.append(af_buffer);
+					byte[] b = new byte[buf.remaining()];
+					buf.duplicate().get(b);
+					res[i] = b;
+				}
 			} else if (obj instanceof Integer) {
 				fmt.append(af_int);
 				res[i] = obj;
@@ -75,4 +107,167 @@ class J2CHelper
 
 		return new NormalizedArgs(fmt.toString(), res);
 	}
+
+	/**
+	 * pack all the args in one byte[], so they are passed to native code with a constant count
+	 * of JNI calls. values are in the native byte order:
+	 *   'b'/'i' -> int32, 'd' -> float64, 'S'/'B'/'a'/'o' -> int32 length and bytes, 'n' -> nothing.
+	 * ByteBuffer args can't be packed, normalizeArgs() is used then.
+	 */
+	public static NormalizedArgs packArgs(Object ...args) throws Exception {
+		if (args == null || args.length == 0) {
+			return new NormalizedArgs("", new byte[0]);
+		}
+
+		char[] fmt = new char[args.length];
+		byte[][] bytes = new byte[args.length][];
+		int size = 0;
+		for (int i=0; i<args.length; i++) {
+			Object obj = args[i];
+			if (obj == null) {
+				fmt[i] = af_none;
+			} else if (obj instanceof String) {
+				fmt[i] = af_lstring;
+				bytes[i] = ((String)obj).getBytes("utf-8");
+			} else if (obj instanceof byte[]) {
+				fmt[i] = af_lstring;
+				bytes[i] = (byte[])obj;
+			} else if (obj instanceof Integer) {
+				fmt[i] = af_int;
+				size += 4;
+			} else if (obj instanceof Boolean) {
+				fmt[i] = af_bool;
+				size += 4;
+			} else if (obj instanceof Double) {
+				fmt[i] = af_double;
+				size += 8;
+			} else if (obj instanceof ObjArg) {
+				ObjArg objarg = (ObjArg)obj;
+				switch (objarg.type) {
+				case ObjArg.af_string:
+					fmt[i] = af_lstring;
+					break;
+				case ObjArg.af_buffer:
+					fmt[i] = af_buffer;
+					break;
+				case ObjArg.af_jarray:
+					fmt[i] = af_jarray;
+					break;
+				case ObjArg.af_jobject:
+					fmt[i] = af_jobject;
+					break;
+				default:
+					throw new Exception("unknown arg type " + objarg.type);
+				}
+				bytes[i] = objarg.arg;
+			} else if (obj instanceof ByteBuffer) {
+				return normalizeArgs(args);
+			} else {
+				throw new Exception("your object type is not supported");
+			}
+			if (bytes[i] != null) {
+				size += 4 + bytes[i].length;
+			}
+		}
+
+		byte[] packed = new byte[size];
+		ByteBuffer b = ByteBuffer.wrap(packed).order(ByteOrder.nativeOrder());
+		for (int i=0; i<args.length; i++) {
+			switch (fmt[i]) {
+			case af_none:
+				break;
+			case af_int:
+				b.putInt((Integer)args[i]);
+				break;
+			case af_bool:
+				b.putInt((Boolean)args[i] ? 1 : 0);
+				break;
+			case af_double:
+				b.putDouble((Double)args[i]);
+				break;
+			default:
+				b.putInt(bytes[i].length);
+				b.put(bytes[i]);
+				break;
+			}
+		}
+		return new NormalizedArgs(new String(fmt), packed);
+	}
+
+	/**
+	 * make the result of a native call writing to a direct ByteBuffer.
+	 * @param n  the bytes count written to out, -1 if no result, -2 if the result is not bytes.
+	 * @return out with position 0 and limit n, or null if no result.
+	 */
+	public static ByteBuffer bufferResult(ByteBuffer out, int n) throws Exception {
+		if (n == -1) {
+			return null;
+		}
+		if (n == -2) {
+			throw new Exception("the result is not a string, buffer, array or object");
+		}
+		if (n > out.capacity()) {
+			throw new BufferOverflowException();
+		}
+		out.clear();
+		out.limit(n);
+		return out;
+	}
+
+	public static void checkDirect(ByteBuffer buf) {
+		if (buf == null || !buf.isDirect()) {
+			throw new IllegalArgumentException("a direct ByteBuffer is required");
+		}
+	}
+
+	private static String jniSignature(Class<?> c) {
+		if (c.isArray()) {
+			return c.getName().replace('.', '/');
+		}
+		if (c == void.class)    return "V";
+		if (c == boolean.class) return "Z";
+		if (c == byte.class)    return "B";
+		if (c == char.class)    return "C";
+		if (c == short.class)   return "S";
+		if (c == int.class)     return "I";
+		if (c == long.class)    return "J";
+		if (c == float.class)   return "F";
+		if (c == double.class)  return "D";
+		return "L" + c.getName().replace('.', '/') + ";";
+	}
+
+	private static boolean isModuleArgType(Class<?> c) {
+		return c.isPrimitive() || c == String.class || c == byte[].class || c == Object.class;
+	}
+
+	/**
+	 * the public static methods of a module class which can be called by JS.
+	 * called only once per class by the native module loader.
+	 * @return names and JNI signatures in pairs
+	 */
+	public static String[] moduleMethods(Class<?> cls) {
+		ArrayList<String> res = new ArrayList<String>();
+		HashSet<String> names = new HashSet<String>();
+		for (Method m : cls.getMethods()) {
+			if (!Modifier.isStatic(m.getModifiers())) {
+				continue;
+			}
+			StringBuilder sig = new StringBuilder("(");
+			boolean ok = true;
+			for (Class<?> p : m.getParameterTypes()) {
+				if (!isModuleArgType(p)) {
+					ok = false;
+					break;
+				}
+				sig.append(jniSignature(p));
+			}
+			if (!ok || !names.add(m.getName())) {
+				continue; // unsupported argument type or overloaded
+			}
+			sig.append(')').append(jniSignature(m.getReturnType()));
+			res.add(m.getName());
+			res.add(sig.toString());
+		}
+		return res.toArray(new String[res.size()]);
+	}
 }
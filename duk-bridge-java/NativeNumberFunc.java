@@ -0,0 +1,4 @@
+public interface NativeNumberFunc
+{
+	double calledByJs(double[] args);
+}
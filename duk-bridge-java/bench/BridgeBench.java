@@ -0,0 +1,129 @@
+import org.openjdk.jmh.annotations.*;
+import java.io.File;
+import java.io.FileOutputStream;
+import java.util.Arrays;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * per-call overhead of the Java binding across payload sizes:
+ * eval, callFunc with every ObjArg type, file funcs and JS calling Java.
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class BridgeBench {
+	@Param({"16", "1024", "65536"})
+	public int size;
+
+	private DukBridge js;
+	private File scriptFile;
+	private String str;
+	private String evalCode;
+	private ObjArg strArg;
+	private ObjArg bufArg;
+	private ObjArg arrArg;
+	private ObjArg objArg;
+
+	private static ObjArg objArg(char type, String arg) throws Exception {
+		ObjArg a = new ObjArg();
+		a.type = type;
+		a.arg = arg.getBytes("utf-8");
+		return a;
+	}
+
+	@Setup
+	public void setup() throws Exception {
+		char[] c = new char[size];
+		Arrays.fill(c, 'x');
+		str = new String(c);
+		evalCode = "'" + str + "'.length";
+
+		// about size bytes in JSON
+		int n = Math.max(1, size / 2);
+		StringBuilder arr = new StringBuilder("[");
+		for (int i=0; i<n; i++) {
+			arr.append(i == 0 ? "1" : ",1");
+		}
+		arr.append(']');
+
+		strArg = objArg(ObjArg.af_string, str);
+		bufArg = objArg(ObjArg.af_buffer, str);
+		arrArg = objArg(ObjArg.af_jarray, arr.toString());
+		objArg = objArg(ObjArg.af_jobject, "{\"s\":\"" + str + "\"}");
+
+		js = new DukBridge(".", null);
+		js.registerCodeFunc("function len(a) { return a.length; }", "len");
+		js.registerCodeFunc("function objLen(o) { return o.s.length; }", "objLen");
+		js.registerCodeFunc("function echo(a) { return a; }", "echo");
+		js.registerJavaFunc("javaEcho", args -> args[0]);
+		js.registerCodeFunc("function callJava(s) { return javaEcho(s).length; }", "callJava");
+
+		scriptFile = File.createTempFile("bridge-bench", ".js");
+		scriptFile.deleteOnExit();
+		try (FileOutputStream out = new FileOutputStream(scriptFile)) {
+			out.write("function fileLen(a) { return a.length; }".getBytes("utf-8"));
+		}
+		js.registerFileFunc(scriptFile.getPath(), "fileLen");
+	}
+
+	@TearDown
+	public void tearDown() {
+		js.close();
+	}
+
+	@Benchmark
+	public Object eval() {
+		return js.eval(evalCode);
+	}
+
+	@Benchmark
+	public Object callString() throws Exception {
+		return js.callFunc("len", str);
+	}
+
+	@Benchmark
+	public Object callObjArgString() throws Exception {
+		return js.callFunc("len", strArg);
+	}
+
+	@Benchmark
+	public Object callObjArgBuffer() throws Exception {
+		return js.callFunc("len", bufArg);
+	}
+
+	@Benchmark
+	public Object callObjArgArray() throws Exception {
+		return js.callFunc("len", arrArg);
+	}
+
+	@Benchmark
+	public Object callObjArgObject() throws Exception {
+		return js.callFunc("objLen", objArg);
+	}
+
+	// the string result is converted to byte[]
+	@Benchmark
+	public Object callEchoResult() throws Exception {
+		return js.callFunc("echo", str);
+	}
+
+	// the file is loaded and compiled for every call
+	@Benchmark
+	public Object callFileFunc() throws Exception {
+		return js.callFileFunc(scriptFile.getPath(), str);
+	}
+
+	@Benchmark
+	public Object callRegisteredFileFunc() throws Exception {
+		return js.callFunc("fileLen", str);
+	}
+
+	// JS calls a java function with the payload, which is returned to JS.
+	@Benchmark
+	public Object callJava() throws Exception {
+		return js.callFunc("callJava", str);
+	}
+}
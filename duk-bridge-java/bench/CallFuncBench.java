@@ -0,0 +1,44 @@
+import org.openjdk.jmh.annotations.*;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * throughput of calling a JS scoring function returning one number,
+ * with boxed and unboxed arguments and results.
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class CallFuncBench {
+	private DukBridge js;
+	private double x = 0.5;
+	private double y = 2.0;
+
+	@Setup
+	public void setup() throws Exception {
+		js = new DukBridge(".", null);
+		js.registerCodeFunc("function score(x, y) { return x * 0.3 + y * 0.7; }", "score");
+	}
+
+	@TearDown
+	public void tearDown() {
+		js.close();
+	}
+
+	@Benchmark
+	public Object boxed() throws Exception {
+		return js.callFunc("score", x, y);
+	}
+
+	@Benchmark
+	public double unboxedResult() throws Exception {
+		return js.callFuncDouble("score", (Object)x, (Object)y);
+	}
+
+	@Benchmark
+	public double unboxed() throws Exception {
+		return js.callFuncDoubleN("score", x, y);
+	}
+}
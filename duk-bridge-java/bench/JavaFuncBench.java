@@ -0,0 +1,59 @@
+import org.openjdk.jmh.annotations.*;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * throughput of calling java functions from JS.
+ * every benchmark invocation runs a JS loop calling a java function 1000 times.
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class JavaFuncBench {
+	private static final int CALLS = 1000;
+	private DukBridge js;
+
+	@Setup
+	public void setup() throws Exception {
+		js = new DukBridge(".", null);
+		js.registerJavaFunc("boxedAdd", args -> (Double)args[0] + (Double)args[1]);
+		js.registerJavaNumberFunc("numberAdd", args -> args[0] + args[1]);
+		js.registerJavaFunc("echo", args -> args[0]);
+		js.registerCodeFunc("function callBoxed(n) { var s = 0; for (var i=0; i<n; i++) { s = boxedAdd(s, 1); } return s; }", "callBoxed");
+		js.registerCodeFunc("function callNumber(n) { var s = 0; for (var i=0; i<n; i++) { s = numberAdd(s, 1); } return s; }", "callNumber");
+		js.registerCodeFunc("function callEcho(n) { var s; for (var i=0; i<n; i++) { s = echo('hello, java'); } return s; }", "callEcho");
+		js.registerCodeFunc("function callEmpty(n) { var s = 0; for (var i=0; i<n; i++) { s += 1; } return s; }", "callEmpty");
+	}
+
+	@TearDown
+	public void tearDown() {
+		js.close();
+	}
+
+	@Benchmark
+	@OperationsPerInvocation(CALLS)
+	public Object boxedArgs() throws Exception {
+		return js.callFunc("callBoxed", CALLS);
+	}
+
+	@Benchmark
+	@OperationsPerInvocation(CALLS)
+	public Object numberArgs() throws Exception {
+		return js.callFunc("callNumber", CALLS);
+	}
+
+	@Benchmark
+	@OperationsPerInvocation(CALLS)
+	public Object stringArgs() throws Exception {
+		return js.callFunc("callEcho", CALLS);
+	}
+
+	// the cost of the JS loop itself
+	@Benchmark
+	@OperationsPerInvocation(CALLS)
+	public Object baseline() throws Exception {
+		return js.callFunc("callEmpty", CALLS);
+	}
+}
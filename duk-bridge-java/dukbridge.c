@@ -3,6 +3,188 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* JNI classes and method IDs which are resolved only once in JNI_OnLoad() */
+static struct {
+	jclass booleanClass;
+	jclass integerClass;
+	jclass doubleClass;
+	jmethodID booleanValueOf; // static Boolean Boolean.valueOf(boolean)
+	jmethodID integerValueOf; // static Integer Integer.valueOf(int)
+	jmethodID doubleValueOf;  // static Double Double.valueOf(double)
+	jmethodID booleanValue;   // boolean Boolean.booleanValue()
+	jmethodID doubleValue;    // double Number.doubleValue()
+	jmethodID readFile;       // byte[] FileReader.readFile(String)
+	jclass numberClass;
+	jclass stringClass;
+	jclass bytesClass;        // byte[]
+	jclass objectClass;
+	jclass objArgClass;
+	jclass nativeNumberFuncClass;
+	jfieldID objArgType;      // char ObjArg.type
+	jfieldID objArgArg;       // byte[] ObjArg.arg
+	jmethodID toString;       // String Object.toString()
+	jmethodID calledByJs;     // Object NativeFunc.calledByJs(Object ...args)
+	jmethodID calledByJsD;    // double NativeNumberFunc.calledByJs(double[] args)
+	jclass j2cHelperClass;
+	jmethodID moduleMethods;  // static String[] J2CHelper.moduleMethods(Class<?>)
+	jmethodID loadModule;     // Class<?> NativeModuleLoader.LoadModule(String)
+	jmethodID finalizeModule; // void NativeModuleLoader.FinalizeModule(String, Class<?>)
+	jclass doublesClass;      // double[]
+	jclass intsClass;         // int[]
+	jclass exceptionClass;
+} jcache;
+
+static JavaVM *g_vm = NULL;
+static pthread_key_t g_attachedKey; // set for native threads attached by currentJNIEnv()
+
+static void detachThread(void *p) {
+	if (g_vm != NULL) {
+		(*g_vm)->DetachCurrentThread(g_vm);
+	}
+}
+
+static jclass findGlobalClass(JNIEnv *env, const char *clsName) {
+	jclass cls = (*env)->FindClass(env, clsName);
+	if (cls == NULL) {
+		return NULL;
+	}
+	jclass gcls = (jclass)(*env)->NewGlobalRef(env, cls);
+	(*env)->DeleteLocalRef(env, cls);
+	return gcls;
+}
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved)
+{
+	JNIEnv *env;
+	if ((*vm)->GetEnv(vm, (void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+		return JNI_ERR;
+	}
+	g_vm = vm;
+	if (pthread_key_create(&g_attachedKey, detachThread) != 0) {
+		return JNI_ERR;
+	}
+
+	if ((jcache.booleanClass = findGlobalClass(env, "java/lang/Boolean")) == NULL ||
+		(jcache.integerClass = findGlobalClass(env, "java/lang/Integer")) == NULL ||
+		(jcache.doubleClass = findGlobalClass(env, "java/lang/Double")) == NULL) {
+		return JNI_ERR;
+	}
+	jcache.booleanValueOf = (*env)->GetStaticMethodID(env, jcache.booleanClass, "valueOf", "(Z)Ljava/lang/Boolean;");
+	jcache.integerValueOf = (*env)->GetStaticMethodID(env, jcache.integerClass, "valueOf", "(I)Ljava/lang/Integer;");
+	jcache.doubleValueOf = (*env)->GetStaticMethodID(env, jcache.doubleClass, "valueOf", "(D)Ljava/lang/Double;");
+	jcache.booleanValue = (*env)->GetMethodID(env, jcache.booleanClass, "booleanValue", "()Z");
+
+	jclass cls = (*env)->FindClass(env, "java/lang/Number");
+	if (cls == NULL) {
+		return JNI_ERR;
+	}
+	jcache.doubleValue = (*env)->GetMethodID(env, cls, "doubleValue", "()D");
+	(*env)->DeleteLocalRef(env, cls);
+
+	cls = (*env)->FindClass(env, "FileReader");
+	if (cls == NULL) {
+		return JNI_ERR;
+	}
+	jcache.readFile = (*env)->GetMethodID(env, cls, "readFile", "(Ljava/lang/String;)[B");
+	(*env)->DeleteLocalRef(env, cls);
+
+	if ((jcache.numberClass = findGlobalClass(env, "java/lang/Number")) == NULL ||
+		(jcache.stringClass = findGlobalClass(env, "java/lang/String")) == NULL ||
+		(jcache.bytesClass = findGlobalClass(env, "[B")) == NULL ||
+		(jcache.objectClass = findGlobalClass(env, "java/lang/Object")) == NULL ||
+		(jcache.objArgClass = findGlobalClass(env, "ObjArg")) == NULL ||
+		(jcache.nativeNumberFuncClass = findGlobalClass(env, "NativeNumberFunc")) == NULL) {
+		return JNI_ERR;
+	}
+	jcache.objArgType = (*env)->GetFieldID(env, jcache.objArgClass, "type", "C");
+	jcache.objArgArg = (*env)->GetFieldID(env, jcache.objArgClass, "arg", "[B");
+	jcache.toString = (*env)->GetMethodID(env, jcache.objectClass, "toString", "()Ljava/lang/String;");
+	jcache.calledByJsD = (*env)->GetMethodID(env, jcache.nativeNumberFuncClass, "calledByJs", "([D)D");
+
+	cls = (*env)->FindClass(env, "NativeFunc");
+	if (cls == NULL) {
+		return JNI_ERR;
+	}
+	jcache.calledByJs = (*env)->GetMethodID(env, cls, "calledByJs", "([Ljava/lang/Object;)Ljava/lang/Object;");
+	(*env)->DeleteLocalRef(env, cls);
+
+	if ((jcache.j2cHelperClass = findGlobalClass(env, "J2CHelper")) == NULL ||
+		(jcache.doublesClass = findGlobalClass(env, "[D")) == NULL ||
+		(jcache.intsClass = findGlobalClass(env, "[I")) == NULL ||
+		(jcache.exceptionClass = findGlobalClass(env, "java/lang/Exception")) == NULL) {
+		return JNI_ERR;
+	}
+	jcache.moduleMethods = (*env)->GetStaticMethodID(env, jcache.j2cHelperClass, "moduleMethods", "(Ljava/lang/Class;)[Ljava/lang/String;");
+
+	cls = (*env)->FindClass(env, "NativeModuleLoader");
+	if (cls == NULL) {
+		return JNI_ERR;
+	}
+	jcache.loadModule = (*env)->GetMethodID(env, cls, "LoadModule", "(Ljava/lang/String;)Ljava/lang/Class;");
+	jcache.finalizeModule = (*env)->GetMethodID(env, cls, "FinalizeModule", "(Ljava/lang/String;Ljava/lang/Class;)V");
+	(*env)->DeleteLocalRef(env, cls);
+
+	if (jcache.booleanValueOf == NULL || jcache.integerValueOf == NULL || jcache.doubleValueOf == NULL ||
+		jcache.booleanValue == NULL || jcache.doubleValue == NULL || jcache.readFile == NULL ||
+		jcache.objArgType == NULL || jcache.objArgArg == NULL || jcache.toString == NULL ||
+		jcache.calledByJs == NULL || jcache.calledByJsD == NULL ||
+		jcache.moduleMethods == NULL || jcache.loadModule == NULL || jcache.finalizeModule == NULL) {
+		return JNI_ERR;
+	}
+	return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved)
+{
+	JNIEnv *env;
+	if ((*vm)->GetEnv(vm, (void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+		return;
+	}
+	(*env)->DeleteGlobalRef(env, jcache.booleanClass);
+	(*env)->DeleteGlobalRef(env, jcache.integerClass);
+	(*env)->DeleteGlobalRef(env, jcache.doubleClass);
+	(*env)->DeleteGlobalRef(env, jcache.numberClass);
+	(*env)->DeleteGlobalRef(env, jcache.stringClass);
+	(*env)->DeleteGlobalRef(env, jcache.bytesClass);
+	(*env)->DeleteGlobalRef(env, jcache.objectClass);
+	(*env)->DeleteGlobalRef(env, jcache.objArgClass);
+	(*env)->DeleteGlobalRef(env, jcache.nativeNumberFuncClass);
+	(*env)->DeleteGlobalRef(env, jcache.j2cHelperClass);
+	(*env)->DeleteGlobalRef(env, jcache.doublesClass);
+	(*env)->DeleteGlobalRef(env, jcache.intsClass);
+	(*env)->DeleteGlobalRef(env, jcache.exceptionClass);
+	memset(&jcache, 0, sizeof(jcache));
+	g_vm = NULL;
+}
+
+/*
+ * a java function registered by jsRegisterJavaFunc(), owned by the JS function
+ * bridging it, which may outlive the registration: `var g = f;`
+ */
+typedef struct {
+	jobject func;            // global ref of NativeFunc or NativeNumberFunc
+	int isNumberFunc;        // func is an instance of NativeNumberFunc
+	void *js;                // the JS env the function registered in
+} java_func_t;
+
+/* a NativeModuleLoader added by jsAddModuleLoader() */
+typedef struct java_loader {
+	jobject loader;          // global ref of NativeModuleLoader
+	void *js;                // the JS env the loader added to
+	struct java_loader *next;
+} java_loader_t;
+
+/* the env handle held by DukBridge */
+typedef struct {
+	void *js;                // the result of js_create_env()
+	java_loader_t *loaders;  // module loaders added to the env
+	jobject fileReader;      // global ref of FileReader, NULL if not set
+} jenv_t;
+
+#define JS_ENV(jsEnv) (((jenv_t*)(jsEnv))->js)
 
 /*
  * Class:     DukBridge
@@ -11,10 +193,18 @@
  */
 JNIEXPORT jlong JNICALL Java_DukBridge_jsCreateEnv(JNIEnv *env, jobject obj, jstring modPath)
 {
+	jenv_t *e = (jenv_t*)calloc(1, sizeof(jenv_t));
+	if (e == NULL) {
+		return 0L;
+	}
 	const char* mp = (*env)->GetStringUTFChars(env, modPath, 0);
-	jlong e = (jlong)js_create_env(mp);
-	(*env)->ReleaseStringUTFChars(env, modPath, 0);
-	return e;
+	e->js = js_create_env(mp);
+	(*env)->ReleaseStringUTFChars(env, modPath, mp);
+	if (e->js == NULL) {
+		free(e);
+		return 0L;
+	}
+	return (jlong)e;
 }
 
 /*
@@ -24,34 +214,104 @@ JNIEXPORT jlong JNICALL Java_DukBridge_jsCreateEnv(JNIEnv *env, jobject obj, jst
  */
 JNIEXPORT void JNICALL Java_DukBridge_jsDestroyEnv(JNIEnv *env, jobject obj, jlong jsEnv)
 {
-	void *e = (void*)jsEnv;
-	js_destroy_env(e);
+	jenv_t *e = (jenv_t*)jsEnv;
+	if (e == NULL) {
+		return;
+	}
+	js_destroy_env(e->js); // java functions are freed by finalizers
+
+	java_loader_t *l, *nextLoader;
+	for (l=e->loaders; l!=NULL; l=nextLoader) {
+		nextLoader = l->next;
+		(*env)->DeleteGlobalRef(env, l->loader);
+		free(l);
+	}
+	if (e->fileReader != NULL) {
+		(*env)->DeleteGlobalRef(env, e->fileReader);
+	}
+	free(e);
 }
 
-static JNIEnv *g_env = NULL;
-static jobject g_fileReader = NULL;
+/*
+ * Class:     DukBridge
+ * Method:    jsGetHeapStats
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_DukBridge_jsGetHeapStats(JNIEnv *env, jobject obj, jlong jsEnv)
+{
+	env_stats_t stats;
+	js_get_env_stats(JS_ENV(jsEnv), &stats);
 
-static int fileReaderBridge(const char *fileName, char **content, size_t *len) {
-	jclass clazz = (*g_env)->GetObjectClass(g_env, g_fileReader);
-	jmethodID readFile = (*g_env)->GetMethodID(g_env, clazz, "readFile","(Ljava/lang/String;)[B");
-	if (readFile == NULL) {
+	jlong s[3] = {(jlong)stats.heap_bytes, (jlong)stats.peak_bytes, (jlong)stats.alloc_count};
+	jlongArray res = (*env)->NewLongArray(env, 3);
+	if (res != NULL) {
+		(*env)->SetLongArrayRegion(env, res, 0, 3, s);
+	}
+	return res;
+}
+
+/*
+ * the JNIEnv of the current thread. A native thread running JS is attached to
+ * the JVM as a daemon thread, and detached when the thread exits.
+ */
+static JNIEnv *currentJNIEnv() {
+	JNIEnv *env;
+	if (g_vm == NULL) {
+		return NULL;
+	}
+	switch ((*g_vm)->GetEnv(g_vm, (void**)&env, JNI_VERSION_1_6)) {
+	case JNI_OK:
+		return env;
+	case JNI_EDETACHED:
+		if ((*g_vm)->AttachCurrentThreadAsDaemon(g_vm, (void**)&env, NULL) != JNI_OK) {
+			return NULL;
+		}
+		pthread_setspecific(g_attachedKey, env);
+		return env;
+	default:
+		return NULL;
+	}
+}
+
+// the fn_free_udd of a java function, called when the JS function bridging it is finalized
+static void freeJavaFunc(void *udd) {
+	java_func_t *f = (java_func_t*)udd;
+	JNIEnv *env = currentJNIEnv();
+	if (env != NULL) {
+		(*env)->DeleteGlobalRef(env, f->func);
+	}
+	free(f);
+}
+
+// the fn_read_env_file of an env, udd is the jenv_t
+static int fileReaderBridge(void *udd, const char *fileName, char **content, size_t *len) {
+	jenv_t *e = (jenv_t*)udd;
+	JNIEnv *env = currentJNIEnv();
+	if (env == NULL || e->fileReader == NULL) {
 		return -1;
 	}
 
-	jstring fn = (*g_env)->NewStringUTF(g_env, fileName);
-	jbyteArray c = (jbyteArray)(*g_env)->CallObjectMethod(g_env, g_fileReader, readFile, fn);
-	if (c == NULL) {
+	jstring fn = (*env)->NewStringUTF(env, fileName);
+	jbyteArray c = (jbyteArray)(*env)->CallObjectMethod(env, e->fileReader, jcache.readFile, fn);
+	(*env)->DeleteLocalRef(env, fn);
+	if ((*env)->ExceptionCheck(env)) {
+		(*env)->ExceptionClear(env);
 		return -2;
 	}
+	if (c == NULL) {
+		return -1; // not found
+	}
 
-	jboolean copy = JNI_FALSE;
-	jbyte *arr = (*g_env)->GetByteArrayElements(g_env, c, &copy);
-	jsize alen = (*g_env)->GetArrayLength(g_env, c);
-	*content = (char*)malloc(alen);
-	memcpy(*content, arr, alen);
+	jsize alen = (*env)->GetArrayLength(env, c);
+	*content = (char*)malloc(alen > 0 ? alen : 1);
+	if (*content == NULL) {
+		(*env)->DeleteLocalRef(env, c);
+		return -3;
+	}
+	(*env)->GetByteArrayRegion(env, c, 0, alen, (jbyte*)*content);
 	*len = (size_t)alen;
 
-	(*g_env)->ReleaseByteArrayElements(g_env, c, arr, JNI_ABORT);
+	(*env)->DeleteLocalRef(env, c);
 	return 0;
 }
 
@@ -62,19 +322,17 @@ static int fileReaderBridge(const char *fileName, char **content, size_t *len) {
  */
 JNIEXPORT void JNICALL Java_DukBridge_jsSetFileReader(JNIEnv *env, jobject obj, jlong jsEnv, jobject fr)
 {
-	void *e = (void*)jsEnv;
+	jenv_t *e = (jenv_t*)jsEnv;
+	if (e->fileReader != NULL) {
+		(*env)->DeleteGlobalRef(env, e->fileReader);
+		e->fileReader = NULL;
+	}
 	if (fr == NULL) {
+		js_set_env_readfile(e->js, NULL, NULL);
 		return;
 	}
-	if (g_fileReader != NULL) {
-		(*env)->DeleteGlobalRef(env, g_fileReader);
-	}
-	g_fileReader = (*env)->NewGlobalRef(env, fr);
-
-	if (g_env == NULL) {
-		g_env = env;
-		js_set_readfile(fileReaderBridge);
-	}
+	e->fileReader = (*env)->NewGlobalRef(env, fr);
+	js_set_env_readfile(e->js, fileReaderBridge, e);
 }
 
 typedef struct {
@@ -82,15 +340,9 @@ typedef struct {
 	jobject *res;
 } cb_t;
 
-static void setObject(cb_t *cb, const char* clsName, const char *initSignature, res_type_t res_type, jvalue v) {
+static void setObject(cb_t *cb, jclass cls, jmethodID valueOf, jvalue v) {
 	JNIEnv *env = cb->env;
-	jclass cls = (*env)->FindClass(env, clsName);
-	jmethodID constructor = (*env)->GetMethodID(env, cls, "<init>", initSignature);
-	if (res_type == rt_double) {
-		*(cb->res) = (*env)->NewObject(env, cls, constructor, v.d);
-	} else {
-		*(cb->res) = (*env)->NewObject(env, cls, constructor, v);
-	}
+	*(cb->res) = (*env)->CallStaticObjectMethodA(env, cls, valueOf, &v);
 }
 
 static void resultReceived(void *udd, res_type_t res_type, void *res, size_t res_len) {
@@ -102,13 +354,13 @@ static void resultReceived(void *udd, res_type_t res_type, void *res, size_t res
 		return;
 	case rt_bool:
 		v.z = (jboolean)((long)res);
-		return setObject(cb, "java/lang/Boolean", "(Z)V", res_type, v);
+		return setObject(cb, jcache.booleanClass, jcache.booleanValueOf, v);
 	case rt_int:
 		v.i = (jint)(long)res;
-		return setObject(cb, "java/lang/Integer", "(I)V", res_type, v);
+		return setObject(cb, jcache.integerClass, jcache.integerValueOf, v);
 	case rt_double:
 		v.d = (jdouble)voidp2double(res);
-		return setObject(cb, "java/lang/Double", "(D)V", res_type, v);
+		return setObject(cb, jcache.doubleClass, jcache.doubleValueOf, v);
 	case rt_string:
 	case rt_object:
 	case rt_buffer:
@@ -144,7 +396,7 @@ JNIEXPORT jobject JNICALL Java_DukBridge_jsEval(JNIEnv *env, jobject ojb, jlong
 	jobject res = NULL;
 	cb_t cb = {env, &res};
 
-	void *e = (void*)jsEnv;
+	void *e = JS_ENV(jsEnv);
 	int ret = js_eval(e, jc, len, resultReceived, &cb);
 
 	(*env)->ReleaseByteArrayElements(env, jsCode, jc, JNI_ABORT);
@@ -165,9 +417,9 @@ JNIEXPORT jobject JNICALL Java_DukBridge_jsEvalFile(JNIEnv *env, jobject obj, jl
 
 	jobject res = NULL;
 	cb_t cb = {env, &res};
-	void *e = (void*)jsEnv;
+	void *e = JS_ENV(jsEnv);
 	int ret = js_eval_file(e, sf, resultReceived, &cb);
-	(*env)->ReleaseStringUTFChars(env, scriptFile, 0);
+	(*env)->ReleaseStringUTFChars(env, scriptFile, sf);
 	if (ret == 0) {
 		return res;
 	}
@@ -181,14 +433,14 @@ JNIEXPORT jobject JNICALL Java_DukBridge_jsEvalFile(JNIEnv *env, jobject obj, jl
  */
 JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterFileFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring scriptFile, jstring funcName)
 {
-	void *e = (void*)jsEnv;
+	void *e = JS_ENV(jsEnv);
 	const char* sf = (*env)->GetStringUTFChars(env, scriptFile, 0);
 	const char* fn = (*env)->GetStringUTFChars(env, funcName, 0);
 
 	int res = js_register_file_func(e, sf, fn);
 
-	(*env)->ReleaseStringUTFChars(env, scriptFile, 0);
-	(*env)->ReleaseStringUTFChars(env, funcName, 0);
+	(*env)->ReleaseStringUTFChars(env, scriptFile, sf);
+	(*env)->ReleaseStringUTFChars(env, funcName, fn);
 	return (jint)res;
 }
 
@@ -199,15 +451,15 @@ JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterFileFunc(JNIEnv *env, jobject ob
  */
 JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterCodeFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring jsCode, jstring funcName)
 {
-	void *e = (void*)jsEnv;
+	void *e = JS_ENV(jsEnv);
 	const char* jc = (*env)->GetStringUTFChars(env, jsCode, 0);
 	size_t len = (*env)->GetStringUTFLength(env, jsCode);
 	const char* fn = (*env)->GetStringUTFChars(env, funcName, 0);
 
 	int res = js_register_code_func(e, jc, len, fn);
 
-	(*env)->ReleaseStringUTFChars(env, jsCode, 0);
-	(*env)->ReleaseStringUTFChars(env, funcName, 0);
+	(*env)->ReleaseStringUTFChars(env, jsCode, jc);
+	(*env)->ReleaseStringUTFChars(env, funcName, fn);
 	return (jint)res;
 }
 
@@ -218,117 +470,721 @@ JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterCodeFunc(JNIEnv *env, jobject ob
  */
 JNIEXPORT void JNICALL Java_DukBridge_jsUnregisterFunc(JNIEnv *env, jobject ojb, jlong jsEnv, jstring funcName)
 {
-	void *e = (void*)jsEnv;
+	void *e = JS_ENV(jsEnv);
 	const char* fn = (*env)->GetStringUTFChars(env, funcName, 0);
 	js_unregister_func(e, fn);
-	(*env)->ReleaseStringUTFChars(env, funcName, 0);
+	(*env)->ReleaseStringUTFChars(env, funcName, fn);
 }
 
 static void setValue(JNIEnv *env, char fmt, jobject val, void **v)
 {
-	jclass cls = (*env)->GetObjectClass(env, val);
-	jmethodID getVal;
 	switch (fmt) {
 	case af_bool:
-		getVal = (*env)->GetMethodID(env, cls, "booleanValue", "()Z");
-		jboolean b = (*env)->CallBooleanMethod(env, val, getVal);
-		if (b) {
+		if ((*env)->CallBooleanMethod(env, val, jcache.booleanValue)) {
 			*v = (void*)((long)1);
 		} else {
 			*v = (void*)((long)0);
 		}
 		return;
 	case af_int:
+		*v = (void*)(long)(jint)(*env)->CallDoubleMethod(env, val, jcache.doubleValue);
+		return;
 	case af_double:
-		getVal = (*env)->GetMethodID(env, cls, "doubleValue", "()D");
-		jdouble d = (*env)->CallDoubleMethod(env, val, getVal);
-		*v = double2voidp(d);
+		*v = double2voidp((*env)->CallDoubleMethod(env, val, jcache.doubleValue));
 		return;
 	}
 }
 
-#define SET_BYTES_ELEM(i, j, n) do { \
-	jobject val = (*env)->GetObjectArrayElement(env, args, i); \
-	switch (fmt[i]) { \
-		case af_none: \
-			argv[j++] = NULL; \
-			continue; \
-		case af_bool: \
-		case af_int: \
-		case af_double: \
-			setValue(env, fmt[i], val, &(argv[j])); \
-			j++; continue; \
-		default: break; \
-	} \
-	argv[j++] = (void*)(long)(*env)->GetArrayLength(env, val); \
-	argv[j++] = (void*)(*env)->GetByteArrayElements(env, val, NULL); \
-} while (++i < n);
+#define MAX_STACK_ARGS 16
+// byte[] arguments not more than MAX_STACK_BYTES bytes in total are copied to the stack
+#define MAX_STACK_BYTES 1024
 
-#define RELEASE_BYTES(i, n) i=0; do { \
-	(*env)->ReleaseByteArrayElements(env, ba[i], b[i], JNI_ABORT); \
-} while (i++ < n);
+typedef int (*fn_call_func)(void*, const char*, fn_call_func_res, void*, char*, void**);
 
+/*
+ * unpack the arguments packed by J2CHelper.packArgs(), in the native byte order:
+ * 'b'/'i' -> int32, 'd' -> float64, 'S'/'B'/'a'/'o' -> int32 length and bytes, 'n' -> nothing.
+ */
+static void unpackArgs(const char *fmt, const char *p, void **argv) {
+	int32_t n;
+	double d;
+	int j = 0;
+	for (; *fmt; fmt++) {
+		switch (*fmt) {
+		case af_none:
+			argv[j++] = NULL;
+			break;
+		case af_bool:
+		case af_int:
+			memcpy(&n, p, sizeof(n)); p += sizeof(n);
+			argv[j++] = (void*)(long)n;
+			break;
+		case af_double:
+			memcpy(&d, p, sizeof(d)); p += sizeof(d);
+			argv[j++] = double2voidp(d);
+			break;
+		default:
+			memcpy(&n, p, sizeof(n)); p += sizeof(n);
+			argv[j++] = (void*)(long)n;
+			argv[j++] = (void*)p;
+			p += n;
+			break;
+		}
+	}
+}
 
-typedef int (*fn_call_func)(void*,const char*, fn_call_func_res,void*,char*, void**);
+// the arguments converted by J2CHelper.normalizeArgs() in Object[].
+static int do_call_func_objects(JNIEnv *env, void *e, const char *f, const char *fmt, jobjectArray args, fn_call_func call_func, fn_call_func_res call_func_res, void *udd) {
+	jsize len = (args == NULL) ? 0 : (*env)->GetArrayLength(env, args);
+	void *argvBuf[MAX_STACK_ARGS*2];
+	jarray arrsBuf[MAX_STACK_ARGS];
+	int slotsBuf[MAX_STACK_ARGS];
+	char bytesBuf[MAX_STACK_BYTES];
+	void **argv = argvBuf;
+	jarray *arrs = arrsBuf;
+	int *slots = slotsBuf;
+	char *bytes = bytesBuf;
+	size_t total = 0, off = 0;
+	int i, j = 0, n = 0, ret = -1;
 
-static jobject do_call_func(JNIEnv *env, jobject obj, jlong jsEnv, jstring strarg, jstring fmtarg, jobjectArray args, fn_call_func call_func) {
-	void *e = (void*)jsEnv;
-	jobject res = NULL;
-	cb_t cb = {env, &res};
+	if (len > MAX_STACK_ARGS) {
+		argv = (void**)malloc(sizeof(void*) * len * 2);
+		arrs = (jarray*)malloc(sizeof(jarray) * len);
+		slots = (int*)malloc(sizeof(int) * len);
+		if (argv == NULL || arrs == NULL || slots == NULL) {
+			goto EXIT;
+		}
+	}
+	if (len > 0 && (*env)->EnsureLocalCapacity(env, len) != 0) {
+		goto EXIT;
+	}
 
-	const char* fmt = (*env)->GetStringUTFChars(env, fmtarg, 0);
-	const char* f = (*env)->GetStringUTFChars(env, strarg, 0);
-	jsize len = (*env)->GetArrayLength(env, args);
-	// printf("len of args: %d\n", len);
-	int ret;
-	
-	if (len <= 0) {
-		ret = call_func(e, f, resultReceived, &cb, NULL, (void**)NULL);
+	for (i=0; i<len; i++) {
+		jobject val = (*env)->GetObjectArrayElement(env, args, i);
+		switch (fmt[i]) {
+		case af_none:
+			argv[j++] = NULL;
+			break;
+		case af_bool:
+		case af_int:
+		case af_double:
+			setValue(env, fmt[i], val, &(argv[j]));
+			j++;
+			break;
+		case af_xbuffer:
+			argv[j++] = (void*)(long)(*env)->GetDirectBufferCapacity(env, val);
+			argv[j++] = (*env)->GetDirectBufferAddress(env, val);
+			break;
+		default:
+			// byte[], copied below when all the lengths are known
+			argv[j] = (void*)(long)((val == NULL) ? 0 : (*env)->GetArrayLength(env, (jarray)val));
+			total += (size_t)(long)argv[j++];
+			arrs[n] = (jarray)val;
+			slots[n++] = j++;
+			continue; // the local ref is deleted after copying
+		}
+		(*env)->DeleteLocalRef(env, val);
+	}
+
+	/*
+	 * byte[] are copied by GetByteArrayRegion() instead of being pinned, because pushing
+	 * the arguments allocates memory in JS, which may run finalizers calling JNI functions.
+	 */
+	if (total > sizeof(bytesBuf)) {
+		bytes = (char*)malloc(total);
+	}
+	for (i=0; i<n; i++) {
+		size_t l = (size_t)(long)argv[slots[i]-1];
+		if (bytes != NULL && l > 0) {
+			(*env)->GetByteArrayRegion(env, (jbyteArray)arrs[i], 0, (jsize)l, (jbyte*)(bytes + off));
+		}
+		argv[slots[i]] = bytes + off;
+		off += l;
+		if (arrs[i] != NULL) {
+			(*env)->DeleteLocalRef(env, arrs[i]);
+		}
+	}
+	if (bytes == NULL) {
 		goto EXIT;
 	}
 
-	void **argv = (void**)malloc(sizeof(void*) * len * 2);
+	ret = call_func(e, f, call_func_res, udd, (char*)fmt, argv);
+EXIT:
+	if (bytes != bytesBuf) {
+		free(bytes);
+	}
+	if (argv != argvBuf) {
+		free(argv);
+		free(arrs);
+		free(slots);
+	}
+	return ret;
+}
+
+// the arguments packed in one byte[] by J2CHelper.packArgs()
+static int do_call_func_packed(JNIEnv *env, void *e, const char *f, const char *fmt, jbyteArray packed, fn_call_func call_func, fn_call_func_res call_func_res, void *udd) {
+	size_t len = strlen(fmt);
+	jsize packedLen = (*env)->GetArrayLength(env, packed);
+	void *argvBuf[MAX_STACK_ARGS*2];
+	char bytesBuf[MAX_STACK_BYTES];
+	void **argv = argvBuf;
+	char *bytes = bytesBuf;
+	int ret = -1;
+	if (len > MAX_STACK_ARGS) {
+		argv = (void**)malloc(sizeof(void*) * len * 2);
+		if (argv == NULL) {
+			goto EXIT;
+		}
+	}
+	if (packedLen > (jsize)sizeof(bytesBuf)) {
+		bytes = (char*)malloc(packedLen);
+		if (bytes == NULL) {
+			goto EXIT;
+		}
+	}
+
+	// copied instead of being pinned, as do_call_func_objects() does.
+	(*env)->GetByteArrayRegion(env, packed, 0, packedLen, (jbyte*)bytes);
+	unpackArgs(fmt, bytes, argv);
+	ret = call_func(e, f, call_func_res, udd, (char*)fmt, argv);
+EXIT:
+	if (bytes != bytesBuf) {
+		free(bytes);
+	}
+	if (argv != argvBuf) {
+		free(argv);
+	}
+	return ret;
+}
+
+// all the arguments are in a double[] or int[], which are passed without boxing.
+static int do_call_func_prims(JNIEnv *env, void *e, const char *f, jarray args, fn_call_func call_func, fn_call_func_res call_func_res, void *udd) {
+	jsize len = (args == NULL) ? 0 : (*env)->GetArrayLength(env, args);
+	char fmtBuf[MAX_STACK_ARGS+1];
+	void *argvBuf[MAX_STACK_ARGS];
+	jdouble dBuf[MAX_STACK_ARGS];
+	char *fmt = fmtBuf;
+	void **argv = argvBuf;
+	jdouble *d = dBuf;
+	int i, ret = -1;
+	if (len > MAX_STACK_ARGS) {
+		fmt = (char*)malloc(len+1);
+		argv = (void**)malloc(sizeof(void*) * len);
+		d = (jdouble*)malloc(sizeof(jdouble) * len);
+		if (fmt == NULL || argv == NULL || d == NULL) {
+			goto EXIT;
+		}
+	}
+
+	if (len == 0) {
+		// no argument
+	} else if ((*env)->IsInstanceOf(env, args, jcache.intsClass)) {
+		jint *n = (jint*)d; // sizeof(jint) < sizeof(jdouble)
+		(*env)->GetIntArrayRegion(env, (jintArray)args, 0, len, n);
+		for (i=0; i<len; i++) {
+			fmt[i] = af_int;
+			argv[i] = (void*)(long)n[i];
+		}
+	} else {
+		(*env)->GetDoubleArrayRegion(env, (jdoubleArray)args, 0, len, d);
+		for (i=0; i<len; i++) {
+			fmt[i] = af_double;
+			argv[i] = double2voidp(d[i]);
+		}
+	}
+	fmt[len] = '\0';
 
-	int i=0;
-	int j=0;
-	SET_BYTES_ELEM(i, j, len)
-	ret = call_func(e, f, resultReceived, &cb, (char*)fmt, argv);
-	// RELEASE_BYTES(i, len);  // b[i] belongs to args(jobjectArray), so calling ReleaseByteArrayElements() is not necessary.
-	free((void*)argv);
+	ret = call_func(e, f, call_func_res, udd, fmt, argv);
 EXIT:
-	(*env)->ReleaseStringUTFChars(env, strarg, 0);
-	(*env)->ReleaseStringUTFChars(env, fmtarg, 0);
+	if (fmt != fmtBuf) {
+		free(fmt);
+		free(argv);
+		free(d);
+	}
+	return ret;
+}
+
+/*
+ * call a function with arguments in one of the forms:
+ *  - fmtarg is NULL: args is double[] or int[]
+ *  - args is byte[]: the arguments packed by J2CHelper.packArgs()
+ *  - otherwise: args is Object[] normalized by J2CHelper.normalizeArgs()
+ */
+static int do_call_func(JNIEnv *env, jlong jsEnv, jstring strarg, jstring fmtarg, jobject args, fn_call_func call_func, fn_call_func_res call_func_res, void *udd) {
+	void *e = JS_ENV(jsEnv);
+	const char* f = (*env)->GetStringUTFChars(env, strarg, 0);
+	int ret;
+
+	if (fmtarg == NULL) {
+		ret = do_call_func_prims(env, e, f, (jarray)args, call_func, call_func_res, udd);
+	} else {
+		const char* fmt = (*env)->GetStringUTFChars(env, fmtarg, 0);
+		if (args != NULL && (*env)->IsInstanceOf(env, args, jcache.bytesClass)) {
+			ret = do_call_func_packed(env, e, f, fmt, (jbyteArray)args, call_func, call_func_res, udd);
+		} else {
+			ret = do_call_func_objects(env, e, f, fmt, (jobjectArray)args, call_func, call_func_res, udd);
+		}
+		(*env)->ReleaseStringUTFChars(env, fmtarg, fmt);
+	}
+
+	(*env)->ReleaseStringUTFChars(env, strarg, f);
+	return ret;
+}
+
+static jobject call_func_object(JNIEnv *env, jlong jsEnv, jstring strarg, jstring fmtarg, jobject args, fn_call_func call_func) {
+	jobject res = NULL;
+	cb_t cb = {env, &res};
+	do_call_func(env, jsEnv, strarg, fmtarg, args, call_func, resultReceived, &cb);
 	return res;
 }
 
+// the udd of bufResultReceived(), the result is written to a direct ByteBuffer.
+typedef struct {
+	char *addr;
+	jlong capacity;
+	jint len; // -1: no result, -2: the result is not bytes
+} buf_cb_t;
+
+static void bufResultReceived(void *udd, res_type_t res_type, void *res, size_t res_len) {
+	buf_cb_t *cb = (buf_cb_t*)udd;
+	switch (res_type) {
+	case rt_none:
+		cb->len = -1;
+		return;
+	case rt_string:
+	case rt_object:
+	case rt_buffer:
+	case rt_array:
+		break;
+	default:
+		cb->len = -2;
+		return;
+	}
+	cb->len = (jint)res_len;
+	if ((jlong)res_len <= cb->capacity) {
+		memcpy(cb->addr, res, res_len);
+	}
+}
+
+static jint call_func_buffer(JNIEnv *env, jlong jsEnv, jstring strarg, jstring fmtarg, jobject args, jobject out, fn_call_func call_func) {
+	buf_cb_t cb = {(*env)->GetDirectBufferAddress(env, out), (*env)->GetDirectBufferCapacity(env, out), -1};
+	if (cb.addr == NULL) {
+		return -1;
+	}
+	if (do_call_func(env, jsEnv, strarg, fmtarg, args, call_func, bufResultReceived, &cb) != 0) {
+		return -1;
+	}
+	return cb.len;
+}
+
+// the udd of primResultReceived(), a scalar result is kept without boxing.
+typedef struct {
+	res_type_t type;
+	jvalue v;
+	char err[256];
+} prim_cb_t;
+
+static void primResultReceived(void *udd, res_type_t res_type, void *res, size_t res_len) {
+	prim_cb_t *cb = (prim_cb_t*)udd;
+	cb->type = res_type;
+	switch (res_type) {
+	case rt_bool:
+		cb->v.z = (jboolean)((long)res);
+		return;
+	case rt_int:
+		cb->v.d = (jdouble)(long)res;
+		return;
+	case rt_double:
+		cb->v.d = (jdouble)voidp2double(res);
+		return;
+	case rt_error:
+		snprintf(cb->err, sizeof(cb->err), "%.*s", (int)res_len, (char*)res);
+		return;
+	default:
+		return;
+	}
+}
+
+static int call_func_prim(JNIEnv *env, jlong jsEnv, jstring funcName, jstring fmt, jobject args, prim_cb_t *cb) {
+	cb->type = rt_none;
+	cb->err[0] = '\0';
+	int ret = do_call_func(env, jsEnv, funcName, fmt, args, js_call_registered_func, primResultReceived, cb);
+	if (ret == 0) {
+		return 0;
+	}
+	if (cb->type == rt_error) {
+		(*env)->ThrowNew(env, jcache.exceptionClass, cb->err);
+	} else {
+		(*env)->ThrowNew(env, jcache.exceptionClass, "failed to call JS function");
+	}
+	return -1;
+}
+
+// check the type of a scalar result, an exception is thrown if the type is not wanted.
+static int checkPrimResult(JNIEnv *env, prim_cb_t *cb, res_type_t want) {
+	if (cb->type == want || (want == rt_double && cb->type == rt_int)) {
+		return 0;
+	}
+	(*env)->ThrowNew(env, jcache.exceptionClass, want == rt_bool ? "the result is not a boolean" : "the result is not a number");
+	return -1;
+}
+
 /*
  * Class:     DukBridge
  * Method:    jsCallFunc
- * Signature: (JLjava/lang/String;Ljava/lang/String;[Ljava/lang/Object;)Ljava/lang/Object;
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Ljava/lang/Object;
  */
-JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobjectArray args)
+JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobject args)
 {
-	return do_call_func(env, obj, jsEnv, funcName, fmt, args, js_call_registered_func);
+	return call_func_object(env, jsEnv, funcName, fmt, args, js_call_registered_func);
 }
 
 /*
  * Class:     DukBridge
  * Method:    jsCallFileFunc
- * Signature: (JLjava/lang/String;Ljava/lang/String;[Ljava/lang/Object;)Ljava/lang/Object;
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Ljava/lang/Object;
+ */
+JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFileFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring scriptFile, jstring fmt, jobject args)
+{
+	return call_func_object(env, jsEnv, scriptFile, fmt, args, js_call_file_func);
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncDouble
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)D
+ */
+JNIEXPORT jdouble JNICALL Java_DukBridge_jsCallFuncDouble(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobject args)
+{
+	prim_cb_t cb;
+	if (call_func_prim(env, jsEnv, funcName, fmt, args, &cb) != 0 || checkPrimResult(env, &cb, rt_double) != 0) {
+		return 0.0;
+	}
+	return cb.v.d;
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncLong
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)J
+ */
+JNIEXPORT jlong JNICALL Java_DukBridge_jsCallFuncLong(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobject args)
+{
+	prim_cb_t cb;
+	if (call_func_prim(env, jsEnv, funcName, fmt, args, &cb) != 0 || checkPrimResult(env, &cb, rt_double) != 0) {
+		return 0;
+	}
+	return (jlong)cb.v.d;
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncBoolean
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_DukBridge_jsCallFuncBoolean(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobject args)
+{
+	prim_cb_t cb;
+	if (call_func_prim(env, jsEnv, funcName, fmt, args, &cb) != 0 || checkPrimResult(env, &cb, rt_bool) != 0) {
+		return JNI_FALSE;
+	}
+	return cb.v.z;
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsEvalDouble
+ * Signature: (J[B)D
  */
-JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFileFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring scriptFile, jstring fmt, jobjectArray args)
+JNIEXPORT jdouble JNICALL Java_DukBridge_jsEvalDouble(JNIEnv *env, jobject obj, jlong jsEnv, jbyteArray jsCode)
 {
-	return do_call_func(env, obj, jsEnv, scriptFile, fmt, args, js_call_file_func);
+	jbyte *jc = (*env)->GetByteArrayElements(env, jsCode, NULL);
+	jsize len = (*env)->GetArrayLength(env, jsCode);
+
+	prim_cb_t cb;
+	cb.type = rt_none;
+	cb.err[0] = '\0';
+	int ret = js_eval(JS_ENV(jsEnv), (const char*)jc, len, primResultReceived, &cb);
+	(*env)->ReleaseByteArrayElements(env, jsCode, jc, JNI_ABORT);
+
+	if (ret != 0) {
+		(*env)->ThrowNew(env, jcache.exceptionClass, cb.type == rt_error ? cb.err : "failed to eval JS code");
+		return 0.0;
+	}
+	if (checkPrimResult(env, &cb, rt_double) != 0) {
+		return 0.0;
+	}
+	return cb.v.d;
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsEvalBuffer
+ * Signature: (JLjava/nio/ByteBuffer;)Ljava/lang/Object;
+ */
+JNIEXPORT jobject JNICALL Java_DukBridge_jsEvalBuffer(JNIEnv *env, jobject obj, jlong jsEnv, jobject jsCode)
+{
+	char *jc = (char*)(*env)->GetDirectBufferAddress(env, jsCode);
+	jlong len = (*env)->GetDirectBufferCapacity(env, jsCode);
+	if (jc == NULL || len < 0) {
+		return NULL;
+	}
+
+	jobject res = NULL;
+	cb_t cb = {env, &res};
+	if (js_eval(JS_ENV(jsEnv), jc, (size_t)len, resultReceived, &cb) == 0) {
+		return res;
+	}
+	return NULL;
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncBuffer
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;Ljava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_DukBridge_jsCallFuncBuffer(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jstring fmt, jobject args, jobject out)
+{
+	return call_func_buffer(env, jsEnv, funcName, fmt, args, out, js_call_registered_func);
+}
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFileFuncBuffer
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;Ljava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_DukBridge_jsCallFileFuncBuffer(JNIEnv *env, jobject obj, jlong jsEnv, jstring scriptFile, jstring fmt, jobject args, jobject out)
+{
+	return call_func_buffer(env, jsEnv, scriptFile, fmt, args, out, js_call_file_func);
+}
+
+static jobject toJavaArg(JNIEnv *env, void *js, char fmt, void **argv, int *j) {
+	size_t len;
+	char *s;
+	jbyteArray a;
+	jvalue v;
+	switch (fmt) {
+	case af_none:
+		(*j)++;
+		return NULL;
+	case af_bool:
+		v.z = (jboolean)(long)argv[(*j)++];
+		return (*env)->CallStaticObjectMethodA(env, jcache.booleanClass, jcache.booleanValueOf, &v);
+	case af_int:
+		v.i = (jint)(long)argv[(*j)++];
+		return (*env)->CallStaticObjectMethodA(env, jcache.integerClass, jcache.integerValueOf, &v);
+	case af_double:
+		v.d = (jdouble)voidp2double(argv[(*j)++]);
+		return (*env)->CallStaticObjectMethodA(env, jcache.doubleClass, jcache.doubleValueOf, &v);
+	case af_ecmafunc:
+		// not callable in java
+		js_destroy_ecmascript_func(js, argv[(*j)++]);
+		return NULL;
+	case af_lstring:
+		len = (size_t)argv[(*j)++];
+		s = (char*)argv[(*j)++];
+		if (memchr(s, 0, len) == NULL && s[len] == '\0') {
+			return (*env)->NewStringUTF(env, s);
+		}
+		break;
+	default:
+		// buffer, JSON array and JSON object are converted to byte[]
+		len = (size_t)argv[(*j)++];
+		s = (char*)argv[(*j)++];
+		break;
+	}
+	a = (*env)->NewByteArray(env, len);
+	if (a != NULL) {
+		(*env)->SetByteArrayRegion(env, a, 0, len, (jbyte*)s);
+	}
+	return a;
+}
+
+static double toJavaDouble(const char fmt, void **argv, int *j) {
+	switch (fmt) {
+	case af_bool:
+	case af_int:
+		return (double)(long)argv[(*j)++];
+	case af_double:
+		return voidp2double(argv[(*j)++]);
+	case af_none:
+	case af_ecmafunc:
+		(*j)++;
+		return 0.0/0.0;
+	default:
+		*j += 2;
+		return 0.0/0.0;
+	}
+}
+
+static void setBytesResult(JNIEnv *env, jbyteArray a, res_type_t type, void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	jsize len = (*env)->GetArrayLength(env, a);
+	char *b = (char*)malloc(len + 1);
+	if (b == NULL) {
+		return;
+	}
+	(*env)->GetByteArrayRegion(env, a, 0, len, (jbyte*)b);
+	b[len] = '\0';
+	*res = b;
+	*res_len = (size_t)len;
+	*res_type = type;
+	*free_res = free;
+}
+
+static void setStringResult(JNIEnv *env, jstring str, res_type_t type, void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	jsize len = (*env)->GetStringUTFLength(env, str);
+	char *b = (char*)malloc(len + 1);
+	if (b == NULL) {
+		return;
+	}
+	(*env)->GetStringUTFRegion(env, str, 0, (*env)->GetStringLength(env, str), b);
+	b[len] = '\0';
+	*res = b;
+	*res_len = (size_t)len;
+	*res_type = type;
+	*free_res = free;
+}
+
+static void fromJavaResult(JNIEnv *env, jobject r, void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	if (r == NULL) {
+		return;
+	}
+	if ((*env)->IsInstanceOf(env, r, jcache.booleanClass)) {
+		*res_type = rt_bool;
+		*res = (void*)(long)((*env)->CallBooleanMethod(env, r, jcache.booleanValue) ? 1 : 0);
+	} else if ((*env)->IsInstanceOf(env, r, jcache.integerClass)) {
+		*res_type = rt_int;
+		*res = (void*)(long)(*env)->CallDoubleMethod(env, r, jcache.doubleValue);
+	} else if ((*env)->IsInstanceOf(env, r, jcache.numberClass)) {
+		*res_type = rt_double;
+		*res = double2voidp((*env)->CallDoubleMethod(env, r, jcache.doubleValue));
+	} else if ((*env)->IsInstanceOf(env, r, jcache.stringClass)) {
+		setStringResult(env, (jstring)r, rt_string, res, res_type, res_len, free_res);
+	} else if ((*env)->IsInstanceOf(env, r, jcache.bytesClass)) {
+		setBytesResult(env, (jbyteArray)r, rt_string, res, res_type, res_len, free_res);
+	} else if ((*env)->IsInstanceOf(env, r, jcache.objArgClass)) {
+		jbyteArray a = (jbyteArray)(*env)->GetObjectField(env, r, jcache.objArgArg);
+		if (a == NULL) {
+			return;
+		}
+		res_type_t type;
+		switch ((*env)->GetCharField(env, r, jcache.objArgType)) {
+		case 'B':
+			type = rt_buffer;
+			break;
+		case 'a':
+			type = rt_array;
+			break;
+		case 'o':
+			type = rt_object;
+			break;
+		default:
+			type = rt_string;
+			break;
+		}
+		setBytesResult(env, a, type, res, res_type, res_len, free_res);
+		(*env)->DeleteLocalRef(env, a);
+	}
+}
+
+static int setJavaException(JNIEnv *env, void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	jthrowable e = (*env)->ExceptionOccurred(env);
+	if (e == NULL) {
+		return 0;
+	}
+	(*env)->ExceptionClear(env);
+	jstring msg = (jstring)(*env)->CallObjectMethod(env, e, jcache.toString);
+	if (msg != NULL) {
+		setStringResult(env, msg, rt_error, res, res_type, res_len, free_res);
+		(*env)->DeleteLocalRef(env, msg);
+	}
+	(*env)->DeleteLocalRef(env, e);
+	return 1;
+}
+
+// the fn_native_func of all the java functions, udd is a pointer to java_func_t
+static void javaFuncBridge(void *udd, const char *fmt, void *argv[], void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	java_func_t *f = (java_func_t*)udd;
+	JNIEnv *env = currentJNIEnv();
+	*res_type = rt_none;
+	*free_res = NULL;
+	if (env == NULL) {
+		return;
+	}
+
+	int nargs = (fmt == NULL) ? 0 : strlen(fmt);
+	int i, j;
+	if ((*env)->PushLocalFrame(env, nargs + 4) != 0) {
+		return;
+	}
+
+	if (f->isNumberFunc) {
+		// primitives are passed without boxing
+		jdouble stackArgs[8];
+		jdouble *d = (nargs <= 8) ? stackArgs : (jdouble*)malloc(sizeof(jdouble) * nargs);
+		jdoubleArray a = (d == NULL) ? NULL : (*env)->NewDoubleArray(env, nargs);
+		if (a != NULL) {
+			for (i=0, j=0; i<nargs; i++) {
+				d[i] = toJavaDouble(fmt[i], argv, &j);
+			}
+			(*env)->SetDoubleArrayRegion(env, a, 0, nargs, d);
+			jdouble r = (*env)->CallDoubleMethod(env, f->func, jcache.calledByJsD, a);
+			if (!setJavaException(env, res, res_type, res_len, free_res)) {
+				*res_type = rt_double;
+				*res = double2voidp(r);
+			}
+		}
+		if (d != stackArgs) {
+			free(d);
+		}
+		(*env)->PopLocalFrame(env, NULL);
+		return;
+	}
+
+	jobjectArray a = (*env)->NewObjectArray(env, nargs, jcache.objectClass, NULL);
+	if (a != NULL) {
+		for (i=0, j=0; i<nargs; i++) {
+			jobject v = toJavaArg(env, f->js, fmt[i], argv, &j);
+			if (v != NULL) {
+				(*env)->SetObjectArrayElement(env, a, i, v);
+				(*env)->DeleteLocalRef(env, v);
+			}
+		}
+		jobject r = (*env)->CallObjectMethod(env, f->func, jcache.calledByJs, a);
+		if (!setJavaException(env, res, res_type, res_len, free_res)) {
+			fromJavaResult(env, r, res, res_type, res_len, free_res);
+		}
+	}
+	(*env)->PopLocalFrame(env, NULL);
 }
 
 /*
  * Class:     DukBridge
  * Method:    jsRegisterJavaFunc
- * Signature: (JLjava/lang/String;LNativeFunc;)I
+ * Signature: (JLjava/lang/String;Ljava/lang/Object;)I
  */
 JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterJavaFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName, jobject nativeFunc)
 {
-	return -1;
+	jenv_t *e = (jenv_t*)jsEnv;
+	if (nativeFunc == NULL) {
+		return -1;
+	}
+	java_func_t *f = (java_func_t*)calloc(1, sizeof(java_func_t));
+	if (f == NULL) {
+		return -1;
+	}
+	f->func = (*env)->NewGlobalRef(env, nativeFunc);
+	f->isNumberFunc = (*env)->IsInstanceOf(env, nativeFunc, jcache.nativeNumberFuncClass);
+	f->js = e->js;
+
+	// the function with the same name is replaced, the old one is freed when it is finalized.
+	const char* fn = (*env)->GetStringUTFChars(env, funcName, 0);
+	int ret = js_register_native_func_ex(e->js, fn, javaFuncBridge, -1, f, freeJavaFunc);
+	(*env)->ReleaseStringUTFChars(env, funcName, fn);
+	if (ret != 0) {
+		freeJavaFunc(f);
+	}
+	return ret;
 }
 
 /*
@@ -338,6 +1194,320 @@ JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterJavaFunc(JNIEnv *env, jobject ob
  */
 JNIEXPORT void JNICALL Java_DukBridge_jsUnregisterJavaFunc(JNIEnv *env, jobject obj, jlong jsEnv, jstring funcName)
 {
+	const char* fn = (*env)->GetStringUTFChars(env, funcName, 0);
+	js_unregister_native_func(JS_ENV(jsEnv), fn); // the java function is freed when it is finalized
+	(*env)->ReleaseStringUTFChars(env, funcName, fn);
+}
+
+/* a public static method of a java module class */
+typedef struct {
+	struct java_class *jc;
+	char *name;
+	jmethodID method;
+	char *argTypes;          // one char per argument: Z B C S I J F D, T for String, Y for byte[], O for Object
+	char retType;            // V Z B C S I J F D, or O for any object
+} java_method_t;
+
+/*
+ * the method table of a java module class, which is created once per class
+ * and shared by all the module instances in all the envs. A cached class is
+ * never unloaded.
+ */
+typedef struct java_class {
+	jclass cls;              // global ref
+	int nMethods;
+	java_method_t *methods;
+	struct java_class *next;
+} java_class_t;
+
+/* the udd of a module method, owned by the JS function of the method, which may outlive the module */
+typedef struct {
+	java_method_t *m;
+	void *js;
+} java_method_ref_t;
+
+/* a module instance created by a NativeModuleLoader */
+typedef struct {
+	java_loader_t *loader;
+	jclass cls;              // global ref of the class returned by LoadModule(), deleted by the finalizer
+	module_method_t *methods; // jc->nMethods+1 items
+} java_module_t;
+
+static java_class_t *g_classes = NULL;
+static pthread_mutex_t g_classes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void javaMethodBridge(void *udd, const char *fmt, void *argv[], void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res);
+
+// parse a JNI method signature to argument types and result type
+static int parseSignature(const char *sig, java_method_t *m) {
+	int n = 0;
+	char *types = (char*)malloc(strlen(sig) + 1);
+	if (types == NULL) {
+		return -1;
+	}
+	const char *p = sig + 1; // skip '('
+	while (*p != ')' && *p != '\0') {
+		if (strncmp(p, "Ljava/lang/String;", 18) == 0) {
+			types[n++] = 'T';
+			p += 18;
+		} else if (strncmp(p, "[B", 2) == 0) {
+			types[n++] = 'Y';
+			p += 2;
+		} else if (strncmp(p, "Ljava/lang/Object;", 18) == 0) {
+			types[n++] = 'O';
+			p += 18;
+		} else if (strchr("ZBCSIJFD", *p) != NULL) {
+			types[n++] = *p++;
+		} else {
+			// filtered by J2CHelper.moduleMethods()
+			free(types);
+			return -1;
+		}
+	}
+	types[n] = '\0';
+	m->argTypes = types;
+	p++;
+	m->retType = (strchr("VZBCSIJFD", *p) != NULL) ? *p : 'O';
+	return n;
+}
+
+static java_class_t *createJavaClass(JNIEnv *env, jclass cls) {
+	jobjectArray descs = (jobjectArray)(*env)->CallStaticObjectMethod(env, jcache.j2cHelperClass, jcache.moduleMethods, cls);
+	if (descs == NULL) {
+		(*env)->ExceptionClear(env);
+		return NULL;
+	}
+	int n = (*env)->GetArrayLength(env, descs) / 2;
+	java_class_t *jc = (java_class_t*)calloc(1, sizeof(java_class_t));
+	if (jc == NULL) {
+		return NULL;
+	}
+	jc->methods = (java_method_t*)calloc(n+1, sizeof(java_method_t));
+	if (jc->methods == NULL) {
+		free(jc);
+		return NULL;
+	}
+	jc->cls = (jclass)(*env)->NewGlobalRef(env, cls);
+
+	int i, j;
+	for (i=0, j=0; i<n; i++) {
+		jstring name = (jstring)(*env)->GetObjectArrayElement(env, descs, 2*i);
+		jstring sig = (jstring)(*env)->GetObjectArrayElement(env, descs, 2*i+1);
+		const char *cname = (*env)->GetStringUTFChars(env, name, 0);
+		const char *csig = (*env)->GetStringUTFChars(env, sig, 0);
+
+		java_method_t *m = jc->methods + j;
+		m->jc = jc;
+		m->method = (*env)->GetStaticMethodID(env, cls, cname, csig);
+		int nargs = (m->method == NULL) ? -1 : parseSignature(csig, m);
+		if (nargs >= 0) {
+			m->name = strdup(cname);
+			j++;
+		} else {
+			(*env)->ExceptionClear(env);
+		}
+
+		(*env)->ReleaseStringUTFChars(env, name, cname);
+		(*env)->ReleaseStringUTFChars(env, sig, csig);
+		(*env)->DeleteLocalRef(env, name);
+		(*env)->DeleteLocalRef(env, sig);
+	}
+	jc->nMethods = j;
+	(*env)->DeleteLocalRef(env, descs);
+	return jc;
+}
+
+// get the method table of a class, reflection is done only when the class is met the first time.
+static java_class_t *getJavaClass(JNIEnv *env, jclass cls) {
+	java_class_t *jc;
+	pthread_mutex_lock(&g_classes_lock);
+	for (jc=g_classes; jc!=NULL; jc=jc->next) {
+		if ((*env)->IsSameObject(env, jc->cls, cls)) {
+			pthread_mutex_unlock(&g_classes_lock);
+			return jc;
+		}
+	}
+	jc = createJavaClass(env, cls);
+	if (jc != NULL) {
+		jc->next = g_classes;
+		g_classes = jc;
+	}
+	pthread_mutex_unlock(&g_classes_lock);
+	return jc;
+}
+
+static void javaMethodBridge(void *udd, const char *fmt, void *argv[], void **res, res_type_t *res_type, size_t *res_len, fn_free_res *free_res) {
+	java_method_ref_t *ref = (java_method_ref_t*)udd;
+	java_method_t *m = ref->m;
+	JNIEnv *env = currentJNIEnv();
+	*res_type = rt_none;
+	*free_res = NULL;
+	if (env == NULL) {
+		return;
+	}
+
+	int nargs = strlen(m->argTypes);
+	int fmtLen = (fmt == NULL) ? 0 : strlen(fmt);
+	if ((*env)->PushLocalFrame(env, nargs + 4) != 0) {
+		return;
+	}
+	jvalue stackArgs[8];
+	jvalue *v = (nargs <= 8) ? stackArgs : (jvalue*)malloc(sizeof(jvalue) * nargs);
+	if (v == NULL) {
+		(*env)->PopLocalFrame(env, NULL);
+		return;
+	}
+
+	int i, j;
+	for (i=0, j=0; i<nargs; i++) {
+		char f = (i < fmtLen) ? fmt[i] : af_none;
+		char t = m->argTypes[i];
+		double d;
+		jobject o;
+		switch (t) {
+		case 'Z': case 'B': case 'C': case 'S': case 'I': case 'J': case 'F': case 'D':
+			d = toJavaDouble(f, argv, &j);
+			if (d != d) {
+				d = 0.0; // NaN
+			}
+			switch (t) {
+			case 'Z': v[i].z = (d != 0.0); break;
+			case 'B': v[i].b = (jbyte)d; break;
+			case 'C': v[i].c = (jchar)d; break;
+			case 'S': v[i].s = (jshort)d; break;
+			case 'I': v[i].i = (jint)d; break;
+			case 'J': v[i].j = (jlong)d; break;
+			case 'F': v[i].f = (jfloat)d; break;
+			default:  v[i].d = d; break;
+			}
+			break;
+		default:
+			o = toJavaArg(env, ref->js, f, argv, &j);
+			// only instances of the declared types are transfered
+			if (o != NULL && ((t == 'T' && !(*env)->IsInstanceOf(env, o, jcache.stringClass)) ||
+				(t == 'Y' && !(*env)->IsInstanceOf(env, o, jcache.bytesClass)))) {
+				o = NULL;
+			}
+			v[i].l = o;
+			break;
+		}
+	}
+
+	jclass cls = m->jc->cls;
+	jobject r = NULL;
+	switch (m->retType) {
+	case 'V':
+		(*env)->CallStaticVoidMethodA(env, cls, m->method, v);
+		break;
+	case 'Z':
+		*res = (void*)(long)((*env)->CallStaticBooleanMethodA(env, cls, m->method, v) ? 1 : 0);
+		*res_type = rt_bool;
+		break;
+	case 'B': case 'C': case 'S': case 'I':
+		*res = (void*)(long)(*env)->CallStaticIntMethodA(env, cls, m->method, v);
+		*res_type = rt_int;
+		break;
+	case 'J':
+		*res = double2voidp((double)(*env)->CallStaticLongMethodA(env, cls, m->method, v));
+		*res_type = rt_double;
+		break;
+	case 'F': case 'D':
+		*res = double2voidp((*env)->CallStaticDoubleMethodA(env, cls, m->method, v));
+		*res_type = rt_double;
+		break;
+	default:
+		r = (*env)->CallStaticObjectMethodA(env, cls, m->method, v);
+		break;
+	}
+	if (setJavaException(env, res, res_type, res_len, free_res) == 0 && r != NULL) {
+		fromJavaResult(env, r, res, res_type, res_len, free_res);
+	}
+
+	if (v != stackArgs) {
+		free(v);
+	}
+	(*env)->PopLocalFrame(env, NULL);
+}
+
+static void *javaLoadModule(void *udd, const char *mod_home, const char *mod_name) {
+	java_loader_t *l = (java_loader_t*)udd;
+	JNIEnv *env = currentJNIEnv();
+	if (env == NULL) {
+		return NULL;
+	}
+
+	jstring name = (*env)->NewStringUTF(env, mod_name);
+	jclass cls = (jclass)(*env)->CallObjectMethod(env, l->loader, jcache.loadModule, name);
+	(*env)->DeleteLocalRef(env, name);
+	if ((*env)->ExceptionCheck(env)) {
+		(*env)->ExceptionClear(env);
+		return NULL;
+	}
+	if (cls == NULL) {
+		return NULL;
+	}
+
+	java_class_t *jc = getJavaClass(env, cls);
+	java_module_t *mod = (jc == NULL) ? NULL : (java_module_t*)malloc(sizeof(java_module_t));
+	if (mod == NULL) {
+		(*env)->DeleteLocalRef(env, cls);
+		return NULL;
+	}
+
+	// only the instance is bound, the methods are resolved in the cached class.
+	int i, n = jc->nMethods;
+	mod->methods = (module_method_t*)calloc(n+1, sizeof(module_method_t));
+	if (mod->methods == NULL) {
+		free(mod);
+		(*env)->DeleteLocalRef(env, cls);
+		return NULL;
+	}
+	for (i=0; i<n; i++) {
+		java_method_ref_t *ref = (java_method_ref_t*)malloc(sizeof(java_method_ref_t));
+		if (ref == NULL) {
+			while (--i >= 0) {
+				free(mod->methods[i].udd);
+			}
+			free(mod->methods);
+			free(mod);
+			(*env)->DeleteLocalRef(env, cls);
+			return NULL;
+		}
+		ref->m = jc->methods + i;
+		ref->js = l->js;
+		mod->methods[i].name = jc->methods[i].name;
+		mod->methods[i].method = javaMethodBridge;
+		mod->methods[i].nargs = strlen(jc->methods[i].argTypes);
+		mod->methods[i].udd = ref;
+		mod->methods[i].free_udd = free; // the cached class is never unloaded, so a detached method is still callable
+	}
+	mod->loader = l;
+	mod->cls = (jclass)(*env)->NewGlobalRef(env, cls);
+	(*env)->DeleteLocalRef(env, cls);
+	return mod;
+}
+
+static module_method_t *javaGetMethodsList(void *udd, const char *mod_name, void *mod_handle) {
+	java_module_t *mod = (java_module_t*)mod_handle;
+	return mod->methods;
+}
+
+static void javaFinalizeModule(void *udd, const char *mod_name, void *mod_handle) {
+	java_module_t *mod = (java_module_t*)mod_handle;
+	JNIEnv *env = currentJNIEnv();
+	if (env != NULL) {
+		jstring name = (mod_name == NULL) ? NULL : (*env)->NewStringUTF(env, mod_name);
+		(*env)->CallVoidMethod(env, mod->loader->loader, jcache.finalizeModule, name, mod->cls);
+		if ((*env)->ExceptionCheck(env)) {
+			(*env)->ExceptionClear(env);
+		}
+		if (name != NULL) {
+			(*env)->DeleteLocalRef(env, name);
+		}
+		(*env)->DeleteGlobalRef(env, mod->cls);
+	}
+	free(mod->methods); // the udd of methods are freed by their JS functions
+	free(mod);
 }
 
 /*
@@ -347,5 +1517,19 @@ JNIEXPORT void JNICALL Java_DukBridge_jsUnregisterJavaFunc(JNIEnv *env, jobject
  */
 JNIEXPORT jint JNICALL Java_DukBridge_jsAddModuleLoader(JNIEnv *env, jobject obj, jlong jsEnv, jobject nativeModuleLoader)
 {
-	return -1;
+	jenv_t *e = (jenv_t*)jsEnv;
+	if (nativeModuleLoader == NULL) {
+		return -1;
+	}
+	java_loader_t *l = (java_loader_t*)malloc(sizeof(java_loader_t));
+	if (l == NULL) {
+		return -1;
+	}
+	l->loader = (*env)->NewGlobalRef(env, nativeModuleLoader);
+	l->js = e->js;
+	l->next = e->loaders;
+	e->loaders = l;
+
+	js_add_module_loader(e->js, l, "class", javaLoadModule, javaGetMethodsList, NULL, javaFinalizeModule);
+	return 0;
 }
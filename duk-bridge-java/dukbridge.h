@@ -23,6 +23,14 @@ JNIEXPORT jlong JNICALL Java_DukBridge_jsCreateEnv
 JNIEXPORT void JNICALL Java_DukBridge_jsDestroyEnv
   (JNIEnv *, jobject, jlong);
 
+/*
+ * Class:     DukBridge
+ * Method:    jsGetHeapStats
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_DukBridge_jsGetHeapStats
+  (JNIEnv *, jobject, jlong);
+
 /*
  * Class:     DukBridge
  * Method:    jsSetFileReader
@@ -74,23 +82,79 @@ JNIEXPORT void JNICALL Java_DukBridge_jsUnregisterFunc
 /*
  * Class:     DukBridge
  * Method:    jsCallFunc
- * Signature: (JLjava/lang/String;Ljava/lang/String;[Ljava/lang/Object;)Ljava/lang/Object;
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Ljava/lang/Object;
  */
 JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFunc
-  (JNIEnv *, jobject, jlong, jstring, jstring, jobjectArray);
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject);
 
 /*
  * Class:     DukBridge
  * Method:    jsCallFileFunc
- * Signature: (JLjava/lang/String;Ljava/lang/String;[Ljava/lang/Object;)Ljava/lang/Object;
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Ljava/lang/Object;
  */
 JNIEXPORT jobject JNICALL Java_DukBridge_jsCallFileFunc
-  (JNIEnv *, jobject, jlong, jstring, jstring, jobjectArray);
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncDouble
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)D
+ */
+JNIEXPORT jdouble JNICALL Java_DukBridge_jsCallFuncDouble
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncLong
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)J
+ */
+JNIEXPORT jlong JNICALL Java_DukBridge_jsCallFuncLong
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncBoolean
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_DukBridge_jsCallFuncBoolean
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsEvalDouble
+ * Signature: (J[B)D
+ */
+JNIEXPORT jdouble JNICALL Java_DukBridge_jsEvalDouble
+  (JNIEnv *, jobject, jlong, jbyteArray);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsEvalBuffer
+ * Signature: (JLjava/nio/ByteBuffer;)Ljava/lang/Object;
+ */
+JNIEXPORT jobject JNICALL Java_DukBridge_jsEvalBuffer
+  (JNIEnv *, jobject, jlong, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFuncBuffer
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;Ljava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_DukBridge_jsCallFuncBuffer
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject, jobject);
+
+/*
+ * Class:     DukBridge
+ * Method:    jsCallFileFuncBuffer
+ * Signature: (JLjava/lang/String;Ljava/lang/String;Ljava/lang/Object;Ljava/nio/ByteBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_DukBridge_jsCallFileFuncBuffer
+  (JNIEnv *, jobject, jlong, jstring, jstring, jobject, jobject);
 
 /*
  * Class:     DukBridge
  * Method:    jsRegisterJavaFunc
- * Signature: (JLjava/lang/String;LNativeFunc;)I
+ * Signature: (JLjava/lang/String;Ljava/lang/Object;)I
  */
 JNIEXPORT jint JNICALL Java_DukBridge_jsRegisterJavaFunc
   (JNIEnv *, jobject, jlong, jstring, jobject);
@@ -25,7 +25,8 @@ typedef enum {
 	af_jobject = 'o',
 	af_ecmafunc= 'F',
 	af_error   = 'E',
-	af_mobject = 'O'
+	af_mobject = 'O',
+	af_xbuffer = 'X'
 } arg_format_t;
 
 /** type value for describe fn_native_func() argument `res` */
@@ -66,16 +67,97 @@ typedef void (*fn_call_func_res)(void *udd, res_type_t res_type, void *res, size
  * to create a environment of JS. the returned result will be used as an argument of the other functions.
  * @param mod_path   the path with a subdir of `modules` (`mod_path`/modules) to store the js modules. 
  *                   If NULL is given, the dir path of the executive will be used.
+ *                   If there is a bundle `mod_path`/modules.bundle, it is mounted.
  * @return  the JS environment.
  */
 void* js_create_env(const char *mod_path);
 
+/**
+ * prototype of a function to receive the result of warming a module.
+ * @param udd         argument when calling js_warm_modules_wait()
+ * @param mod_id      the module id
+ * @param mod_file    the module file
+ * @param status      0 if warmed, -1 if the file is not found, -2 if it has syntax error
+ * @param read_us     microseconds to read the file
+ * @param compile_us  microseconds to compile the module
+ */
+typedef void (*fn_warm_report)(void *udd, const char *mod_id, const char *mod_file, int status, long read_us, long compile_us);
+
+/**
+ * to warm the modules required by a script in background. the modules required by `require('...')`
+ * literals are found from entry_script recursively, and compiled to the code cache shared by all the envs,
+ * so `require()` in envs created with the same mod_path needn't compile them.
+ * @param mod_path      the mod_path of envs, see js_create_env()
+ * @param entry_script  the script file to find the required modules
+ * @param nthreads      count of threads to read and compile modules, <=0 for the default count
+ * @return the handle to wait for the warming, NULL if failed.
+ */
+void *js_warm_modules(const char *mod_path, const char *entry_script, int nthreads);
+
+/**
+ * to wait for the warming to finish.
+ * @param warm    the result of js_warm_modules()
+ * @param report  the function to receive the result of every module, NULL if not needed
+ * @param udd     argument which will be transfered to report()
+ * @return count of modules warmed
+ */
+int js_warm_modules_wait(void *warm, fn_warm_report report, void *udd);
+
+/**
+ * to invalidate a module required in the env, so it is loaded again by the next `require(id)`
+ * with the latest file. modules holding the exports of the module are not changed.
+ * a module in the mounted bundle takes precedence over its file, and a .so module is kept loaded
+ * by dlopen() for all the envs, so they are not invalidated.
+ * @param env   the result when calling js_create_env()
+ * @param id    the resolved module id, e.g. "lib/a"
+ * @return 0 if the module was loaded, -2 if the module is in the mounted bundle or a .so module, otherwise <0
+ */
+int js_invalidate_module(void *env, const char *id);
+
+/**
+ * to watch the changes of .js files in `mod_path`/modules/ and its subdirs, with inotify.
+ * .so modules can't be reloaded, so their changes are not watched.
+ * @param mod_path  the mod_path of envs, see js_create_env()
+ * @return the watcher, NULL if failed or not supported.
+ */
+void *js_watch_modules(const char *mod_path);
+
+/**
+ * to stop watching, envs must not call js_apply_module_changes() with the watcher after it.
+ * @param watcher  the result of js_watch_modules()
+ */
+void js_unwatch_modules(void *watcher);
+
+/**
+ * to invalidate the modules changed since the last calling, with js_invalidate_module().
+ * it must be called in the thread using the env, e.g. before running a job. it is cheap if nothing changed.
+ * the changes of modules in the mounted bundle are ignored, rebuild the bundle to change them.
+ * @param env      the result when calling js_create_env()
+ * @param watcher  the result of js_watch_modules()
+ * @return count of loaded modules invalidated
+ */
+int js_apply_module_changes(void *env, void *watcher);
+
 /**
  * to destroy the JS environment.
  * @param env   the result when calling js_create_env()
  */
 void js_destroy_env(void *env);
 
+/** memory stats of an env */
+typedef struct {
+	size_t heap_bytes;  // bytes allocated by the Duktape heap now
+	size_t peak_bytes;  // max of heap_bytes
+	size_t alloc_count; // count of allocations, including reallocations
+} env_stats_t;
+
+/**
+ * get the memory stats of an env. it can be called by any thread while the env is not destroyed.
+ * @param env     the result when calling js_create_env()
+ * @param stats   [OUT] the stats
+ */
+void js_get_env_stats(void *env, env_stats_t *stats);
+
 /**
  * destroy ecmascript object. it is used as a base of some macros
  * @param env       the result when calling js_create_env()
@@ -98,6 +180,55 @@ typedef int (*fn_read_file)(const char *file_name, char **content, size_t *len);
  */
 void js_set_readfile(fn_read_file read_file);
 
+/**
+ * prototype of a function to free the content returned by fn_read_file.
+ * @param content     the content returned by fn_read_file
+ * @param len         the bytes length of the content
+ */
+typedef void (*fn_free_file)(char *content, size_t len);
+
+/**
+ * same as js_set_readfile(), but the content is freed by calling free_file() instead of free(),
+ * so read_file can return memory other than malloc()ed, e.g. a mmap()ed view.
+ * the default implementation maps large script files into memory, which are compiled without copying
+ * and must not be truncated meanwhile. module files are always read, as they may be rewritten in place
+ * to be reloaded.
+ * @param read_file  the function to read a file
+ * @param free_file  the function to free the content, NULL to use free()
+ */
+void js_set_readfile_ex(fn_read_file read_file, fn_free_file free_file);
+
+/**
+ * prototype of a function to read a file content for an env.
+ * @param udd         argument when calling js_set_env_readfile()
+ * @param file_name   the name of file to be read
+ * @param content     the pointer to the momery allocated by this function, and will be freed by the calling function.
+ * @param len         the pointer to the bytes length in `content`
+ * @return 0 if succssful, otherwise other value.
+ */
+typedef int (*fn_read_env_file)(void *udd, const char *file_name, char **content, size_t *len);
+
+/**
+ * set the function to read a file in the given env only, which takes precedence over
+ * the one set by js_set_readfile().
+ * @param env        the result when calling js_create_env()
+ * @param read_file  the reader, NULL to use the one set by js_set_readfile()
+ * @param udd        argument which will be transfered to read_file()
+ */
+void js_set_env_readfile(void *env, fn_read_env_file read_file, void *udd);
+
+/**
+ * mount a module bundle built by `cmd/duk-bundle`, which replaces the one mounted before.
+ * modules in the bundle are required without reading `mod_path`/modules/. the bundle is
+ * mapped into memory once and shared by all the envs mounting it, until the file is changed.
+ * a bundle must be replaced by rename instead of being rewritten in place, because the
+ * envs mounting the old one keep reading its mapping.
+ * @param env          the result when calling js_create_env()
+ * @param bundle_file  the bundle file
+ * @return 0 if successfuly, otherwise <0
+ */
+int js_mount_bundle(void *env, const char *bundle_file);
+
 /**
  * declare a variable with a given val, which could be refered by the name `var_name`.
  * @param env          the result when calling js_create_env()
@@ -162,6 +293,8 @@ int js_unregister_func(void *env, const char *func_name);
  *                        'a' -> JS array, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'o' -> JS object, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'F' -> ecmascript function, the corresponding value in argv is an ecmascript function object
+ *                        'X' -> external buffer, the next 2 values in argv are length and address of buffer,
+ *                               which is used by JS without copying, and detached after calling
  * @param argv          arguments describe by fmt.
  * @return 0 if successfuly, otherwise <0
  */
@@ -183,6 +316,8 @@ int js_call_registered_func(void *env, const char *func_name, fn_call_func_res c
  *                        'a' -> JS array, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'o' -> JS object, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'F' -> ecmascript function, the corresponding value in argv is an ecmascript function object
+ *                        'X' -> external buffer, the next 2 values in argv are length and address of buffer,
+ *                               which is used by JS without copying, and detached after calling
  * @param argv          arguments describe by fmt.
  * @return 0 if successfuly, otherwise <0
  */
@@ -199,6 +334,18 @@ int js_call_file_func(void *env, const char *script_file, fn_call_func_res call_
  */
 int js_eval(void *env, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd);
 
+/**
+ * to compile the source of a module to bytecode, which can be saved in a module bundle.
+ * @param env       the result when calling js_create_env()
+ * @param js_code   the source of the module
+ * @param len       the bytes length of js_code
+ * @param file_name the file name of the module in error messages, NULL for "module"
+ * @param call_func_res the function to receive the bytecode as rt_buffer, or the error
+ * @param udd           the UDD which will be sent to call_func_res()
+ * @return 0 if successfuly, otherwise <0
+ */
+int js_dump_module(void *env, const char *js_code, size_t len, const char *file_name, fn_call_func_res call_func_res, void *udd);
+
 /**
  * to evaluate(run) JS code in a file
  * @param env           the result when calling js_create_env()
@@ -268,6 +415,21 @@ typedef void (*fn_native_func)(void *udd, const char* fmt, void *args[], void**
  */
 int js_register_native_func(void *env, const char *func_name, fn_native_func native_func, int param_num, void *udd);
 
+/**
+ * prototype of a function to free the udd of a native function. It is called when the JS function
+ * bridging the native function is finalized, so the udd is valid as long as JS can call the function,
+ * even if the function is unregistered, replaced or detached from its module.
+ * @param udd   the udd of the native function
+ */
+typedef void (*fn_free_udd)(void *udd);
+
+/**
+ * same as js_register_native_func(), but udd is owned by the JS function and freed by calling
+ * free_udd() when the function is finalized, which may be later than js_unregister_native_func().
+ * @param free_udd  the function to free udd, NULL not to free it
+ */
+int js_register_native_func_ex(void *env, const char *func_name, fn_native_func native_func, int param_num, void *udd, fn_free_udd free_udd);
+
 /**
  * to unregister a global function registered by calling js_register_native_func()
  * @param env           the result when calling js_create_env()
@@ -292,6 +454,8 @@ int js_unregister_native_func(void *env, const char *func_name);
  *                        'a' -> JS array, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'o' -> JS object, the next 2 values in argv are length and address of a string encoded in JSON
  *                        'F' -> ecmascript function, the corresponding value in argv is an ecmascript function object
+ *                        'X' -> external buffer, the next 2 values in argv are length and address of buffer,
+ *                               which is used by JS without copying, and detached after calling
  * @param argv          arguments describe by fmt.
  * @return 0 if successfuly, otherwise <0
  */
@@ -314,6 +478,7 @@ typedef struct {
 	fn_native_func method;  // the native method 
 	int nargs;              // the number of arguments of the method, <0 if the method supports variadic arguments
 	void *udd;              // the udd transfered to method arguments
+	fn_free_udd free_udd;   // the function to free udd when the method is finalized, NULL if udd is not owned by the method
 } module_method_t;
 
 /** module attribute definition */
@@ -324,6 +489,15 @@ typedef struct {
 	size_t val_len;   // the length of bytes in val
 } module_attr_t;
 
+/** module accessor definition, an attribute whose value is got/set by calling native functions */
+typedef struct {
+	const char *name;       // attribute name to refered in the format `mod_name`.`name`
+	fn_native_func getter;  // called with no argument when the attribute is read
+	fn_native_func setter;  // called with 1 argument when the attribute is assigned, NULL if read only
+	void *udd;              // the udd transfered to getter/setter
+	fn_free_udd free_udd;   // the function to free udd when both getter and setter are finalized, NULL if udd is not owned by them
+} module_accessor_t;
+
 /**
  * prototype of loading module. this function is called by a module loader.
  * @param udd        argument when calling js_add_module_loader()
@@ -359,6 +533,8 @@ typedef void (*fn_module_finalizer)(void *udd, const char *mod_name, void *mod_h
 
 /**
  * to register a module loader. module loaders will be called when calling `require(mod_name)` in JS.
+ * if the extension of mod_name is the mod_ext of some loaders, only they are called. otherwise all
+ * the loaders are called in the order of registering until one of them loads the module.
  * @param env              the result when calling js_create_env()
  * @param udd              argument which will be transfered to load_moudle()/get_methods_list()/get_attrs_list()/finalizer()
  * @param mod_ext          the module file extension for this module loader
@@ -383,6 +559,14 @@ void js_add_module_method(void *env, module_method_t *method);
  */
 void js_add_module_attr(void *env, module_attr_t *attr);
 
+/**
+ * a helper function which will be used to attach ONE accessor to a module in get_attrs_list().
+ * The value is not converted until the attribute is read or assigned in JS.
+ * @param env       the result when calling js_create_env()
+ * @param accessor  the accessor description
+ */
+void js_add_module_accessor(void *env, module_accessor_t *accessor);
+
 /**
  * create a ecmascript module instance which can be used as a ecmascript function arguement
  * or as a returned value of native function.
@@ -405,6 +589,187 @@ typedef int (*fn_create_ecmascript_instance)(void *env, void *udd);
  */
 int js_create_ecmascript_object(void *env, void *udd, void *mod_handle, fn_get_methods_list get_methods_list, fn_get_attrs_list get_attrs_list, fn_module_finalizer finalizer);
 
+/**
+ * prototype of a function to initialize every env of an executor, e.g. to register functions.
+ * it is called in the thread owning the env.
+ * @param udd   the `init_udd` argument when calling js_create_executor()
+ * @param env   the env to be initialized
+ */
+typedef void (*fn_executor_init)(void *udd, void *env);
+
+/**
+ * prototype of a job run by an executor with the env owned by the running thread.
+ * @param udd   the `udd` argument when calling js_executor_submit()
+ * @param env   the env which must not be used after the job returns
+ */
+typedef void (*fn_executor_job)(void *udd, void *env);
+
+/**
+ * to create an executor, which has a pool of threads each owning an env initialized by init().
+ * jobs submitted are queued to the threads round robin, and a thread with nothing to do steals
+ * half of the jobs queued to a busy one, so jobs with uneven time don't wait for long.
+ * @param mod_path    the mod_path of the envs, see js_create_env()
+ * @param nthreads    count of threads and envs, <=0 for the count of CPUs
+ * @param queue_size  max count of jobs waiting in all the queues, <=0 for 16 times nthreads
+ * @param init        the function to initialize every env, NULL if none
+ * @param init_udd    argument which will be transfered to init()
+ * @return the executor, NULL if failed.
+ */
+void *js_create_executor(const char *mod_path, int nthreads, int queue_size, fn_executor_init init, void *init_udd);
+
+/**
+ * to destroy an executor. jobs in the queue are run before the threads exit. the submitters
+ * blocked by a full queue fail, and it returns after they leave, so no job may be submitted
+ * once it's called.
+ * @param executor  the result of js_create_executor()
+ */
+void js_destroy_executor(void *executor);
+
+/**
+ * to submit a job, which blocks while the queue is full. a job of the executor may submit jobs
+ * to it, which fail instead of blocking, but must not wait for them to finish: the job waited for
+ * may be pinned to the same thread, or be left in the queue while every thread is waiting.
+ * @param executor  the result of js_create_executor()
+ * @param func      the job
+ * @param udd       argument which will be transfered to func()
+ * @return 0 if submitted, -3 if the queue is full and the caller is a job of the executor,
+ *         other <0 if the executor is destroyed
+ */
+int js_executor_submit(void *executor, fn_executor_job func, void *udd);
+
+/**
+ * to submit a job which must run with the env of a thread, e.g. to use the state kept in the env.
+ * it is never stolen by other threads.
+ * @param worker  index of the thread, 0 <= worker < nthreads, see js_executor_worker(). <0 for any thread
+ * @return 0 if submitted, <0 if the executor is destroyed or worker is out of range
+ */
+int js_executor_submit_to(void *executor, int worker, fn_executor_job func, void *udd);
+
+/**
+ * to submit a job evaluating JS code, like js_eval(). js_code is copied.
+ * call_func_res is called in the thread running the job.
+ * @return 0 if submitted, otherwise <0
+ */
+int js_executor_eval(void *executor, const char *js_code, size_t len, fn_call_func_res call_func_res, void *udd);
+
+/**
+ * to submit a job calling a function registered by init(), like js_call_registered_func().
+ * fmt and argv must be valid until call_func_res is called in the thread running the job.
+ * @return 0 if submitted, otherwise <0
+ */
+int js_executor_call(void *executor, const char *func_name, fn_call_func_res call_func_res, void *udd, char *fmt, void *argv[]);
+
+/**
+ * get the index of the executor thread calling it, e.g. in init() or a job.
+ * @return the index of thread, -1 if the caller is not a thread of an executor
+ */
+int js_executor_worker(void);
+
+/**
+ * like js_executor_worker(), but only for the threads of the executor.
+ * @return the index of thread, -1 if the caller is not a thread of the executor
+ */
+int js_executor_worker_of(void *executor);
+
+/** the utilization of an executor thread */
+typedef struct {
+	unsigned long jobs;         // count of jobs run
+	unsigned long stolen;       // count of jobs stolen from other threads
+	unsigned long long busy_us; // time of running jobs in microseconds
+	unsigned long long up_us;   // time since the thread started in microseconds
+	int queued;                 // count of jobs waiting in the queues of the thread
+} executor_stats_t;
+
+/**
+ * get the utilization of every thread of an executor.
+ * @param stats   [OUT] the stats of thread i is saved in stats[i]
+ * @param n       count of items of stats
+ * @return count of threads
+ */
+int js_executor_stats(void *executor, executor_stats_t *stats, int n);
+
+/**
+ * to enable the event loop of an env, which adds setTimeout()/setInterval()/clearTimeout()/clearInterval()
+ * to JS. timers and async operations are run by js_run_once() or js_run_loop() in the thread using the env.
+ * @param env   the result when calling js_create_env()
+ * @return 0 if successful, otherwise < 0.
+ */
+int js_enable_loop(void *env);
+
+/**
+ * to run the timers expired and the async operations completed, waiting for one of them if none is ready.
+ * @param env         the env with the event loop enabled
+ * @param timeout_ms  the max time to wait, 0 not to wait, <0 to wait until one is ready
+ * @param on_error    called with rt_error for every error thrown by a timer, NULL if not cared
+ * @param udd         argument which will be transfered to on_error()
+ * @return count of timers and async operations pending, <0 if the event loop is not enabled.
+ */
+int js_run_once(void *env, int timeout_ms, fn_call_func_res on_error, void *udd);
+
+/**
+ * to run the event loop until no timers and async operations are pending.
+ * @return 0 if finished, <0 if the event loop is not enabled.
+ */
+int js_run_loop(void *env, fn_call_func_res on_error, void *udd);
+
+/**
+ * prototype of a task to complete an async operation, run by the event loop with the env.
+ * e.g. calling the ecmascript callback with js_call_ecmascript_func() and destroying it.
+ * @param udd   the `udd` argument when calling js_loop_complete()
+ * @param env   the env running the event loop
+ */
+typedef void (*fn_loop_task)(void *udd, void *env);
+
+/**
+ * to start an async operation, e.g. in a native function before starting I/O in another thread.
+ * the event loop keeps running until it is completed by js_loop_complete().
+ * @param env   the env with the event loop enabled
+ * @return the handle of the operation, NULL if the event loop is not enabled.
+ */
+void *js_loop_async(void *env);
+
+/**
+ * to complete an async operation, it can be called by any thread and exactly once for every
+ * js_loop_async(). task is run by the event loop later. the env must not be destroyed before it.
+ * @param async  the result of js_loop_async()
+ * @param task   the task to be run with the env
+ * @param udd    argument which will be transfered to task()
+ * @return 0 if successful, otherwise < 0.
+ */
+int js_loop_complete(void *async, fn_loop_task task, void *udd);
+
+/**
+ * prototype of an async native function, which returns at once and leaves the work to other threads.
+ * JS gets a Promise settled by js_resolve_async() with completion.
+ * @param udd         the `udd` argument when calling js_register_async_native_func()
+ * @param fmt         the same as fn_native_func
+ * @param args        the same as fn_native_func, valid only until the function returns. a JS function
+ *                    argument is destroyed after the function returns too
+ * @param completion  the handle to settle the Promise, js_resolve_async() must be called once with it
+ */
+typedef void (*fn_async_native_func)(void *udd, char *fmt, void *args[], void *completion);
+
+/**
+ * to register a global async native function returning a Promise. the event loop of the env is enabled,
+ * and a small Promise is added to JS if it has none. the Promise is settled when the loop is run.
+ * @param env         the result when calling js_create_env()
+ * @param func_name   the name of the function
+ * @param native_func the async native function
+ * @param param_num   count of arguments, <0 for variable arguments
+ * @param udd         argument which will be transfered to native_func()
+ * @return 0 if successful, otherwise < 0.
+ */
+int js_register_async_native_func(void *env, const char *func_name, fn_async_native_func native_func, int param_num, void *udd);
+
+/**
+ * to settle the Promise of an async native function. it can be called by any thread, the result
+ * is copied. rt_error rejects the Promise with an Error of the message in res, other result types
+ * except rt_func/rt_mobject resolve it like the result of fn_native_func.
+ * @param completion  the argument of fn_async_native_func
+ * @return 0 if successful, otherwise < 0.
+ */
+int js_resolve_async(void *completion, res_type_t res_type, void *res, size_t res_len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,3 @@
 module github.com/rosbit/duktape-bridge
 
-go 1.17
+go 1.20